@@ -22,7 +22,6 @@
 	not be applied to this library, at least for now. There is a list of unimplemented features placed
 	below
 
-	\todo Implement support of char literals
 	\todo Improve existing performance for massive input files
 	\todo Add support of integral literals like L, u, etc
 	\todo Implement built-in directives like #pragma, #error and others
@@ -38,11 +37,36 @@
 #include <algorithm>
 #include <tuple>
 #include <stack>
+#include <map>
 #include <unordered_set>
 #include <unordered_map>
 #include <cctype>
 #include <sstream>
 #include <memory>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+	#include <io.h>
+	#include <direct.h>
+	#include <process.h>
+	#include <sys/utime.h>
+#else
+	#include <dirent.h>
+	#include <unistd.h>
+	#include <utime.h>
+#endif
 
 
 ///< Library's configs
@@ -61,6 +85,11 @@
 
 namespace tcpp
 {
+	struct TTokensBuffer;
+
+	using TTokensBufferSharedPtr = std::shared_ptr<const TTokensBuffer>;
+
+
 	/*!
 		interface IInputStream
 
@@ -76,10 +105,18 @@ namespace tcpp
 
 			virtual std::string ReadLine() TCPP_NOEXCEPT = 0;
 			virtual bool HasNextLine() const TCPP_NOEXCEPT = 0;
+
+			/*!
+				\brief The method returns already scanned tokens of the stream if there are some. In that case
+				the lexer replays them instead of reading lines
+			*/
+
+			virtual TTokensBufferSharedPtr GetTokensBuffer() const TCPP_NOEXCEPT { return nullptr; }
 	};
 
 	
 	using TInputStreamUniquePtr = std::unique_ptr<IInputStream>;
+	using TContentSharedPtr = std::shared_ptr<const std::string>;
 
 
 	/*!
@@ -134,7 +171,6 @@ namespace tcpp
 		QUOTES,
 		KEYWORD,
 		END,
-		REJECT_MACRO, ///< Special type of a token to provide meta information 
 		STRINGIZE_OP,
 		CONCAT_OP,
 		NUMBER,
@@ -158,6 +194,14 @@ namespace tcpp
 		COMMENTARY,
 		UNKNOWN,
 		ELLIPSIS,
+		STRING_LITERAL,
+		CHAR_LITERAL,
+		PERCENT,
+		CARET,
+		TILDE,
+		QUESTION,
+		COLON,
+		PRAGMA,
 	};
 
 
@@ -175,9 +219,70 @@ namespace tcpp
 
 		size_t mLineId;
 		size_t mPos;
+
+		uint32_t mHideSetId = 0; ///< Macros which produced the token and shouldn't be expanded again, see HideSetsTable
 	} TToken, *TTokenPtr;
 
 
+	struct TCompiledExpression;
+
+
+	/*!
+		struct TConditionalDirectiveInfo
+
+		\brief The type describes a conditional directive within a tokens buffer. All the entries of a buffer form 
+		a skeleton of its conditional blocks, so inactive blocks are skipped without looking at their tokens
+	*/
+
+	typedef struct TConditionalDirectiveInfo
+	{
+		size_t mTokenIndex = 0;
+		size_t mNextBranchTokenIndex = 0; ///< #elif, #else or #endif which ends the block after the directive, or amount of tokens
+
+		std::shared_ptr<const TCompiledExpression> mpCondition; ///< The expression of #if or #elif
+	} TConditionalDirectiveInfo, *TConditionalDirectiveInfoPtr;
+
+
+	/*!
+		struct TTokensBuffer
+
+		\brief The structure contains all tokens of a single input stream which were produced by the lexer.
+		Line indices of the tokens are relative to the beginning of the stream, so the buffer can be replayed 
+		at any place
+	*/
+
+	typedef struct TTokensBuffer
+	{
+		std::vector<TToken> mTokens;
+
+		size_t mLinesCount = 0; ///< Amount of source lines which were read to produce the tokens
+
+		std::vector<TConditionalDirectiveInfo> mConditionalDirectives; ///< Sorted by tokens' indices, see BuildConditionalSkeleton
+	} TTokensBuffer, *TTokensBufferPtr;
+
+
+	/*!
+		class TokensInputStream
+
+		\brief The stream doesn't provide any lines but already scanned tokens, which are replayed by the lexer
+	*/
+
+	class TokensInputStream : public IInputStream
+	{
+		public:
+			TokensInputStream() TCPP_NOEXCEPT = delete;
+			explicit TokensInputStream(TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT;
+			virtual ~TokensInputStream() TCPP_NOEXCEPT = default;
+
+			std::string ReadLine() TCPP_NOEXCEPT override;
+			bool HasNextLine() const TCPP_NOEXCEPT override;
+
+			TTokensBufferSharedPtr GetTokensBuffer() const TCPP_NOEXCEPT override;
+		private:
+			TTokensBufferSharedPtr mpTokensBuffer;
+	};
+
+
 	/*!
 		class Lexer
 
@@ -187,8 +292,18 @@ namespace tcpp
 	class Lexer
 	{
 		private:
+			typedef struct TStreamContext
+			{
+				TInputStreamUniquePtr  mpStream;
+				TTokensBufferSharedPtr mpTokensBuffer; ///< Isn't null if the stream's tokens are replayed
+				size_t                 mCurrTokenIndex = 0;
+				size_t                 mFirstLineIndex = 0;
+				size_t                 mNestedLinesCount = 0; ///< Amount of lines that were read from streams which were pushed above this one
+				size_t                 mNextConditionalIndex = 0; ///< The first entry of the buffer's skeleton which is placed after the current token
+			} TStreamContext, *TStreamContextPtr;
+
 			using TTokensQueue = std::list<TToken>;
-			using TStreamStack = std::stack<TInputStreamUniquePtr>;
+			using TStreamStack = std::stack<TStreamContext>;
 			using TDirectivesMap = std::vector<std::tuple<std::string, E_TOKEN_TYPE>>;
 			using TDirectiveHandlersArray = std::unordered_set<std::string>;
 		public:
@@ -212,14 +327,71 @@ namespace tcpp
 
 			void AppendFront(const std::vector<TToken>& tokens) TCPP_NOEXCEPT;
 
+			/*!
+				\brief The method skips the rest of an inactive conditional block without tokenization. Only conditional 
+				directives are recognized to track nesting, so nested blocks are skipped entirely. The lexer stops right
+				before #elif, #else or #endif of the current block or at the end of the active stream
+
+				\return false if the block can't be skipped this way because there are pending tokens
+			*/
+
+			bool SkipInactiveBlock() TCPP_NOEXCEPT;
+
 			void PushStream(TInputStreamUniquePtr stream) TCPP_NOEXCEPT;
+			void PushStream(TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT; ///< Tokens of the buffer are replayed without scanning
 			void PopStream() TCPP_NOEXCEPT;
 
+			/*!
+				\brief The method scans the whole stream using the same configuration as the current lexer has.
+				The result can be cached and passed back later via TokensInputStream
+
+				\param[in] stream An input stream which should be tokenized
+			*/
+
+			TTokensBufferSharedPtr Tokenize(TInputStreamUniquePtr stream) const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method scans the rest of the active stream at once. After that its tokens are replayed 
+				from the returned buffer
+
+				\return A pointer to tokens of the active stream, nullptr if there is no stream
+			*/
+
+			TTokensBufferSharedPtr TokenizeActiveStream() TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method reads the rest of the active stream at once. After that its lines are read from the returned content
+
+				\return A pointer to the content, nullptr if there is no stream or it has been read partially or its tokens are replayed
+			*/
+
+			TContentSharedPtr ReadActiveStream() TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns the compiled expression of #if or #elif which has been just replayed from a tokens buffer
+
+				\return A pointer to the expression, nullptr if the last token isn't such directive or it isn't replayed
+			*/
+
+			std::shared_ptr<const TCompiledExpression> GetPrecompiledCondition() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns a hash of the lexer's configuration (keywords, directives). Tokens that were 
+				produced by lexers with different hashes are incompatible. The hash is updated when custom directives are added
+			*/
+
+			uint64_t GetConfigHash() const TCPP_NOEXCEPT;
+
 			size_t GetCurrLineIndex() const TCPP_NOEXCEPT;
 			size_t GetCurrPos() const TCPP_NOEXCEPT;
+
+			size_t GetStreamsCount() const TCPP_NOEXCEPT; ///< Returns a number of streams which are being read now including the main one
 		private:
 			TToken _getNextTokenInternal(bool ignoreQueue) TCPP_NOEXCEPT;
 
+			TToken _replayNextToken(TStreamContext& context) TCPP_NOEXCEPT;
+			void _skipInactiveTokens(TStreamContext& context) TCPP_NOEXCEPT;
+
 			TToken _scanTokens(std::string& inputLine) TCPP_NOEXCEPT;
 
 			std::string _requestSourceLine() TCPP_NOEXCEPT;
@@ -227,6 +399,10 @@ namespace tcpp
 			TToken _scanSeparatorTokens(char ch, std::string& inputLine) TCPP_NOEXCEPT;
 
 			IInputStream* _getActiveStream() const TCPP_NOEXCEPT;
+
+			bool _isReplayingTokens() const TCPP_NOEXCEPT;
+
+			uint64_t _computeConfigHash() const TCPP_NOEXCEPT;
 		private:
 			static const TToken mEOFToken;
 
@@ -242,1805 +418,7693 @@ namespace tcpp
 			TStreamStack mStreamsContext;
 			
 			TDirectiveHandlersArray mCustomDirectivesMap;
+
+			uint64_t mConfigHash;
 	};
 
 
 	/*!
-		struct TMacroDesc
+		class DiskTokensCache
 
-		\brief The type describes a single macro definition's description
+		\brief The class stores tokens of rarely changed sources within a local directory. Each entry is keyed 
+		by a hash of the source's content and the lexer's configuration. Entries are written in a flat binary format 
+		(a header, fixed-size token records and a strings pool), which is protected with a checksum. Corrupted entries 
+		are removed on load. When the total size of entries exceeds the limit least recently used ones are evicted, the directory
+		is also trimmed on construction.
 	*/
 
-	typedef struct TMacroDesc
+	class DiskTokensCache
 	{
-		std::string mName;
-		std::vector<std::string> mArgsNames;
-		std::vector<TToken> mValue;
-		bool mVariadic = false;
-	} TMacroDesc, *TMacroDescPtr;
+		public:
+			DiskTokensCache() TCPP_NOEXCEPT = delete;
+			DiskTokensCache(const std::string& directory, size_t maxSizeInBytes) TCPP_NOEXCEPT;
+			~DiskTokensCache() TCPP_NOEXCEPT = default;
 
+			/*!
+				\brief The method returns cached tokens of the source if there is a valid entry. Otherwise the source
+				is tokenized by the given lexer and the result is stored into the cache
+			*/
 
-	enum class E_ERROR_TYPE : unsigned int
-	{
-		UNEXPECTED_TOKEN,
-		UNBALANCED_ENDIF,
-		INVALID_MACRO_DEFINITION,
-		MACRO_ALREADY_DEFINED,
-		INCONSISTENT_MACRO_ARITY,
-		UNDEFINED_MACRO,
-		INVALID_INCLUDE_DIRECTIVE,
-		UNEXPECTED_END_OF_INCLUDE_PATH,
-		ANOTHER_ELSE_BLOCK_FOUND,
-		ELIF_BLOCK_AFTER_ELSE_FOUND,
-		UNDEFINED_DIRECTIVE,
-		INCORRECT_OPERATION_USAGE,
-		INCORRECT_STRINGIFY_OPERATOR_USAGE,
-	};
+			TTokensBufferSharedPtr GetTokens(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT;
 
+			TTokensBufferSharedPtr Load(uint64_t key) TCPP_NOEXCEPT;
+			bool Store(uint64_t key, const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT;
 
-	std::string ErrorTypeToString(const E_ERROR_TYPE& errorType) TCPP_NOEXCEPT;
+			void Clear() TCPP_NOEXCEPT;
 
+			static uint64_t ComputeKey(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT;
 
-	/*!
-		struct TErrorInfo
+			size_t GetSize() const TCPP_NOEXCEPT;
+		private:
+			std::string _getEntryPath(uint64_t key) const TCPP_NOEXCEPT;
+		private:
+			mutable std::mutex mMutex;
 
-		\brief The type contains all information about happened error
-	*/
+			std::string mDirectory;
 
-	typedef struct TErrorInfo
-	{
-		E_ERROR_TYPE mType;
-		size_t mLine;
-	} TErrorInfo, *TErrorInfoPtr;
+			size_t mMaxSizeInBytes;
+			size_t mCurrSizeInBytes;
+	};
 
 
 	/*!
-		class Preprocessor
+		class WorkersPool
 
-		\brief The class implements main functionality of C preprocessor. To preprocess
-		some source code string, create an instance of this class and call Process method.
-		The usage of the class is the same as iterators.
+		\brief The class is a simple pool of worker threads which execute submitted tasks in FIFO order.
+		The destructor waits until all submitted tasks are completed
 	*/
 
-	class Preprocessor
+	class WorkersPool
 	{
 		public:
-			using TOnErrorCallback = std::function<void(const TErrorInfo&)>;
-			using TOnIncludeCallback = std::function<TInputStreamUniquePtr(const std::string&, bool)>;
-			using TSymTable = std::vector<TMacroDesc>;
-			using TContextStack = std::list<std::string>;
-			using TDirectiveHandler = std::function<std::string(Preprocessor&, Lexer&, const std::string&)>;
-			using TDirectivesMap = std::unordered_map<std::string, TDirectiveHandler>;
+			using TTask = std::function<void()>;
+		public:
+			WorkersPool() TCPP_NOEXCEPT = delete;
+			WorkersPool(const WorkersPool&) TCPP_NOEXCEPT = delete;
+			explicit WorkersPool(size_t workersCount) TCPP_NOEXCEPT; ///< Passing 0 means amount of hardware threads
+			~WorkersPool() TCPP_NOEXCEPT;
 
-			typedef struct TPreprocessorConfigInfo
+			template <typename TFunc>
+			auto Submit(TFunc&& func) TCPP_NOEXCEPT -> std::shared_future<decltype(func())>
 			{
-				TOnErrorCallback   mOnErrorCallback = {};
-				TOnIncludeCallback mOnIncludeCallback = {};
+				auto pTask = std::make_shared<std::packaged_task<decltype(func())()>>(std::forward<TFunc>(func));
+				auto result = pTask->get_future().share();
 
-				bool               mSkipComments = false; ///< When it's true all tokens which are E_TOKEN_TYPE::COMMENTARY will be thrown away from preprocessor's output
-			} TPreprocessorConfigInfo, *TPreprocessorConfigInfoPtr;
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mTasks.push_back([pTask] { (*pTask)(); });
+				}
 
-			typedef struct TIfStackEntry
-			{
-				bool mShouldBeSkipped = true;
-				bool mHasElseBeenFound = false;
-				bool mHasIfBlockBeenEntered = false;
-				bool mIsParentBlockActive = true;
+				mTasksCondition.notify_one();
 
-				TIfStackEntry(bool shouldBeSkipped, bool isParentBlockActive) :
-					mShouldBeSkipped(shouldBeSkipped),
-					mHasElseBeenFound(false),
-					mHasIfBlockBeenEntered(!shouldBeSkipped),
-					mIsParentBlockActive(isParentBlockActive) {}
-			} TIfStackEntry, *TIfStackEntryPtr;
+				return result;
+			}
 
-			using TIfStack = std::stack<TIfStackEntry>;
-		public:
-			Preprocessor() TCPP_NOEXCEPT = delete;
-			Preprocessor(const Preprocessor&) TCPP_NOEXCEPT = delete;
-			Preprocessor(Lexer& lexer, const TPreprocessorConfigInfo& config) TCPP_NOEXCEPT;
-			~Preprocessor() TCPP_NOEXCEPT = default;
+			size_t GetWorkersCount() const TCPP_NOEXCEPT;
 
-			bool AddCustomDirectiveHandler(const std::string& directive, const TDirectiveHandler& handler) TCPP_NOEXCEPT;
+			WorkersPool& operator= (const WorkersPool&) TCPP_NOEXCEPT = delete;
+		private:
+			void _processTasks() TCPP_NOEXCEPT;
+		private:
+			std::vector<std::thread> mWorkers;
+			std::list<TTask> mTasks;
 
-			std::string Process() TCPP_NOEXCEPT;
+			std::mutex mMutex;
+			std::condition_variable mTasksCondition;
 
-			Preprocessor& operator= (const Preprocessor&) TCPP_NOEXCEPT = delete;
+			bool mIsStopped;
+	};
 
-			TSymTable GetSymbolsTable() const TCPP_NOEXCEPT;
-		private:
-			void _createMacroDefinition() TCPP_NOEXCEPT;
-			void _removeMacroDefinition(const std::string& macroName) TCPP_NOEXCEPT;
 
-			std::vector<TToken> _expandMacroDefinition(const TMacroDesc& macroDesc, const TToken& idToken, const std::function<TToken()>& getNextTokenCallback) const TCPP_NOEXCEPT;
+	/*!
+		struct TCacheStats
 
-			void _expect(const E_TOKEN_TYPE& expectedType, const E_TOKEN_TYPE& actualType) const TCPP_NOEXCEPT;
+		\brief The type contains statistics of some cache's usage
+	*/
 
-			void _processInclusion() TCPP_NOEXCEPT;
+	typedef struct TCacheStats
+	{
+		size_t mHitsCount = 0;
+		size_t mMissesCount = 0;
+	} TCacheStats, *TCacheStatsPtr;
 
-			TIfStackEntry _processIfConditional() TCPP_NOEXCEPT;
-			TIfStackEntry _processIfdefConditional() TCPP_NOEXCEPT;
-			TIfStackEntry _processIfndefConditional() TCPP_NOEXCEPT;
-			void _processElseConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT;
-			void _processElifConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT;
 
-			int _evaluateExpression(const std::vector<TToken>& exprTokens) const TCPP_NOEXCEPT;
+	/*!
+		class LRUCache
 
-			bool _shouldTokenBeSkipped() const TCPP_NOEXCEPT;
+		\brief The class is a container with a limited capacity which evicts least recently used entries. Every entry 
+		has a size in arbitrary units, e.g. bytes or 1 to limit amount of entries. The class isn't thread-safe, owners 
+		are expected to guard it with their own locks. Returned pointers are valid until the next change of the cache
+	*/
+
+	template <typename TKey, typename TValue>
+	class LRUCache
+	{
 		private:
-			Lexer* mpLexer;
+			typedef struct TCacheEntry
+			{
+				TKey   mKey;
+				TValue mValue;
+				size_t mSize;
+			} TCacheEntry, *TCacheEntryPtr;
 
-			TOnErrorCallback   mOnErrorCallback;
-			TOnIncludeCallback mOnIncludeCallback;
+			using TEntriesList = std::list<TCacheEntry>;
+			using TEntriesMap = std::unordered_map<TKey, typename TEntriesList::iterator>;
+		public:
+			LRUCache() TCPP_NOEXCEPT = delete;
+			explicit LRUCache(size_t capacity) TCPP_NOEXCEPT : mCapacity(capacity), mCurrSize(0) {}
+			LRUCache(const LRUCache& cache) TCPP_NOEXCEPT : mEntries(cache.mEntries), mCapacity(cache.mCapacity), mCurrSize(cache.mCurrSize) { _rebuildTable(); }
+			~LRUCache() TCPP_NOEXCEPT = default;
 
-			TSymTable mSymTable;
-			mutable TContextStack mContextStack;
-			TIfStack mConditionalBlocksStack;
-			TDirectivesMap mCustomDirectivesHandlersMap;
+			/*!
+				\brief The method returns the entry's value and marks it as the most recently used one
+			*/
 
-			bool mSkipCommentsTokens;
-	};
+			const TValue* Find(const TKey& key) TCPP_NOEXCEPT
+			{
+				auto it = mEntriesTable.find(key);
+				if (it == mEntriesTable.end())
+				{
+					return nullptr;
+				}
 
+				mEntries.splice(mEntries.begin(), mEntries, it->second); // \note Move the entry to the beginning of LRU list
+				return &it->second->mValue;
+			}
 
-	///< implementation of the library is placed below
-#if defined(TCPP_IMPLEMENTATION)
+			const TValue* Peek(const TKey& key) const TCPP_NOEXCEPT ///< The same as Find but the order of entries isn't changed
+			{
+				auto it = mEntriesTable.find(key);
+				return (it == mEntriesTable.end()) ? nullptr : &it->second->mValue;
+			}
 
+			/*!
+				\brief The method replaces an entry with the same key and evicts least recently used ones while the cache exceeds its capacity
 
-	std::string ErrorTypeToString(const E_ERROR_TYPE& errorType) TCPP_NOEXCEPT
-	{
-		switch (errorType)
-		{
-			case E_ERROR_TYPE::UNEXPECTED_TOKEN:
-				return "Unexpected token";
-			case E_ERROR_TYPE::UNBALANCED_ENDIF:
-				return "Unbalanced endif";
-			case E_ERROR_TYPE::INVALID_MACRO_DEFINITION:
-				return "Invalid macro definition";
-			case E_ERROR_TYPE::MACRO_ALREADY_DEFINED:
-				return "The macro is already defined";
-			case E_ERROR_TYPE::INCONSISTENT_MACRO_ARITY:
-				return "Inconsistent number of arguments between definition and invocation of the macro";
-			case E_ERROR_TYPE::UNDEFINED_MACRO:
-				return "Undefined macro";
-			case E_ERROR_TYPE::INVALID_INCLUDE_DIRECTIVE:
-				return "Invalid #include directive";
-			case E_ERROR_TYPE::UNEXPECTED_END_OF_INCLUDE_PATH:
-				return "Unexpected end of include path";
-			case E_ERROR_TYPE::ANOTHER_ELSE_BLOCK_FOUND:
-				return "#else directive should be last one";
-			case E_ERROR_TYPE::ELIF_BLOCK_AFTER_ELSE_FOUND:
-				return "#elif found after #else block";
-			case E_ERROR_TYPE::UNDEFINED_DIRECTIVE:
-				return "Undefined directive";
-			case E_ERROR_TYPE::INCORRECT_OPERATION_USAGE:
-				return "Incorrect operation usage";
-			case E_ERROR_TYPE::INCORRECT_STRINGIFY_OPERATOR_USAGE:
-				return "Incorrect usage of stringification operation";
-		}
+				\return false if the entry is larger than the capacity, the cache isn't changed in that case
+			*/
 
-		return "";
-	}
+			bool Insert(const TKey& key, TValue value, size_t size) TCPP_NOEXCEPT
+			{
+				if (size > mCapacity)
+				{
+					return false;
+				}
 
+				Remove(key);
 
-	StringInputStream::StringInputStream(const std::string& source) TCPP_NOEXCEPT:
-		IInputStream(), mSourceStr(source)
-	{
-	}
+				mEntries.push_front({ key, std::move(value), size });
+				mEntriesTable[key] = mEntries.begin();
 
-	StringInputStream::StringInputStream(const StringInputStream& inputStream) TCPP_NOEXCEPT:
-		mSourceStr(inputStream.mSourceStr)
-	{
-	}
-	
-	StringInputStream::StringInputStream(StringInputStream&& inputStream) TCPP_NOEXCEPT:
-		mSourceStr(std::move(inputStream.mSourceStr))
-	{
-	}
+				mCurrSize += size;
 
-	std::string StringInputStream::ReadLine() TCPP_NOEXCEPT
-	{
-		std::string::size_type pos = mSourceStr.find_first_of('\n');
-		pos = (pos == std::string::npos) ? pos : (pos + 1);
+				while (mCurrSize > mCapacity && !mEntries.empty())
+				{
+					const TCacheEntry& lastEntry = mEntries.back();
 
-		std::string currLine = mSourceStr.substr(0, pos);
-		mSourceStr.erase(0, pos);
+					mCurrSize -= lastEntry.mSize;
+					mEntriesTable.erase(lastEntry.mKey);
 
-		return currLine;
-	}
+					mEntries.pop_back();
+				}
 
-	bool StringInputStream::HasNextLine() const TCPP_NOEXCEPT
-	{
-		return !mSourceStr.empty();
-	}
+				return true;
+			}
 
-	StringInputStream& StringInputStream::operator= (const StringInputStream& stream) TCPP_NOEXCEPT
-	{
-		mSourceStr = stream.mSourceStr;
-		return *this;
-	}
+			bool Remove(const TKey& key) TCPP_NOEXCEPT
+			{
+				auto it = mEntriesTable.find(key);
+				if (it == mEntriesTable.end())
+				{
+					return false;
+				}
 
-	StringInputStream& StringInputStream::operator= (StringInputStream&& stream) TCPP_NOEXCEPT
-	{
-		mSourceStr = std::move(stream.mSourceStr);
-		return *this;
-	}
+				mCurrSize -= it->second->mSize;
 
+				mEntries.erase(it->second);
+				mEntriesTable.erase(it);
 
-	const TToken Lexer::mEOFToken = { E_TOKEN_TYPE::END };
+				return true;
+			}
 
-	Lexer::Lexer(TInputStreamUniquePtr pIinputStream) TCPP_NOEXCEPT:
-		mDirectivesTable
-		{
-			{ "define", E_TOKEN_TYPE::DEFINE },
-			{ "ifdef", E_TOKEN_TYPE::IFDEF },
-			{ "ifndef", E_TOKEN_TYPE::IFNDEF },
-			{ "if", E_TOKEN_TYPE::IF },
-			{ "else", E_TOKEN_TYPE::ELSE },
-			{ "elif", E_TOKEN_TYPE::ELIF },
-			{ "undef", E_TOKEN_TYPE::UNDEF },
-			{ "endif", E_TOKEN_TYPE::ENDIF },
-			{ "include", E_TOKEN_TYPE::INCLUDE },
-			{ "defined", E_TOKEN_TYPE::DEFINED },
-		}, mCurrLine(), mCurrLineIndex(0)
-	{
-		PushStream(std::move(pIinputStream));
-	}
+			void Clear() TCPP_NOEXCEPT
+			{
+				mEntries.clear();
+				mEntriesTable.clear();
 
-	bool Lexer::AddCustomDirective(const std::string& directive) TCPP_NOEXCEPT
-	{
-		if (mCustomDirectivesMap.find(directive) != mCustomDirectivesMap.cend())
-		{
-			return false;
-		}
+				mCurrSize = 0;
+			}
 
-		mCustomDirectivesMap.insert(directive);
-		return true;
-	}
+			size_t GetSize() const TCPP_NOEXCEPT { return mCurrSize; }
+			size_t GetEntriesCount() const TCPP_NOEXCEPT { return mEntries.size(); }
 
-	TToken Lexer::GetNextToken() TCPP_NOEXCEPT
-	{
-		return _getNextTokenInternal(false);
-	}
+			LRUCache& operator= (const LRUCache& cache) TCPP_NOEXCEPT
+			{
+				mEntries = cache.mEntries;
+				mCapacity = cache.mCapacity;
+				mCurrSize = cache.mCurrSize;
 
-	TToken Lexer::PeekNextToken(size_t offset)
-	{
-		if (!mTokensQueue.empty() && offset < mTokensQueue.size())
-		{
-			return *std::next(mTokensQueue.begin(), offset);
-		}
+				_rebuildTable();
 
-		const size_t count = offset - mTokensQueue.size();
-		for (size_t i = 0; i < count; i++)
-		{
-			mTokensQueue.push_back(_getNextTokenInternal(true));
-		}
+				return *this;
+			}
+		private:
+			void _rebuildTable() TCPP_NOEXCEPT
+			{
+				mEntriesTable.clear();
 
-		if (mTokensQueue.empty())
-		{
-			return GetNextToken();
-		}
+				for (auto it = mEntries.begin(); it != mEntries.end(); ++it)
+				{
+					mEntriesTable[it->mKey] = it;
+				}
+			}
+		private:
+			TEntriesList mEntries; ///< The most recently used entries are placed at the beginning
+			TEntriesMap  mEntriesTable;
 
-		return mTokensQueue.back();
-	}
+			size_t mCapacity;
+			size_t mCurrSize;
+	};
 
-	bool Lexer::HasNextToken() const TCPP_NOEXCEPT
-	{
-		IInputStream* pCurrInputStream = _getActiveStream();
-		return (pCurrInputStream ? pCurrInputStream->HasNextLine() : false) || !mCurrLine.empty() || !mTokensQueue.empty();
-	}
 
-	void Lexer::AppendFront(const std::vector<TToken>& tokens) TCPP_NOEXCEPT
-	{
-		mTokensQueue.insert(mTokensQueue.begin(), tokens.begin(), tokens.end());
-	}
+	/*!
+		class CopyOnWritePtr
 
-	void Lexer::PushStream(TInputStreamUniquePtr stream) TCPP_NOEXCEPT
+		\brief The class holds an object which is shared between copies of its owners, e.g. tables or forks of preprocessors.
+		The object is frozen when it's copied for the first time and isn't changed after that, Detach() gives a private
+		copy to an owner instead. Unlike shared_ptr::use_count the flag is exact, so owners which share the object
+		can be used from different threads
+	*/
+
+	template <typename T>
+	class CopyOnWritePtr
 	{
-		TCPP_ASSERT(stream);
+		private:
+			typedef struct TSharedObject
+			{
+				explicit TSharedObject(const T& object) TCPP_NOEXCEPT : mObject(object), mIsFrozen(false) {}
+				explicit TSharedObject(T&& object) TCPP_NOEXCEPT : mObject(std::move(object)), mIsFrozen(false) {}
 
-		if (!stream)
-		{
-			return;
-		}
+				T                 mObject;
+				std::atomic<bool> mIsFrozen;
+			} TSharedObject, *TSharedObjectPtr;
+		public:
+			CopyOnWritePtr() TCPP_NOEXCEPT : mpObject(std::make_shared<TSharedObject>(T())) {}
+			explicit CopyOnWritePtr(T&& object) TCPP_NOEXCEPT : mpObject(std::make_shared<TSharedObject>(std::move(object))) {}
+			CopyOnWritePtr(const CopyOnWritePtr& ptr) TCPP_NOEXCEPT : mpObject(ptr.mpObject) { mpObject->mIsFrozen = true; }
+			~CopyOnWritePtr() TCPP_NOEXCEPT = default;
 
-		mStreamsContext.push(std::move(stream));
-	}
+			/*!
+				\brief The method returns the object which can be changed. A frozen object is copied before that
+			*/
 
-	void Lexer::PopStream() TCPP_NOEXCEPT
-	{
-		if (mStreamsContext.empty())
-		{
-			return;
-		}
+			T& Detach() TCPP_NOEXCEPT
+			{
+				if (mpObject->mIsFrozen)
+				{
+					mpObject = std::make_shared<TSharedObject>(static_cast<const T&>(mpObject->mObject));
+				}
 
-		mStreamsContext.pop();
-	}
+				return mpObject->mObject;
+			}
 
-	size_t Lexer::GetCurrLineIndex() const TCPP_NOEXCEPT
-	{
-		return mCurrLineIndex;
-	}
+			/*!
+				\brief The method returns true if the object is shared with other owners, so it can be only read
+			*/
 
-	size_t Lexer::GetCurrPos() const TCPP_NOEXCEPT
-	{
-		return mCurrPos;
-	}
+			bool IsFrozen() const TCPP_NOEXCEPT { return mpObject->mIsFrozen; }
 
+			CopyOnWritePtr& operator= (const CopyOnWritePtr& ptr) TCPP_NOEXCEPT
+			{
+				ptr.mpObject->mIsFrozen = true;
+				mpObject = ptr.mpObject;
 
-	static std::tuple<size_t, char> EatNextChar(std::string& str, size_t pos, size_t count = 1)
-	{
-		str.erase(0, count);
-		return { pos + count, str.empty() ? static_cast<char>(EOF) : str.front() };
-	}
+				return *this;
+			}
 
+			/// \note Non-const accessors don't detach the object, changes should be made only after Detach() is called
+			T* operator->() const TCPP_NOEXCEPT { return &mpObject->mObject; }
+			T& operator*() const TCPP_NOEXCEPT { return mpObject->mObject; }
+		private:
+			std::shared_ptr<TSharedObject> mpObject;
+	};
 
-	static char PeekNextChar(const std::string& str, size_t step = 1)
-	{
-		return (step < str.length()) ? str[step] : static_cast<char>(EOF);
-	}
 
+	/*!
+		class TokensCache
 
-	static std::string ExtractSingleLineComment(const std::string& currInput) TCPP_NOEXCEPT
+		\brief The class is a thread-safe in-memory cache of tokens buffers. Entries are keyed either by an identity
+		of a file (e.g. its resolved path) or by a hash of the file's content, both combined with the lexer's configuration.
+		Buffers are immutable, so they can be shared between preprocessors and threads. When the size of all
+		buffers exceeds the memory budget least recently used ones are evicted.
+	*/
+
+	class TokensCache
 	{
-		std::stringstream ss(currInput);
-		std::string commentStr;
+		public:
+			using TStreamFactory = std::function<TInputStreamUniquePtr()>;
+		public:
+			TokensCache() TCPP_NOEXCEPT = delete;
+			explicit TokensCache(size_t memoryBudgetInBytes) TCPP_NOEXCEPT;
+			~TokensCache() TCPP_NOEXCEPT = default;
 
-		std::getline(ss, commentStr, '\n');
-		return commentStr;
-	}
+			/*!
+				\brief The method returns tokens of the source, the entry's key is the content's hash
+			*/
 
+			TTokensBufferSharedPtr GetTokens(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT;
 
-	static std::string ExtractMultiLineComments(std::string& currInput, const std::function<std::string()>& requestNextLineFunctor) TCPP_NOEXCEPT
-	{
-		std::string input = currInput;
-		std::string commentStr;
+			/*!
+				\brief The method returns tokens of a file with the given identity. The stream is requested from the 
+				factory only when there is no cached entry
+			*/
 
-		// \note here below all states of DFA are placed
-		std::function<std::string(std::string&)> enterCommentBlock = [&enterCommentBlock, &commentStr, requestNextLineFunctor](std::string& input)
-		{
-			commentStr.append(input.substr(0, 2));
-			input.erase(0, 2); // \note remove /*
+			TTokensBufferSharedPtr GetTokens(const std::string& fileIdentity, const Lexer& lexer, const TStreamFactory& streamFactory) TCPP_NOEXCEPT;
 
-			while (input.rfind("*/", 0) != 0 && !input.empty())
-			{
-				commentStr.push_back(input.front());
-				input.erase(0, 1);
+			void Invalidate(const std::string& fileIdentity, const Lexer& lexer) TCPP_NOEXCEPT;
+			void Clear() TCPP_NOEXCEPT;
 
-				if (input.rfind("//", 0) == 0)
-				{
-					commentStr.append(input.substr(0, 2));
-					input.erase(0, 2);
-				}
+			size_t GetSize() const TCPP_NOEXCEPT;
+			TCacheStats GetStats() const TCPP_NOEXCEPT;
+		private:
+			TTokensBufferSharedPtr _find(const std::string& key) TCPP_NOEXCEPT;
+			void _insert(const std::string& key, TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT;
+		private:
+			mutable std::mutex mMutex;
 
-				if (input.rfind("/*", 0) == 0)
-				{
-					input = enterCommentBlock(input);
-				}
+			LRUCache<std::string, TTokensBufferSharedPtr> mEntries;
 
-				if (input.empty() && requestNextLineFunctor)
-				{
-					input = requestNextLineFunctor();
-				}
-			}
+			TCacheStats mStats;
+	};
 
-			commentStr.append(input.substr(0, 2));
-			input.erase(0, 2); // \note remove */
 
-			return input;
-		};
+	/*!
+		class SharedContentInputStream
 
-		std::string::size_type pos = input.find("/*");
-		if (pos != std::string::npos)
-		{
-			std::string restStr = input.substr(pos, std::string::npos);
-			enterCommentBlock(restStr);
+		\brief The class reads lines of an immutable content which can be shared between many streams and threads
+	*/
 
-			currInput = commentStr + restStr;
-			
-			return commentStr;
-		}
+	class SharedContentInputStream : public IInputStream
+	{
+		public:
+			SharedContentInputStream() TCPP_NOEXCEPT = delete;
+			explicit SharedContentInputStream(TContentSharedPtr pContent) TCPP_NOEXCEPT;
+			virtual ~SharedContentInputStream() TCPP_NOEXCEPT = default;
 
-		return commentStr;
-	}
+			std::string ReadLine() TCPP_NOEXCEPT override;
+			bool HasNextLine() const TCPP_NOEXCEPT override;
+		private:
+			TContentSharedPtr mpContent;
+			size_t            mCurrPos;
+	};
 
 
-	TToken Lexer::_getNextTokenInternal(bool ignoreQueue) TCPP_NOEXCEPT
-	{
-		if (!ignoreQueue && !mTokensQueue.empty())
-		{
-			auto currToken = mTokensQueue.front();
-			mTokensQueue.pop_front();
+	/*!
+		class IncludeContentCache
 
-			return currToken;
-		}
+		\brief The class is a process-wide thread-safe cache of files' contents. Contents are immutable and shared 
+		between streams, so including the same header from many preprocessors reads it once. Entries are split into 
+		shards with own locks. Each shard evicts least recently used entries when it exceeds its part of the memory budget.
+		An entry is reloaded when the file's modification time or size are changed, or after an explicit invalidation
+	*/
 
-		if (mCurrLine.empty())
-		{
-			// \note if it's still empty then we've reached the end of the source
-			if ((mCurrLine = _requestSourceLine()).empty())
+	class IncludeContentCache
+	{
+		private:
+			typedef struct TCacheEntry
 			{
-				return mEOFToken;
-			}
-		}
+				TContentSharedPtr mpContent;
+				size_t            mSize = 0;
+				time_t            mModificationTime = 0;
+			} TCacheEntry, *TCacheEntryPtr;
 
-		return _scanTokens(mCurrLine);
-	}
+			typedef struct TShard
+			{
+				mutable std::mutex mMutex;
 
-	TToken Lexer::_scanTokens(std::string& inputLine) TCPP_NOEXCEPT
-	{
-		char ch = '\0';
+				LRUCache<std::string, TCacheEntry> mEntries { 0 };
+				TCacheStats mStats;
+			} TShard, *TShardPtr;
+		public:
+			IncludeContentCache() TCPP_NOEXCEPT = delete;
+			IncludeContentCache(const IncludeContentCache&) TCPP_NOEXCEPT = delete;
 
-		static const std::unordered_set<std::string> keywordsMap
-		{
-			"auto", "double", "int", "struct",
-			"break", "else", "long", "switch",
-			"case", "enum", "register", "typedef",
-			"char", "extern", "return", "union",
-			"const", "float", "short", "unsigned",
-			"continue", "for", "signed", "void",
-			"default", "goto", "sizeof", "volatile",
-			"do", "if", "static", "while"
-		};
+			/*!
+				\param[in] checkFileStamps If it's false files aren't checked for modifications, entries are updated only with Invalidate
+			*/
 
-		static const std::string separators = ",()[]<>\"+-*/&|!=;";
+			IncludeContentCache(size_t memoryBudgetInBytes, size_t shardsCount = 16, bool checkFileStamps = true) TCPP_NOEXCEPT;
+			~IncludeContentCache() TCPP_NOEXCEPT = default;
 
-		std::string currStr = "";
+			TContentSharedPtr GetContent(const std::string& path) TCPP_NOEXCEPT; ///< Returns nullptr if the file can't be read
 
-		while (!inputLine.empty())
-		{
-			ch = inputLine.front();
+			/*!
+				\brief The method returns a stream over the cached content of the file, so it can be returned from TOnIncludeCallback
+			*/
 
-			if (ch == '.' && PeekNextChar(inputLine, 1) == '.' && PeekNextChar(inputLine, 2) == '.')
-			{
-				// flush current blob
-				if (!currStr.empty())
-				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
-				}
+			TInputStreamUniquePtr OpenStream(const std::string& path) TCPP_NOEXCEPT;
 
-				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, 3));
-				return { E_TOKEN_TYPE::ELLIPSIS, "...", mCurrLineIndex, mCurrPos };
-			}
+			void Invalidate(const std::string& path) TCPP_NOEXCEPT;
+			void Clear() TCPP_NOEXCEPT;
 
-			if (ch == '/')
+			size_t GetSize() const TCPP_NOEXCEPT;
+			TCacheStats GetStats() const TCPP_NOEXCEPT;
+
+			IncludeContentCache& operator= (const IncludeContentCache&) TCPP_NOEXCEPT = delete;
+		private:
+			TShard& _getShard(const std::string& path) const TCPP_NOEXCEPT;
+		private:
+			std::unique_ptr<TShard[]> mpShards;
+			size_t mShardsCount;
+
+			bool mCheckFileStamps;
+	};
+
+
+	/*!
+		struct TMacroBodyChunk
+
+		\brief The type is a part of a precompiled body of a function-like macro. It's either a span of tokens 
+		which are copied as is or a slot of a parameter which is replaced with an argument
+	*/
+
+	typedef struct TMacroBodyChunk
+	{
+		size_t mFirstTokenIndex = 0; ///< Index of the first token within TMacroDesc::mValue, for a slot it's the parameter's token
+		size_t mTokensCount = 0;     ///< 0 means the chunk is a parameter's slot
+
+		size_t mArgIndex = 0;
+
+		bool mIsStringized = false;  ///< The parameter is an operand of # operator
+		bool mIsConcatenated = false; ///< The parameter is an operand of ## operator
+	} TMacroBodyChunk, *TMacroBodyChunkPtr;
+
+
+	/*!
+		struct TMacroDesc
+
+		\brief The type describes a single macro definition's description
+	*/
+
+	typedef struct TMacroDesc
+	{
+		std::string mName;
+		std::vector<std::string> mArgsNames;
+		std::vector<TToken> mValue;
+		bool mVariadic = false;
+		bool mHasImplicitValue = false; ///< True if the macro is defined without a value, mValue contains 1 then
+
+		std::vector<TMacroBodyChunk> mBodyChunks = {}; ///< Precompiled mValue of a function-like macro, see CompileMacroBody
+	} TMacroDesc, *TMacroDescPtr;
+
+
+	/*!
+		\brief The function splits the value of a function-like macro into spans of tokens and parameters' slots,
+		so expansions don't need to look for parameters by their names
+	*/
+
+	std::vector<TMacroBodyChunk> CompileMacroBody(const TMacroDesc& macroDesc) TCPP_NOEXCEPT;
+
+
+	/*!
+		class SymbolsTable
+
+		\brief The class stores macro definitions. Lookups are done with an open addressing hash table which
+		is fronted by a Bloom filter, so most of identifiers that aren't macros are rejected without probing.
+		Definitions are kept in a dense array, the order of its elements isn't preserved after removals.
+		Copies of a table share its state until one of them is changed, so copying is cheap
+	*/
+
+	class SymbolsTable
+	{
+		private:
+			typedef struct TSlot
+			{
+				uint64_t mHash = 0;
+				uint32_t mMacroIndex = 0; ///< Zero means an empty slot, otherwise it's an index of a definition plus one
+			} TSlot, *TSlotPtr;
+
+			typedef struct TState
+			{
+				std::vector<TMacroDesc> mMacros;
+				std::vector<TSlot> mSlots; ///< Amount of slots is always a power of two
+				std::vector<uint64_t> mFilterWords;
+
+				size_t mRemovalsCount = 0; ///< Bits of removed macros stay in the filter until it's rebuilt
+
+				std::unordered_map<std::string, uint64_t> mVersionsTable;
+				uint64_t mChangesCount = 0;
+			} TState, *TStatePtr;
+		public:
+			/// Names of looked up macros keyed by their hashes, so a name which is looked up again isn't copied
+			using TReadsTable = std::unordered_map<uint64_t, std::string>;
+		public:
+			SymbolsTable() TCPP_NOEXCEPT;
+			SymbolsTable(const SymbolsTable& table) TCPP_NOEXCEPT; ///< Logs aren't copied
+			~SymbolsTable() TCPP_NOEXCEPT = default;
+
+			bool Add(const TMacroDesc& macroDesc) TCPP_NOEXCEPT; ///< Returns false if there is a macro with the same name
+			bool Remove(const std::string& macroName) TCPP_NOEXCEPT; ///< Returns false if there is no macro with the given name
+
+			const TMacroDesc* Find(const char* pName, size_t length) const TCPP_NOEXCEPT;
+			const TMacroDesc* Find(const std::string& macroName) const TCPP_NOEXCEPT;
+
+			bool Contains(const std::string& macroName) const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns a number which is changed every time when the macro is defined or removed.
+				0 means the macro has never been defined
+			*/
+
+			uint64_t GetVersion(const std::string& macroName) const TCPP_NOEXCEPT;
+
+			const std::vector<TMacroDesc>& GetMacros() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief While the log is set names passed into Find, Contains and GetVersion are inserted into it, names of 
+				undefined macros included. Pass nullptr to stop logging
+			*/
+
+			void SetReadsLog(TReadsTable* pReadsLog) TCPP_NOEXCEPT;
+
+			/*!
+				\brief The same as SetReadsLog, both of them can be used at once. The log is usually flushed by its owner 
+				while the set collects names of the whole processing
+			*/
+
+			void SetReadsSet(TReadsTable* pReadsSet) TCPP_NOEXCEPT;
+
+			SymbolsTable& operator= (const SymbolsTable& table) TCPP_NOEXCEPT;
+		private:
+			void _updateVersion(const std::string& macroName) TCPP_NOEXCEPT;
+			void _logRead(const char* pName, size_t length, uint64_t hash) const TCPP_NOEXCEPT;
+
+			size_t _findSlotIndex(const char* pName, size_t length, uint64_t hash) const TCPP_NOEXCEPT; ///< Returns an index of the matched or the first empty slot
+			void _rebuild(size_t slotsCount) TCPP_NOEXCEPT;
+			void _addToFilter(uint64_t hash) TCPP_NOEXCEPT;
+			bool _mayContain(uint64_t hash) const TCPP_NOEXCEPT;
+		private:
+			CopyOnWritePtr<TState> mpState; ///< Is copied before changes if it's shared with other tables
+
+			TReadsTable* mpReadsLog;
+			TReadsTable* mpReadsSet;
+	};
+
+
+	/*!
+		class HideSetsTable
+
+		\brief The class interns hide sets which are attached to tokens produced by macro expansions. A hide set 
+		is a set of macros' identifiers, a token isn't expanded again by a macro from its hide set. Sets are immutable 
+		and referred by indices, the index 0 is reserved for the empty set. Copies of a table share its state until
+		one of them interns a new set, indices which were given before the copying stay valid in both
+	*/
+
+	class HideSetsTable
+	{
+		public:
+			using THideSetId = uint32_t;
+			using TMacroId = uint32_t;
+			using TMacroIdsArray = std::vector<TMacroId>;
+		private:
+			typedef struct TState
+			{
+				std::unordered_map<std::string, TMacroId> mMacrosIds;
+
+				std::vector<TMacroIdsArray> mHideSets; ///< Identifiers of every set are sorted
+				std::map<TMacroIdsArray, THideSetId> mHideSetsTable;
+
+				std::unordered_set<uint64_t> mMembershipTable; ///< Contains (hide set, macro) pairs
+				std::unordered_map<uint64_t, THideSetId> mUnionsCache;
+			} TState, *TStatePtr;
+		public:
+			HideSetsTable() TCPP_NOEXCEPT;
+			~HideSetsTable() TCPP_NOEXCEPT = default;
+
+			TMacroId GetMacroId(const std::string& macroName) TCPP_NOEXCEPT;
+
+			THideSetId Add(THideSetId hideSetId, TMacroId macroId) TCPP_NOEXCEPT;
+			THideSetId Union(THideSetId leftHideSetId, THideSetId rightHideSetId) TCPP_NOEXCEPT;
+			THideSetId Intersect(THideSetId leftHideSetId, THideSetId rightHideSetId) TCPP_NOEXCEPT;
+
+			bool Contains(THideSetId hideSetId, TMacroId macroId) const TCPP_NOEXCEPT;
+		private:
+			THideSetId _intern(TMacroIdsArray&& macroIds) TCPP_NOEXCEPT;
+		private:
+			CopyOnWritePtr<TState> mpState; ///< Is copied before changes if it's shared with other tables
+	};
+
+
+	enum class E_ERROR_TYPE : unsigned int
+	{
+		UNEXPECTED_TOKEN,
+		UNBALANCED_ENDIF,
+		INVALID_MACRO_DEFINITION,
+		MACRO_ALREADY_DEFINED,
+		INCONSISTENT_MACRO_ARITY,
+		UNDEFINED_MACRO,
+		INVALID_INCLUDE_DIRECTIVE,
+		UNEXPECTED_END_OF_INCLUDE_PATH,
+		ANOTHER_ELSE_BLOCK_FOUND,
+		ELIF_BLOCK_AFTER_ELSE_FOUND,
+		UNDEFINED_DIRECTIVE,
+		INCORRECT_OPERATION_USAGE,
+		INCORRECT_STRINGIFY_OPERATOR_USAGE,
+	};
+
+
+	std::string ErrorTypeToString(const E_ERROR_TYPE& errorType) TCPP_NOEXCEPT;
+
+
+	/*!
+		struct TErrorInfo
+
+		\brief The type contains all information about happened error
+	*/
+
+	typedef struct TErrorInfo
+	{
+		E_ERROR_TYPE mType;
+		size_t mLine;
+	} TErrorInfo, *TErrorInfoPtr;
+
+
+	enum class E_EXPRESSION_OPCODE : uint8_t
+	{
+		PUSH_VALUE,
+		PUSH_IDENTIFIER,  ///< The operand is an index of the identifier, it's replaced with the macro's value or 0
+		PUSH_DEFINED,     ///< The operand is an index of the identifier, pushes 1 if the macro is defined
+		PUSH_MACRO_CALL,  ///< The operand is an index of the invocation's tokens
+		PUSH_SUBEXPRESSION, ///< The operand is an index of the sub-expression's tokens, they're compiled when the instruction is executed first
+		NEGATE,
+		NOT,
+		BIT_NOT,
+		MUL,
+		DIV,
+		MOD,
+		ADD,
+		SUB,
+		LSHIFT,
+		RSHIFT,
+		LESS,
+		GREATER,
+		LE,
+		GE,
+		EQ,
+		NE,
+		BIT_AND,
+		BIT_XOR,
+		BIT_OR,
+		TO_BOOL,
+		AND_JUMP,         ///< Jumps to the operand if the top value is 0, otherwise pops it
+		OR_JUMP,          ///< Replaces the top value with 1 and jumps to the operand if it isn't 0, otherwise pops it
+		JUMP_IF_ZERO,     ///< Pops the top value and jumps to the operand if it's 0
+		JUMP,
+	};
+
+
+	typedef struct TExpressionInstruction
+	{
+		E_EXPRESSION_OPCODE mOpCode;
+		intmax_t mOperand = 0;
+	} TExpressionInstruction, *TExpressionInstructionPtr;
+
+
+	/*!
+		struct TCompiledExpression
+
+		\brief The type contains a bytecode of a stack machine which computes a condition of #if and #elif directives.
+		Identifiers which are left in the code are resolved during the evaluation
+	*/
+
+	typedef struct TCompiledExpression
+	{
+		std::vector<TExpressionInstruction> mInstructions;
+		std::vector<TToken> mIdentifiers;
+		std::vector<std::vector<TToken>> mMacroCalls;     ///< Tokens of function-like macros invocations starting from their names
+		std::vector<std::vector<TToken>> mSubExpressions; ///< Unexpanded operands of &&, || and ?:
+
+		bool mIsValid = true;           ///< False if the expression has syntax errors, such expression is evaluated as 0
+		bool mHasMacroOperands = false; ///< False if the result doesn't depend on values of macros
+	} TCompiledExpression, *TCompiledExpressionPtr;
+
+
+	/*!
+		\brief The callback replaces a macro which name is at the given index with the macro's tokens. It returns false 
+		if the identifier is left as an operand of the expression
+	*/
+
+	using TExpressionMacroResolver = std::function<bool(std::vector<TToken>& tokens, size_t identifierIndex)>;
+
+
+	/*!
+		\brief The function translates tokens of a constant expression into a bytecode. All C operators except
+		assignments and comma are supported. Whitespaces and comments are ignored. 
+
+		If the resolver is given, macros are substituted into the tokens while they're parsed, except operands of 
+		defined. Right operands of && and || and branches of ?: are stored as sub-expressions then, so their macros 
+		are substituted only if they're evaluated
+	*/
+
+	TCompiledExpression CompileExpression(const std::vector<TToken>& tokens, const TExpressionMacroResolver& resolveMacro = nullptr) TCPP_NOEXCEPT;
+
+
+	/*!
+		\brief The function returns true if tokens are a number, a character or an expression in brackets. Such macros 
+		are evaluated as operands, other ones are substituted into expressions
+	*/
+
+	bool IsPrimaryExpression(const std::vector<TToken>& tokens) TCPP_NOEXCEPT;
+
+
+	/*!
+		\brief The function fills mConditionalDirectives of the buffer. For every conditional directive it finds the branch 
+		which ends the following block and compiles conditions of #if and #elif. Lexer::Tokenize calls it for every buffer
+	*/
+
+	void BuildConditionalSkeleton(TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT;
+
+
+	/*!
+		struct TConditionalRegionInfo
+
+		\brief The type describes a branch of a conditional block which has been met during the processing
+	*/
+
+	typedef struct TConditionalRegionInfo
+	{
+		std::string  mFileId;       ///< An identity of the included file which contains the directive, it's empty for the root source
+		size_t       mLine = 0;     ///< The line of the directive within its file
+		E_TOKEN_TYPE mDirectiveType = E_TOKEN_TYPE::IF; ///< IF, IFDEF, IFNDEF, ELIF or ELSE
+
+		/*!
+			Sorted names of macros which decide whether the branch is active. They include macros of enclosing 
+			blocks' conditions and of previous branches of the same block
+		*/
+
+		std::vector<std::string> mMacros;
+
+		bool mIsActive = false;
+	} TConditionalRegionInfo, *TConditionalRegionInfoPtr;
+
+
+	class DiskOutputCache;
+
+
+	/*!
+		class OutputCache
+
+		\brief The class is a thread-safe in-memory cache of preprocessors' outputs. An entry is keyed by a fingerprint of
+		the root source, initial macros and preprocessor's configuration. It stores content hashes of all files which were 
+		included, the entry is valid only while all of them have the same content. When the size of all entries exceeds 
+		the memory budget least recently used ones are evicted. If a disk cache is specified, it's used as a persistent 
+		storage beneath the memory, so entries survive restarts of the process
+	*/
+
+	class OutputCache
+	{
+		public:
+			typedef struct TIncludeRecord
+			{
+				std::string mPath;
+				bool        mIsSystemPathInclusion = false;
+				uint64_t    mContentHash = 0; ///< 0 means the file wasn't found
+			} TIncludeRecord, *TIncludeRecordPtr;
+
+			typedef struct TOutputEntry
+			{
+				std::vector<TIncludeRecord> mIncludes;
+				std::vector<TMacroDesc>     mMacros; ///< Symbols table after the processing
+				std::string                 mOutput;
+
+				std::vector<std::string>            mMacroDependencies;  ///< Are filled only if the preprocessor has tracked dependencies
+				std::vector<TConditionalRegionInfo> mConditionalRegions;
+			} TOutputEntry, *TOutputEntryPtr;
+
+			using TOutputEntrySharedPtr = std::shared_ptr<const TOutputEntry>;
+			using TEntryValidator = std::function<bool(const TOutputEntry&)>;
+		public:
+			OutputCache() TCPP_NOEXCEPT = delete;
+			explicit OutputCache(size_t memoryBudgetInBytes, std::shared_ptr<DiskOutputCache> pDiskCache = nullptr) TCPP_NOEXCEPT;
+			~OutputCache() TCPP_NOEXCEPT = default;
+
+			/*!
+				\brief The method returns an entry with the given key if the validator accepts it. The validator is invoked without the lock
+			*/
+
+			TOutputEntrySharedPtr Find(const std::string& key, const TEntryValidator& validator) TCPP_NOEXCEPT;
+			void Store(const std::string& key, TOutputEntrySharedPtr pEntry) TCPP_NOEXCEPT;
+
+			void Clear() TCPP_NOEXCEPT;
+
+			size_t GetSize() const TCPP_NOEXCEPT;
+			TCacheStats GetStats() const TCPP_NOEXCEPT;
+		private:
+			void _insert(const std::string& key, TOutputEntrySharedPtr pEntry) TCPP_NOEXCEPT;
+		private:
+			mutable std::mutex mMutex;
+
+			LRUCache<std::string, TOutputEntrySharedPtr> mEntries;
+
+			TCacheStats mStats;
+
+			std::shared_ptr<DiskOutputCache> mpDiskCache;
+	};
+
+
+	/*!
+		class DiskOutputCache
+
+		\brief The class stores outputs of preprocessors within a local directory, an entry's file is named after the key
+		of OutputCache. Each entry contains the output, the manifest of included files and resulting macros, the payload
+		is protected with a checksum. Files are written atomically, so many processes can share the same directory. 
+		When the total size of entries exceeds the limit least recently used ones are evicted, the directory is also trimmed on construction
+	*/
+
+	class DiskOutputCache
+	{
+		public:
+			DiskOutputCache() TCPP_NOEXCEPT = delete;
+			DiskOutputCache(const std::string& directory, size_t maxSizeInBytes) TCPP_NOEXCEPT;
+			~DiskOutputCache() TCPP_NOEXCEPT = default;
+
+			OutputCache::TOutputEntrySharedPtr Load(const std::string& key) TCPP_NOEXCEPT;
+			bool Store(const std::string& key, const OutputCache::TOutputEntry& entry) TCPP_NOEXCEPT;
+
+			void Clear() TCPP_NOEXCEPT;
+
+			size_t GetSize() const TCPP_NOEXCEPT;
+			TCacheStats GetStats() const TCPP_NOEXCEPT; ///< Statistics of loads made by this instance
+		private:
+			std::string _getEntryPath(const std::string& key) const TCPP_NOEXCEPT;
+		private:
+			mutable std::mutex mMutex;
+
+			std::string mDirectory;
+
+			size_t mMaxSizeInBytes;
+			size_t mCurrSizeInBytes;
+
+			TCacheStats mStats;
+	};
+
+
+	enum class E_INCLUDE_GUARD_STATE : uint8_t
+	{
+		AWAIT_IFNDEF, ///< Only whitespaces are met since the beginning of the file
+		INSIDE_GUARD,
+		AFTER_GUARD,  ///< Only whitespaces are met since #endif of the guard
+		NONE,         ///< The file isn't wrapped with a guard
+	};
+
+
+	/*!
+		class Preprocessor
+
+		\brief The class implements main functionality of C preprocessor. To preprocess
+		some source code string, create an instance of this class and call Process method.
+		The usage of the class is the same as iterators.
+	*/
+
+	class Preprocessor
+	{
+		public:
+			using TOnErrorCallback = std::function<void(const TErrorInfo&)>;
+			using TOnIncludeCallback = std::function<TInputStreamUniquePtr(const std::string&, bool)>;
+			using TOnResolveIncludeCallback = std::function<std::string(const std::string&, bool)>;
+			using TSymTable = std::vector<TMacroDesc>;
+			using TDirectiveHandler = std::function<std::string(Preprocessor&, Lexer&, const std::string&)>;
+			using TDirectivesMap = std::unordered_map<std::string, TDirectiveHandler>;
+
+			typedef struct TPreprocessorConfigInfo
+			{
+				TOnErrorCallback   mOnErrorCallback = {};
+				TOnIncludeCallback mOnIncludeCallback = {};
+
+				bool               mSkipComments = false; ///< When it's true all tokens which are E_TOKEN_TYPE::COMMENTARY will be thrown away from preprocessor's output
+
+				std::shared_ptr<TokensCache> mpTokensCache = nullptr; ///< If it's specified, tokens of included files are taken from the cache
+
+				/*!
+					Amount of worker threads that scan included files ahead of time, 0 disables speculative lexing. When it's enabled
+					#include directives of every scanned file are resolved and tokenized in background even if they're placed in 
+					inactive blocks. So mOnIncludeCallback should be thread-safe and return the same content for the same arguments
+				*/
+
+				size_t mSpeculativeLexingWorkersCount = 0;
+
+				/*!
+					Returns a canonical identity of the included file, e.g. its device and inode or a resolved path. Files which are 
+					guarded with #ifndef or #pragma once are skipped on re-inclusion without invoking mOnIncludeCallback, whitespaces
+					around the guard are still written and lines' numbers are kept. If it's not specified the path and the kind of 
+					the inclusion are used, an empty string disables the skipping for the file
+				*/
+
+				TOnResolveIncludeCallback mOnResolveIncludeCallback = {};
+
+				/*!
+					If it's specified, outputs of Process are reused for the same source, initial macros and contents of included files.
+					mOnIncludeCallback and handlers of custom directives are expected to be deterministic. A hit restores the symbols table.
+					Note that every lookup requests all files which were included by the cached processing through mOnIncludeCallback
+					and hashes their contents, so a hit still costs reading of the files but not their processing
+				*/
+
+				std::shared_ptr<OutputCache> mpOutputCache = nullptr;
+
+				/*!
+					If it's true, outputs of included files are recorded together with values of macros they've read and changes of 
+					the symbols table they've made. When the file is included again and the macros have the same values, the output 
+					is replayed instead of processing of the file
+				*/
+
+				bool mMemoizeIncludedFiles = false;
+
+				/*!
+					If it's true, macros whose definedness or values are consulted by conditional directives and expansions 
+					are collected, see GetMacroDependencies and GetConditionalRegions
+				*/
+
+				bool mTrackMacroDependencies = false;
+
+				size_t mExpansionsCacheCapacity = 1 << 14; ///< Amount of memoized macros' expansions, least recently used ones are evicted
+			} TPreprocessorConfigInfo, *TPreprocessorConfigInfoPtr;
+
+			using TConditionalRegionInfo = tcpp::TConditionalRegionInfo;
+
+			typedef struct TIfStackEntry
+			{
+				bool mShouldBeSkipped = true;
+				bool mHasElseBeenFound = false;
+				bool mHasIfBlockBeenEntered = false;
+				bool mIsParentBlockActive = true;
+
+				std::vector<std::string> mDependencies = {}; ///< Macros which were read by conditions of the block and enclosing ones
+
+				TIfStackEntry(bool shouldBeSkipped, bool isParentBlockActive) :
+					mShouldBeSkipped(shouldBeSkipped),
+					mHasElseBeenFound(false),
+					mHasIfBlockBeenEntered(!shouldBeSkipped),
+					mIsParentBlockActive(isParentBlockActive) {}
+			} TIfStackEntry, *TIfStackEntryPtr;
+
+			using TIfStack = std::stack<TIfStackEntry>;
+
+			typedef struct TEvaluationContext
+			{
+				std::vector<std::string> mReadMacros;
+				bool                     mIsCacheable = true;         ///< False if the result depends on something besides macros, e.g. __LINE__
+				bool                     mIsCompilationStale = false; ///< True if a macro which was left as an operand should be substituted now
+				bool                     mHasErrors = false;
+			} TEvaluationContext, *TEvaluationContextPtr;
+
+			typedef struct TConditionCacheEntry
+			{
+				std::shared_ptr<const TCompiledExpression>     mpExpression;
+				std::vector<std::tuple<std::string, uint64_t>> mSubstitutedMacrosVersions; ///< The compiled expression is valid until one of them changes
+				std::vector<std::tuple<std::string, uint64_t>> mReadMacrosVersions;
+				intmax_t                                       mResult = 0;
+				bool                                           mHasResult = false;
+			} TConditionCacheEntry, *TConditionCacheEntryPtr;
+
+			using TConditionsCache = std::unordered_map<std::string, TConditionCacheEntry>;
+			using TTokensSequencePtr = std::shared_ptr<const std::vector<TToken>>;
+
+			/*!
+				\brief Macros which were read while arguments were pre-expanded. A cached expansion is valid until one of them changes
+			*/
+
+			typedef struct TExpansionDependencies
+			{
+				std::vector<std::tuple<std::string, uint64_t>> mReadMacrosVersions;
+				bool                                           mIsCacheable = true; ///< False if the result depends on something besides macros, e.g. __LINE__
+			} TExpansionDependencies, *TExpansionDependenciesPtr;
+
+			typedef struct TExpansionCacheEntry
+			{
+				TTokensSequencePtr     mpTokens;
+				TExpansionDependencies mDependencies;
+			} TExpansionCacheEntry, *TExpansionCacheEntryPtr;
+
+			using TExpansionsCache = LRUCache<std::string, TExpansionCacheEntry>;
+
+			/*!
+				\brief A frame refers to an immutable result of some macro's expansion which is being rescanned now. 
+				Nested expansions push new frames on top of the stack, so tokens are never copied into the lexer
+			*/
+
+			typedef struct TExpansionFrame
+			{
+				TTokensSequencePtr mpTokens;
+				size_t             mCurrTokenIndex = 0;
+			} TExpansionFrame, *TExpansionFramePtr;
+
+			using TExpansionFramesStack = std::vector<TExpansionFrame>;
+
+			/*!
+				\brief The type describes an actual argument of some macro's invocation as a range of the captured tokens
+			*/
+
+			typedef struct TMacroArgument
+			{
+				size_t mFirstTokenIndex = 0;
+				size_t mTokensCount = 0;
+			} TMacroArgument, *TMacroArgumentPtr;
+
+			typedef struct TLexedInclude
+			{
+				TTokensBufferSharedPtr mpTokensBuffer;
+				uint64_t               mContentHash = 0; ///< Is computed only if the output cache is used, see ComputeStreamHash
+			} TLexedInclude, *TLexedIncludePtr;
+
+			using TPrefetchedIncludesTable = std::unordered_map<std::string, std::shared_future<TLexedInclude>>;
+
+			typedef struct TInclusionState
+			{
+				std::string           mFileId;
+				std::string           mGuardMacroName;
+				size_t                mStreamsCount = 0;     ///< Amount of lexer's streams while the file is being read
+				size_t                mConditionalDepth = 0; ///< Size of the conditional blocks stack at the beginning of the file
+				E_INCLUDE_GUARD_STATE mGuardState = E_INCLUDE_GUARD_STATE::AWAIT_IFNDEF;
+				bool                  mIsOnce = false;
+				std::string           mUnguardedOutput;      ///< Output of whitespaces around the guard
+				size_t                mNestedLinesCount = 0; ///< Lines of files which were included by the file
+				bool                  mHasUntrackedInclusions = false; ///< Lines of some included files are unknown
+
+				std::unordered_map<std::string, uint64_t> mReadMacros;    ///< Fingerprints of macros which were read before the file changed them
+				std::unordered_set<std::string>           mChangedMacros;
+				size_t                                    mOutputOffset = 0;
+				size_t                                    mFirstLineIndex = 0;
+				size_t                                    mErrorsCount = 0; ///< Amount of errors at the beginning of the file
+				bool                                      mIsMemoizable = true;
+
+				size_t                                    mConditionalRegionsOffset = 0; ///< Amount of tracked regions at the beginning of the file
+				std::vector<std::string>                  mEnclosingDependencies;        ///< Macros of conditional blocks which enclose the #include directive
+			} TInclusionState, *TInclusionStatePtr;
+
+			typedef struct TIncludedFileOutput
+			{
+				std::vector<std::tuple<std::string, uint64_t>> mReadMacros; ///< 0 fingerprint means that the macro wasn't defined
+				std::vector<TMacroDesc>                        mDefinedMacros;
+				std::vector<std::string>                       mRemovedMacros;
+				std::string                                    mOutput;
+				size_t                                         mLinesCount = 0; ///< Lines of the file and files it has included
+
+				/// Regions without macros of enclosing blocks which the file hasn't read itself, they're merged on replay
+				std::vector<TConditionalRegionInfo>            mConditionalRegions;
+			} TIncludedFileOutput, *TIncludedFileOutputPtr;
+
+			using TIncludedFilesOutputsTable = std::unordered_map<std::string, std::vector<TIncludedFileOutput>>;
+
+			typedef struct TIncludeGuardInfo
+			{
+				std::string mGuardMacroName; ///< The file is skipped while the macro is defined
+				bool        mIsOnce = false;
+				std::string mOutput;          ///< Whitespaces around the guard which are written instead of the skipped file
+				size_t      mLinesCount = 0;  ///< Lines of the file itself, files included within the guard aren't read when it's skipped
+			} TIncludeGuardInfo, *TIncludeGuardInfoPtr;
+
+			using TIncludeGuardsTable = std::unordered_map<std::string, TIncludeGuardInfo>;
+		public:
+			Preprocessor() TCPP_NOEXCEPT = delete;
+			Preprocessor(const Preprocessor&) TCPP_NOEXCEPT = delete;
+			Preprocessor(Lexer& lexer, const TPreprocessorConfigInfo& config) TCPP_NOEXCEPT;
+			~Preprocessor() TCPP_NOEXCEPT;
+
+			bool AddCustomDirectiveHandler(const std::string& directive, const TDirectiveHandler& handler) TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method defines the macro before the processing like -D option of a compiler does
+
+				\return false if there is a macro with the same name
+			*/
+
+			bool AddMacro(const TMacroDesc& macroDesc) TCPP_NOEXCEPT;
+
+			std::string Process() TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method creates an independent preprocessor which reads the given lexer and starts with the state of this one:
+				macros, include guards, custom directives and caches. The state is shared copy-on-write, so forking doesn't depend on 
+				amount of macros. It should be called between invocations of Process, e.g. to process a common prelude once and 
+				then branch into many variants. Forks can be used from other threads
+			*/
+
+			std::unique_ptr<Preprocessor> Fork(Lexer& lexer) const TCPP_NOEXCEPT;
+
+			Preprocessor& operator= (const Preprocessor&) TCPP_NOEXCEPT = delete;
+
+			TSymTable GetSymbolsTable() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns statistics of #if and #elif results' reuse. A result is reused when the same 
+				expression is met again and none of macros it has read were redefined since then
+			*/
+
+			TCacheStats GetConditionsCacheStats() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns statistics of macros' expansions reuse. Substitution results are cached by 
+				the macro, its definition's version, hide sets and values of arguments. Built-in macros are never cached
+			*/
+
+			TCacheStats GetExpansionsCacheStats() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns statistics of included files' outputs reuse, see TPreprocessorConfigInfo::mMemoizeIncludedFiles
+			*/
+
+			TCacheStats GetIncludedFilesCacheStats() const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns sorted names of macros which were consulted by the last Process, built-in macros 
+				are excluded. A macro which isn't in the list can't change the output. The list is restored together with 
+				the output when the latter is taken from the output cache, see TPreprocessorConfigInfo::mTrackMacroDependencies
+			*/
+
+			std::vector<std::string> GetMacroDependencies() const TCPP_NOEXCEPT;
+
+			const std::vector<TConditionalRegionInfo>& GetConditionalRegions() const TCPP_NOEXCEPT; ///< Branches in order they were met by the last Process
+		private:
+			void _createMacroDefinition() TCPP_NOEXCEPT;
+			void _removeMacroDefinition(const std::string& macroName) TCPP_NOEXCEPT;
+
+			TTokensSequencePtr _expandMacroDefinition(const TMacroDesc& macroDesc, const TToken& idToken, const std::function<TToken()>& getNextTokenCallback,
+														TExpansionDependencies* pDependencies = nullptr) const TCPP_NOEXCEPT;
+			std::vector<TToken> _expandMacroArg(std::vector<TToken>::const_iterator firstTokenIt, std::vector<TToken>::const_iterator lastTokenIt, TExpansionDependencies& dependencies) const TCPP_NOEXCEPT;
+
+			TTokensSequencePtr _findExpansion(const std::string& cacheKey, TExpansionDependencies* pDependencies) const TCPP_NOEXCEPT;
+			TTokensSequencePtr _storeExpansion(std::string&& cacheKey, std::vector<TToken>&& replacementList, TExpansionDependencies&& dependencies, TExpansionDependencies* pDependencies) const TCPP_NOEXCEPT;
+
+			TToken _getNextToken() TCPP_NOEXCEPT;
+			TToken _peekNextToken() const TCPP_NOEXCEPT;
+			bool _hasNextToken() const TCPP_NOEXCEPT;
+			void _pushExpansionFrame(const TTokensSequencePtr& pTokens) TCPP_NOEXCEPT;
+
+			void _expect(const E_TOKEN_TYPE& expectedType, const E_TOKEN_TYPE& actualType) const TCPP_NOEXCEPT;
+
+			std::string _processInclusion(size_t outputOffset) TCPP_NOEXCEPT; ///< Returns the output of the file if it's replayed
+
+			std::string _computeOutputCacheKey() TCPP_NOEXCEPT;
+			bool _isOutputEntryValid(const OutputCache::TOutputEntry& entry) const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method changes only macros which differ from the given ones, so versions of others are kept
+				and cached conditions and expansions which depend on them stay valid
+			*/
+
+			void _restoreSymbolsTable(const TSymTable& macros) TCPP_NOEXCEPT;
+			std::string _processPragma() TCPP_NOEXCEPT;
+
+			void _updateInclusionState(TInclusionState& state, E_TOKEN_TYPE tokenType, size_t conditionalDepth, const std::string& guardMacroName, 
+				const std::string& output, size_t tokenOutputOffset) TCPP_NOEXCEPT;
+			/*!
+				\brief The method finishes states of files which streams have been closed. Amount of lines is known only if the streams 
+				have been just closed by the preprocessor, otherwise the lexer could read some lines of the includer
+			*/
+
+			void _finishInclusions(size_t streamsCount, const std::string& output, bool isLinesCountKnown) TCPP_NOEXCEPT;
+
+			const TIncludedFileOutput* _findIncludedFileOutput(const std::string& fileId) TCPP_NOEXCEPT;
+			void _storeIncludedFileOutput(const TInclusionState& state, const std::string& output, bool isLinesCountKnown) TCPP_NOEXCEPT;
+			void _flushMacroReads() TCPP_NOEXCEPT;
+			void _recordMacroChange(const std::string& macroName) TCPP_NOEXCEPT;
+
+			TLexedInclude _lexIncludedFile(const std::string& path, bool isSystemPathInclusion) const TCPP_NOEXCEPT;
+			void _prefetchIncludes(const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT;
+
+			TIfStackEntry _processIfConditional() TCPP_NOEXCEPT;
+			TIfStackEntry _processIfdefConditional() TCPP_NOEXCEPT;
+			TIfStackEntry _processIfndefConditional(std::string& macroIdentifier) TCPP_NOEXCEPT;
+			void _processElseConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT;
+			void _processElifConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method invokes the directive's processing and records macros which have been read by its condition
+			*/
+
+			void _trackConditionalRegion(E_TOKEN_TYPE directiveType, size_t line, const std::function<void()>& processDirective) TCPP_NOEXCEPT;
+
+			intmax_t _evaluateExpression(const std::vector<TToken>& exprTokens, const std::shared_ptr<const TCompiledExpression>& pPrecompiledExpression = nullptr) const TCPP_NOEXCEPT;
+			intmax_t _evaluateTokens(const std::vector<TToken>& exprTokens, TEvaluationContext& context) const TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method returns the expression compiled with the current macros. Compiled expressions are kept in 
+				the conditions cache until one of the substituted macros changes
+			*/
+
+			std::shared_ptr<const TCompiledExpression> _compileExpression(const std::vector<TToken>& exprTokens, TEvaluationContext& context, bool isRecompilationForced) const TCPP_NOEXCEPT;
+			bool _substituteMacro(std::vector<TToken>& exprTokens, size_t identifierIndex, TEvaluationContext& context, TExpansionDependencies& dependencies) const TCPP_NOEXCEPT;
+
+			intmax_t _executeExpression(const TCompiledExpression& expression, TEvaluationContext& context) const TCPP_NOEXCEPT;
+			intmax_t _evaluateIdentifier(const TToken& identifierToken, TEvaluationContext& context) const TCPP_NOEXCEPT;
+			intmax_t _evaluateMacroCall(const std::vector<TToken>& invocationTokens, TEvaluationContext& context) const TCPP_NOEXCEPT;
+
+			bool _shouldTokenBeSkipped() const TCPP_NOEXCEPT;
+			void _skipInactiveBlock() TCPP_NOEXCEPT;
+		private:
+			Lexer* mpLexer;
+
+			TPreprocessorConfigInfo mConfig; ///< Is used to create forks
+
+			TOnErrorCallback   mOnErrorCallback;
+			TOnIncludeCallback mOnIncludeCallback;
+			TOnResolveIncludeCallback mOnResolveIncludeCallback;
+
+			size_t mErrorsCount;
+
+			std::shared_ptr<OutputCache> mpOutputCache;
+			std::vector<OutputCache::TIncludeRecord> mIncludesManifest; ///< Files which were included during the current processing
+
+			std::shared_ptr<TokensCache> mpTokensCache;
+
+			SymbolsTable mSymTable;
+			mutable HideSetsTable mHideSets;
+
+			/// \note Caches and the include guards table are shared with forks copy-on-write
+
+			mutable CopyOnWritePtr<TConditionsCache> mpConditionsCache;
+			mutable TCacheStats mConditionsCacheStats;
+
+			mutable CopyOnWritePtr<TExpansionsCache> mpExpansionsCache;
+			mutable TCacheStats mExpansionsCacheStats;
+
+			TExpansionFramesStack mExpansionFrames;
+
+			TIfStack mConditionalBlocksStack;
+			TDirectivesMap mCustomDirectivesHandlersMap;
+
+			std::vector<TInclusionState> mInclusionsStack;
+			CopyOnWritePtr<TIncludeGuardsTable> mpIncludeGuardsTable;
+
+			bool mMemoizeIncludedFiles;
+			TIncludedFilesOutputsTable mIncludedFilesOutputs;
+			TCacheStats mIncludedFilesCacheStats;
+			SymbolsTable::TReadsTable mMacroReadsLog; ///< Macros which were looked up since the last flush, it's filled only while some included file is read
+
+			bool mSkipCommentsTokens;
+
+			bool mTrackMacroDependencies;
+			SymbolsTable::TReadsTable mMacroDependencies;
+			std::vector<TConditionalRegionInfo> mConditionalRegions;
+
+			std::mutex mPrefetchMutex;
+			TPrefetchedIncludesTable mPrefetchedIncludes;
+			bool mIsPrefetchingStopped;
+
+			std::unique_ptr<WorkersPool> mpWorkersPool; ///< Should be declared last to be destroyed before the state which is used by its tasks
+	};
+
+
+	/*!
+		class PermutationsProcessor
+
+		\brief The class preprocesses a single source under many sets of macros, e.g. permutations of a shader. 
+		The source is tokenized once, every included file is requested and tokenized once per batch, and all 
+		the buffers are shared between preprocessors which are run by a pool of workers. Explore enumerates
+		distinct outputs for all combinations of feature macros processing only combinations which can differ
+	*/
+
+	class PermutationsProcessor
+	{
+		public:
+			using TDefinesSet = std::vector<std::pair<std::string, std::string>>; ///< Names and values of object-like macros, an empty value means 1
+
+			typedef struct TPermutationsConfigInfo
+			{
+				Preprocessor::TOnIncludeCallback mOnIncludeCallback = {}; ///< Should be thread-safe, it's invoked once per file within a batch
+
+				bool mSkipComments = false;
+
+				size_t mWorkersCount = 0; ///< 0 means amount of hardware threads
+
+				std::shared_ptr<TokensCache> mpTokensCache = nullptr; ///< If it's specified, tokens of the source and included files are taken from the cache
+
+				Preprocessor::TOnResolveIncludeCallback mOnResolveIncludeCallback = {};
+
+				bool mMemoizeIncludedFiles = false;
+
+				bool mTrackMacroDependencies = false;
+			} TPermutationsConfigInfo, *TPermutationsConfigInfoPtr;
+
+			typedef struct TPermutationResult
+			{
+				std::string             mOutput;
+				std::vector<TErrorInfo> mErrors;
+
+				std::vector<std::string> mMacroDependencies; ///< Filled if mTrackMacroDependencies is set, permutations which agree on these macros have the same output
+			} TPermutationResult, *TPermutationResultPtr;
+
+			typedef struct TFeatureMacro
+			{
+				std::string              mName;
+				std::vector<std::string> mValues; ///< An empty value leaves the macro undefined, e.g. { "", "1" } for a flag which is checked with #ifdef
+			} TFeatureMacro, *TFeatureMacroPtr;
+
+			/*!
+				\brief The type describes combinations of features' values which have the same output. A combination is a vector
+				of indices of values, one per feature. AnyFeatureValue means the output doesn't depend on the feature
+			*/
+
+			typedef struct TCombinationsGroup
+			{
+				std::vector<size_t>     mValuesIndices;
+				size_t                  mOutputIndex = 0;
+				std::vector<TErrorInfo> mErrors;
+			} TCombinationsGroup, *TCombinationsGroupPtr;
+
+			typedef struct TExplorationResult
+			{
+				std::vector<std::string>        mOutputs; ///< Unique outputs
+				std::vector<TCombinationsGroup> mGroups;  ///< Groups don't intersect and cover all combinations
+
+				size_t mPassesCount = 0; ///< Amount of combinations which have been actually processed
+			} TExplorationResult, *TExplorationResultPtr;
+
+			static constexpr size_t AnyFeatureValue = (std::numeric_limits<size_t>::max)();
+		private:
+			using TIncludedFilesTable = std::unordered_map<std::string, TTokensBufferSharedPtr>;
+
+			typedef struct TBatchContext
+			{
+				TTokensBufferSharedPtr           mpSourceTokens;
+				Preprocessor::TOnIncludeCallback mOnIncludeCallback;
+
+				std::mutex          mIncludedFilesMutex;
+				TIncludedFilesTable mIncludedFiles; ///< Tokens of included files which are shared between all permutations of the batch
+			} TBatchContext, *TBatchContextPtr;
+		public:
+			PermutationsProcessor() TCPP_NOEXCEPT = delete;
+			PermutationsProcessor(const PermutationsProcessor&) TCPP_NOEXCEPT = delete;
+			explicit PermutationsProcessor(const TPermutationsConfigInfo& config) TCPP_NOEXCEPT;
+			~PermutationsProcessor() TCPP_NOEXCEPT = default;
+
+			/*!
+				\brief The method returns outputs of the source for every set of macros in the same order as the sets are passed
+			*/
+
+			std::vector<TPermutationResult> Process(const std::string& source, const std::vector<TDefinesSet>& definesSets) TCPP_NOEXCEPT;
+
+			/*!
+				\brief The method finds all distinct outputs of the source for every combination of features' values. A combination
+				is processed with the first values of features which haven't been fixed yet, then only features which have been 
+				consulted by that pass are forked, because others can't change the output. The first value of each feature is 
+				processed with the rest of the combination, other ones get their own passes. Passes of the same depth run in parallel
+			*/
+
+			TExplorationResult Explore(const std::string& source, const std::vector<TFeatureMacro>& features) TCPP_NOEXCEPT;
+
+			/*!
+				\brief The function returns an index of the output of the combination, or AnyFeatureValue if it isn't covered
+			*/
+
+			static size_t FindOutputIndex(const TExplorationResult& result, const std::vector<size_t>& valuesIndices) TCPP_NOEXCEPT;
+
+			PermutationsProcessor& operator= (const PermutationsProcessor&) TCPP_NOEXCEPT = delete;
+		private:
+			void _initBatchContext(TBatchContext& context, const std::string& source, const Lexer& lexer) const TCPP_NOEXCEPT;
+			std::vector<TPermutationResult> _processBatch(const TBatchContext& context, const std::vector<TDefinesSet>& definesSets, bool trackMacroDependencies) TCPP_NOEXCEPT;
+
+			TPermutationResult _processPermutation(const TBatchContext& context, const TDefinesSet& defines, bool trackMacroDependencies) const TCPP_NOEXCEPT;
+		private:
+			TPermutationsConfigInfo mConfig;
+
+			std::unique_ptr<WorkersPool> mpWorkersPool;
+	};
+
+
+	///< implementation of the library is placed below
+#if defined(TCPP_IMPLEMENTATION)
+
+
+	/*!
+		\brief The function parses integer literals like 42, 0x2A, 052 and 42ul. For other strings
+		the value of their leading digits is returned, so non-numeric identifiers are evaluated as 0
+	*/
+
+	static intmax_t ParseIntegerLiteral(const std::string& literal) TCPP_NOEXCEPT
+	{
+		uintmax_t base = 10;
+		size_t pos = 0;
+
+		if (literal.length() > 1 && literal[0] == '0')
+		{
+			const bool isHexadecimal = std::tolower(static_cast<unsigned char>(literal[1])) == 'x';
+
+			base = isHexadecimal ? 16 : 8;
+			pos = isHexadecimal ? 2 : 1;
+		}
+
+		uintmax_t value = 0;
+
+		for (; pos < literal.length(); ++pos)
+		{
+			const int ch = std::tolower(static_cast<unsigned char>(literal[pos]));
+
+			const uintmax_t digit = std::isdigit(ch) ? static_cast<uintmax_t>(ch - '0') : ((ch >= 'a' && ch <= 'f') ? static_cast<uintmax_t>(ch - 'a' + 10) : base);
+			if (digit >= base)
+			{
+				break;
+			}
+
+			value = value * base + digit;
+		}
+
+		return static_cast<intmax_t>(value);
+	}
+
+
+	static intmax_t ParseCharLiteral(const std::string& literal) TCPP_NOEXCEPT
+	{
+		if (literal.length() < 3)
+		{
+			return 0;
+		}
+
+		if (literal[1] != '\\')
+		{
+			return static_cast<unsigned char>(literal[1]);
+		}
+
+		switch (literal[2])
+		{
+			case 'n':
+				return '\n';
+			case 't':
+				return '\t';
+			case 'r':
+				return '\r';
+			case 'a':
+				return '\a';
+			case 'b':
+				return '\b';
+			case 'f':
+				return '\f';
+			case 'v':
+				return '\v';
+			case 'x':
+				return ParseIntegerLiteral("0" + literal.substr(2, literal.length() - 3));
+			default:
+				return std::isdigit(static_cast<unsigned char>(literal[2])) ? ParseIntegerLiteral("0" + literal.substr(2, literal.length() - 3)) : static_cast<unsigned char>(literal[2]);
+		}
+	}
+
+
+	/*!
+		class ExpressionCompiler
+
+		\brief The class translates an expression into a bytecode using precedence climbing. Tokens are read
+		with a cursor, so each of them is visited once. Macros are substituted in front of the cursor
+	*/
+
+	class ExpressionCompiler
+	{
+		public:
+			ExpressionCompiler(const std::vector<TToken>& tokens, const TExpressionMacroResolver& resolveMacro, TCompiledExpression& result) TCPP_NOEXCEPT:
+				mTokens(tokens), mCurrTokenIndex(0), mFirstUnresolvedTokenIndex(0), mResolveMacro(resolveMacro), mResult(result)
+			{
+			}
+
+			void Compile() TCPP_NOEXCEPT
+			{
+				if (E_TOKEN_TYPE::END == _peekToken().mType) // \note Empty expressions are evaluated as 0
+				{
+					_emit(E_EXPRESSION_OPCODE::PUSH_VALUE, 0);
+					return;
+				}
+
+				_parseConditional();
+
+				if (E_TOKEN_TYPE::END != _peekToken().mType)
+				{
+					mResult.mIsValid = false;
+				}
+			}
+		private:
+			const TToken& _peekToken(bool shouldResolveMacros = true) TCPP_NOEXCEPT
+			{
+				static const TToken endToken { E_TOKEN_TYPE::END };
+
+				while (mCurrTokenIndex < mTokens.size())
+				{
+					const TToken& currToken = mTokens[mCurrTokenIndex];
+
+					if (E_TOKEN_TYPE::SPACE == currToken.mType || E_TOKEN_TYPE::COMMENTARY == currToken.mType || E_TOKEN_TYPE::NEWLINE == currToken.mType)
+					{
+						++mCurrTokenIndex;
+						continue;
+					}
+
+					const bool isIdentifier = E_TOKEN_TYPE::IDENTIFIER == currToken.mType || E_TOKEN_TYPE::KEYWORD == currToken.mType;
+
+					if (!shouldResolveMacros || !mResolveMacro || !isIdentifier || mCurrTokenIndex < mFirstUnresolvedTokenIndex || currToken.mRawView == "defined")
+					{
+						return currToken;
+					}
+
+					/// \note Substituted tokens are rescanned, so the index isn't moved in that case
+					if (!mResolveMacro(mTokens, mCurrTokenIndex))
+					{
+						mFirstUnresolvedTokenIndex = mCurrTokenIndex + 1;
+					}
+				}
+
+				return endToken;
+			}
+
+			void _expect(E_TOKEN_TYPE type) TCPP_NOEXCEPT
+			{
+				if (_peekToken().mType != type)
+				{
+					mResult.mIsValid = false;
+					return;
+				}
+
+				++mCurrTokenIndex;
+			}
+
+			size_t _emit(E_EXPRESSION_OPCODE opCode, intmax_t operand = 0) TCPP_NOEXCEPT
+			{
+				mResult.mInstructions.push_back({ opCode, operand });
+				return mResult.mInstructions.size() - 1;
+			}
+
+			void _setJumpTarget(size_t instructionIndex) TCPP_NOEXCEPT
+			{
+				mResult.mInstructions[instructionIndex].mOperand = static_cast<intmax_t>(mResult.mInstructions.size());
+			}
+
+			intmax_t _addIdentifier(const TToken& identifier) TCPP_NOEXCEPT
+			{
+				mResult.mIdentifiers.push_back(identifier);
+				return static_cast<intmax_t>(mResult.mIdentifiers.size() - 1);
+			}
+
+			void _parseConditional() TCPP_NOEXCEPT
+			{
+				_parseBinary(1);
+
+				if (E_TOKEN_TYPE::QUESTION != _peekToken().mType)
+				{
+					return;
+				}
+
+				++mCurrTokenIndex;
+
+				const size_t elseJumpIndex = _emit(E_EXPRESSION_OPCODE::JUMP_IF_ZERO);
+				_parseOperand(E_TOKEN_TYPE::QUESTION);
+				_expect(E_TOKEN_TYPE::COLON);
+
+				const size_t endJumpIndex = _emit(E_EXPRESSION_OPCODE::JUMP);
+				_setJumpTarget(elseJumpIndex);
+				_parseOperand(E_TOKEN_TYPE::QUESTION);
+				_setJumpTarget(endJumpIndex);
+			}
+
+			/*!
+				\brief The method parses a right operand of && or || or a branch of ?:. If macros are substituted the operand's 
+				tokens are stored unexpanded, its end is found by brackets and operators which can't be a part of the operand
+			*/
+
+			void _parseOperand(E_TOKEN_TYPE operatorType) TCPP_NOEXCEPT
+			{
+				if (!mResolveMacro && E_TOKEN_TYPE::QUESTION == operatorType)
+				{
+					_parseConditional();
+					return;
+				}
+
+				if (!mResolveMacro)
+				{
+					_parseBinary(_getPrecedence(operatorType) + 1);
+					return;
+				}
+
+				const size_t firstTokenIndex = mCurrTokenIndex;
+
+				uint32_t nestingLevel = 0;
+				uint32_t conditionalsLevel = 0;
+
+				bool isOperandEnded = false;
+
+				while (!isOperandEnded && mCurrTokenIndex < mTokens.size())
+				{
+					const E_TOKEN_TYPE currTokenType = mTokens[mCurrTokenIndex].mType;
+
+					switch (currTokenType)
+					{
+						case E_TOKEN_TYPE::OPEN_BRACKET:
+							++nestingLevel;
+							break;
+						case E_TOKEN_TYPE::CLOSE_BRACKET:
+							isOperandEnded = !nestingLevel;
+							nestingLevel -= isOperandEnded ? 0 : 1;
+							break;
+						case E_TOKEN_TYPE::QUESTION: // \note Only branches of ?: can contain nested conditional operators
+							if (!nestingLevel)
+							{
+								isOperandEnded = E_TOKEN_TYPE::QUESTION != operatorType;
+								++conditionalsLevel;
+							}
+							break;
+						case E_TOKEN_TYPE::COLON:
+							if (!nestingLevel)
+							{
+								isOperandEnded = !conditionalsLevel;
+								conditionalsLevel -= isOperandEnded ? 0 : 1;
+							}
+							break;
+						case E_TOKEN_TYPE::AND:
+						case E_TOKEN_TYPE::OR:
+							isOperandEnded = !nestingLevel && _getPrecedence(currTokenType) <= _getPrecedence(operatorType);
+							break;
+						default:
+							break;
+					}
+
+					if (!isOperandEnded)
+					{
+						++mCurrTokenIndex;
+					}
+				}
+
+				std::vector<TToken> operandTokens(mTokens.cbegin() + firstTokenIndex, mTokens.cbegin() + mCurrTokenIndex);
+
+				if (std::all_of(operandTokens.cbegin(), operandTokens.cend(), [](const TToken& token) 
+					{ 
+						return E_TOKEN_TYPE::SPACE == token.mType || E_TOKEN_TYPE::COMMENTARY == token.mType || E_TOKEN_TYPE::NEWLINE == token.mType; 
+					}))
+				{
+					mResult.mIsValid = false;
+					return;
+				}
+
+				mResult.mSubExpressions.push_back(std::move(operandTokens));
+				mResult.mHasMacroOperands = true;
+
+				_emit(E_EXPRESSION_OPCODE::PUSH_SUBEXPRESSION, static_cast<intmax_t>(mResult.mSubExpressions.size() - 1));
+			}
+
+			void _parseBinary(uint32_t minPrecedence) TCPP_NOEXCEPT
+			{
+				_parseUnary();
+
+				while (mResult.mIsValid)
+				{
+					const E_TOKEN_TYPE operatorType = _peekToken().mType;
+
+					const uint32_t precedence = _getPrecedence(operatorType);
+					if (!precedence || precedence < minPrecedence)
+					{
+						return;
+					}
+
+					++mCurrTokenIndex;
+
+					/// \note The right side of logical operators is skipped when the result is already known
+					if (E_TOKEN_TYPE::AND == operatorType || E_TOKEN_TYPE::OR == operatorType)
+					{
+						const size_t jumpIndex = _emit((E_TOKEN_TYPE::AND == operatorType) ? E_EXPRESSION_OPCODE::AND_JUMP : E_EXPRESSION_OPCODE::OR_JUMP);
+						_parseOperand(operatorType);
+						_emit(E_EXPRESSION_OPCODE::TO_BOOL);
+						_setJumpTarget(jumpIndex);
+
+						continue;
+					}
+
+					_parseBinary(precedence + 1);
+					_emit(_getBinaryOpCode(operatorType));
+				}
+			}
+
+			void _parseUnary() TCPP_NOEXCEPT
+			{
+				switch (_peekToken().mType)
+				{
+					case E_TOKEN_TYPE::PLUS:
+						++mCurrTokenIndex;
+						_parseUnary();
+						return;
+					case E_TOKEN_TYPE::MINUS:
+						++mCurrTokenIndex;
+						_parseUnary();
+						_emit(E_EXPRESSION_OPCODE::NEGATE);
+						return;
+					case E_TOKEN_TYPE::NOT:
+						++mCurrTokenIndex;
+						_parseUnary();
+						_emit(E_EXPRESSION_OPCODE::NOT);
+						return;
+					case E_TOKEN_TYPE::TILDE:
+						++mCurrTokenIndex;
+						_parseUnary();
+						_emit(E_EXPRESSION_OPCODE::BIT_NOT);
+						return;
+					default:
+						_parsePrimary();
+						return;
+				}
+			}
+
+			void _parsePrimary() TCPP_NOEXCEPT
+			{
+				const TToken& currToken = _peekToken();
+
+				switch (currToken.mType)
+				{
+					case E_TOKEN_TYPE::NUMBER:
+						++mCurrTokenIndex;
+						_emit(E_EXPRESSION_OPCODE::PUSH_VALUE, ParseIntegerLiteral(currToken.mRawView));
+						return;
+					case E_TOKEN_TYPE::CHAR_LITERAL:
+						++mCurrTokenIndex;
+						_emit(E_EXPRESSION_OPCODE::PUSH_VALUE, ParseCharLiteral(currToken.mRawView));
+						return;
+					case E_TOKEN_TYPE::BLOB: // \note Self references in values of macros and values of built-in macros, e.g. __LINE__
+						++mCurrTokenIndex;
+						_emit(E_EXPRESSION_OPCODE::PUSH_VALUE, ParseIntegerLiteral(currToken.mRawView));
+						return;
+					case E_TOKEN_TYPE::OPEN_BRACKET:
+						++mCurrTokenIndex;
+						_parseConditional();
+						_expect(E_TOKEN_TYPE::CLOSE_BRACKET);
+						return;
+					case E_TOKEN_TYPE::IDENTIFIER:
+					case E_TOKEN_TYPE::KEYWORD:
+						_parseIdentifier();
+						return;
+					default:
+						mResult.mIsValid = false;
+						return;
+				}
+			}
+
+			void _parseIdentifier() TCPP_NOEXCEPT
+			{
+				const size_t identifierIndex = mCurrTokenIndex++;
+				const TToken identifierToken = mTokens[identifierIndex]; // \note The tokens can be reallocated by substitutions
+
+				if (identifierToken.mRawView == "defined") // \note defined X or defined(X), the operand isn't expanded
+				{
+					const bool hasBrackets = (E_TOKEN_TYPE::OPEN_BRACKET == _peekToken(false).mType);
+					if (hasBrackets)
+					{
+						++mCurrTokenIndex;
+					}
+
+					if (E_TOKEN_TYPE::IDENTIFIER != _peekToken(false).mType && E_TOKEN_TYPE::KEYWORD != _peekToken(false).mType)
+					{
+						mResult.mIsValid = false;
+						return;
+					}
+
+					_emit(E_EXPRESSION_OPCODE::PUSH_DEFINED, _addIdentifier(mTokens[mCurrTokenIndex++]));
+
+					if (hasBrackets)
+					{
+						_expect(E_TOKEN_TYPE::CLOSE_BRACKET);
+					}
+
+					return;
+				}
+
+				mResult.mHasMacroOperands = true;
+
+				if (E_TOKEN_TYPE::OPEN_BRACKET != _peekToken().mType)
+				{
+					_emit(E_EXPRESSION_OPCODE::PUSH_IDENTIFIER, _addIdentifier(identifierToken));
+					return;
+				}
+
+				/// \note Tokens of the invocation are stored as is, they're expanded only if the call is evaluated
+				uint32_t nestingLevel = 0;
+
+				do
+				{
+					switch (mTokens[mCurrTokenIndex++].mType)
+					{
+						case E_TOKEN_TYPE::OPEN_BRACKET:
+							++nestingLevel;
+							break;
+						case E_TOKEN_TYPE::CLOSE_BRACKET:
+							--nestingLevel;
+							break;
+						default:
+							break;
+					}
+				} 
+				while (nestingLevel && mCurrTokenIndex < mTokens.size());
+
+				if (nestingLevel)
+				{
+					mResult.mIsValid = false;
+					return;
+				}
+
+				mResult.mMacroCalls.emplace_back(mTokens.cbegin() + identifierIndex, mTokens.cbegin() + mCurrTokenIndex);
+				_emit(E_EXPRESSION_OPCODE::PUSH_MACRO_CALL, static_cast<intmax_t>(mResult.mMacroCalls.size() - 1));
+			}
+
+			static uint32_t _getPrecedence(E_TOKEN_TYPE type) TCPP_NOEXCEPT
+			{
+				switch (type)
+				{
+					case E_TOKEN_TYPE::STAR:
+					case E_TOKEN_TYPE::SLASH:
+					case E_TOKEN_TYPE::PERCENT:
+						return 10;
+					case E_TOKEN_TYPE::PLUS:
+					case E_TOKEN_TYPE::MINUS:
+						return 9;
+					case E_TOKEN_TYPE::LSHIFT:
+					case E_TOKEN_TYPE::RSHIFT:
+						return 8;
+					case E_TOKEN_TYPE::LESS:
+					case E_TOKEN_TYPE::GREATER:
+					case E_TOKEN_TYPE::LE:
+					case E_TOKEN_TYPE::GE:
+						return 7;
+					case E_TOKEN_TYPE::EQ:
+					case E_TOKEN_TYPE::NE:
+						return 6;
+					case E_TOKEN_TYPE::AMPERSAND:
+						return 5;
+					case E_TOKEN_TYPE::CARET:
+						return 4;
+					case E_TOKEN_TYPE::VLINE:
+						return 3;
+					case E_TOKEN_TYPE::AND:
+						return 2;
+					case E_TOKEN_TYPE::OR:
+						return 1;
+					default:
+						return 0;
+				}
+			}
+
+			static E_EXPRESSION_OPCODE _getBinaryOpCode(E_TOKEN_TYPE type) TCPP_NOEXCEPT
+			{
+				switch (type)
+				{
+					case E_TOKEN_TYPE::STAR:
+						return E_EXPRESSION_OPCODE::MUL;
+					case E_TOKEN_TYPE::SLASH:
+						return E_EXPRESSION_OPCODE::DIV;
+					case E_TOKEN_TYPE::PERCENT:
+						return E_EXPRESSION_OPCODE::MOD;
+					case E_TOKEN_TYPE::PLUS:
+						return E_EXPRESSION_OPCODE::ADD;
+					case E_TOKEN_TYPE::MINUS:
+						return E_EXPRESSION_OPCODE::SUB;
+					case E_TOKEN_TYPE::LSHIFT:
+						return E_EXPRESSION_OPCODE::LSHIFT;
+					case E_TOKEN_TYPE::RSHIFT:
+						return E_EXPRESSION_OPCODE::RSHIFT;
+					case E_TOKEN_TYPE::LESS:
+						return E_EXPRESSION_OPCODE::LESS;
+					case E_TOKEN_TYPE::GREATER:
+						return E_EXPRESSION_OPCODE::GREATER;
+					case E_TOKEN_TYPE::LE:
+						return E_EXPRESSION_OPCODE::LE;
+					case E_TOKEN_TYPE::GE:
+						return E_EXPRESSION_OPCODE::GE;
+					case E_TOKEN_TYPE::EQ:
+						return E_EXPRESSION_OPCODE::EQ;
+					case E_TOKEN_TYPE::NE:
+						return E_EXPRESSION_OPCODE::NE;
+					case E_TOKEN_TYPE::AMPERSAND:
+						return E_EXPRESSION_OPCODE::BIT_AND;
+					case E_TOKEN_TYPE::CARET:
+						return E_EXPRESSION_OPCODE::BIT_XOR;
+					default:
+						return E_EXPRESSION_OPCODE::BIT_OR;
+				}
+			}
+		private:
+			std::vector<TToken> mTokens;
+			size_t mCurrTokenIndex;
+			size_t mFirstUnresolvedTokenIndex; ///< Macros before the index have been already resolved
+
+			const TExpressionMacroResolver& mResolveMacro;
+
+			TCompiledExpression& mResult;
+	};
+
+
+	std::vector<TMacroBodyChunk> CompileMacroBody(const TMacroDesc& macroDesc) TCPP_NOEXCEPT
+	{
+		std::vector<TMacroBodyChunk> chunks;
+
+		const std::vector<TToken>& body = macroDesc.mValue;
+		const std::vector<std::string>& argsNames = macroDesc.mArgsNames;
+
+		auto findOperator = [&body](size_t index, int direction)
+		{
+			for (index += direction; index < body.size(); index += direction) // \note The index wraps around when it goes below zero
+			{
+				if (E_TOKEN_TYPE::SPACE != body[index].mType)
+				{
+					return body[index].mType;
+				}
+			}
+
+			return E_TOKEN_TYPE::END;
+		};
+
+		for (size_t i = 0; i < body.size(); ++i)
+		{
+			const TToken& currToken = body[i];
+
+			auto argIt = (E_TOKEN_TYPE::IDENTIFIER == currToken.mType) ? std::find(argsNames.cbegin(), argsNames.cend(), currToken.mRawView) : argsNames.cend();
+			if (argIt == argsNames.cend())
+			{
+				if (chunks.empty() || !chunks.back().mTokensCount)
+				{
+					TMacroBodyChunk chunk;
+					chunk.mFirstTokenIndex = i;
+
+					chunks.push_back(chunk);
+				}
+
+				++chunks.back().mTokensCount;
+				continue;
+			}
+
+			TMacroBodyChunk slot;
+			slot.mFirstTokenIndex = i;
+			slot.mArgIndex = static_cast<size_t>(std::distance(argsNames.cbegin(), argIt));
+			slot.mIsStringized = (E_TOKEN_TYPE::STRINGIZE_OP == findOperator(i, -1));
+			slot.mIsConcatenated = (E_TOKEN_TYPE::CONCAT_OP == findOperator(i, -1)) || (E_TOKEN_TYPE::CONCAT_OP == findOperator(i, 1));
+
+			chunks.push_back(slot);
+		}
+
+		return chunks;
+	}
+
+
+	TCompiledExpression CompileExpression(const std::vector<TToken>& tokens, const TExpressionMacroResolver& resolveMacro) TCPP_NOEXCEPT
+	{
+		TCompiledExpression result;
+
+		ExpressionCompiler compiler(tokens, resolveMacro, result);
+		compiler.Compile();
+
+		return result;
+	}
+
+
+	bool IsPrimaryExpression(const std::vector<TToken>& tokens) TCPP_NOEXCEPT
+	{
+		auto isSignificant = [](const TToken& token)
+		{
+			return E_TOKEN_TYPE::SPACE != token.mType && E_TOKEN_TYPE::COMMENTARY != token.mType && E_TOKEN_TYPE::NEWLINE != token.mType;
+		};
+
+		auto firstTokenIt = std::find_if(tokens.cbegin(), tokens.cend(), isSignificant);
+		if (firstTokenIt == tokens.cend())
+		{
+			return false;
+		}
+
+		auto lastTokenIt = std::find_if(tokens.crbegin(), tokens.crend(), isSignificant).base() - 1;
+
+		if (firstTokenIt == lastTokenIt)
+		{
+			return E_TOKEN_TYPE::NUMBER == firstTokenIt->mType || E_TOKEN_TYPE::CHAR_LITERAL == firstTokenIt->mType;
+		}
+
+		if (E_TOKEN_TYPE::OPEN_BRACKET != firstTokenIt->mType || E_TOKEN_TYPE::CLOSE_BRACKET != lastTokenIt->mType)
+		{
+			return false;
+		}
+
+		/// \note The first bracket should be closed by the last one, e.g. (1) + (2) isn't a primary expression
+		uint32_t nestingLevel = 0;
+
+		for (auto it = firstTokenIt; it != lastTokenIt; ++it)
+		{
+			if (E_TOKEN_TYPE::OPEN_BRACKET == it->mType)
+			{
+				++nestingLevel;
+			}
+			else if (E_TOKEN_TYPE::CLOSE_BRACKET == it->mType && !--nestingLevel)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+
+	void BuildConditionalSkeleton(TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT
+	{
+		const std::vector<TToken>& tokens = tokensBuffer.mTokens;
+
+		std::vector<TConditionalDirectiveInfo>& directives = tokensBuffer.mConditionalDirectives;
+		directives.clear();
+
+		/// \note Every level keeps directives which blocks are ended by the next branch of the level
+		std::vector<std::vector<size_t>> pendingDirectives(1);
+
+		auto resolvePendingDirectives = [&directives, &pendingDirectives](size_t tokenIndex)
+		{
+			for (size_t currDirectiveIndex : pendingDirectives.back())
+			{
+				directives[currDirectiveIndex].mNextBranchTokenIndex = tokenIndex;
+			}
+
+			pendingDirectives.back().clear();
+		};
+
+		auto compileCondition = [&tokens](size_t tokenIndex)
+		{
+			std::vector<TToken> expressionTokens;
+
+			for (size_t i = tokenIndex + 1; i < tokens.size() && E_TOKEN_TYPE::NEWLINE != tokens[i].mType && E_TOKEN_TYPE::END != tokens[i].mType; ++i)
+			{
+				expressionTokens.push_back(tokens[i]);
+			}
+
+			return std::make_shared<const TCompiledExpression>(CompileExpression(expressionTokens));
+		};
+
+		for (size_t i = 0; i < tokens.size(); ++i)
+		{
+			TConditionalDirectiveInfo directiveInfo;
+			directiveInfo.mTokenIndex = i;
+			directiveInfo.mNextBranchTokenIndex = tokens.size();
+
+			switch (tokens[i].mType)
+			{
+				case E_TOKEN_TYPE::IF:
+				case E_TOKEN_TYPE::IFDEF:
+				case E_TOKEN_TYPE::IFNDEF:
+					if (E_TOKEN_TYPE::IF == tokens[i].mType)
+					{
+						directiveInfo.mpCondition = compileCondition(i);
+					}
+
+					pendingDirectives.emplace_back(1, directives.size());
+					break;
+				case E_TOKEN_TYPE::ELIF:
+				case E_TOKEN_TYPE::ELSE:
+					if (E_TOKEN_TYPE::ELIF == tokens[i].mType)
+					{
+						directiveInfo.mpCondition = compileCondition(i);
+					}
+
+					resolvePendingDirectives(i);
+					pendingDirectives.back().push_back(directives.size());
+					break;
+				case E_TOKEN_TYPE::ENDIF:
+					resolvePendingDirectives(i);
+
+					if (pendingDirectives.size() > 1) // \note Unbalanced #endif is processed as a branch of the top level
+					{
+						pendingDirectives.pop_back();
+					}
+
+					pendingDirectives.back().push_back(directives.size());
+					break;
+				default:
+					continue;
+			}
+
+			directives.push_back(std::move(directiveInfo));
+		}
+	}
+
+
+	std::string ErrorTypeToString(const E_ERROR_TYPE& errorType) TCPP_NOEXCEPT
+	{
+		switch (errorType)
+		{
+			case E_ERROR_TYPE::UNEXPECTED_TOKEN:
+				return "Unexpected token";
+			case E_ERROR_TYPE::UNBALANCED_ENDIF:
+				return "Unbalanced endif";
+			case E_ERROR_TYPE::INVALID_MACRO_DEFINITION:
+				return "Invalid macro definition";
+			case E_ERROR_TYPE::MACRO_ALREADY_DEFINED:
+				return "The macro is already defined";
+			case E_ERROR_TYPE::INCONSISTENT_MACRO_ARITY:
+				return "Inconsistent number of arguments between definition and invocation of the macro";
+			case E_ERROR_TYPE::UNDEFINED_MACRO:
+				return "Undefined macro";
+			case E_ERROR_TYPE::INVALID_INCLUDE_DIRECTIVE:
+				return "Invalid #include directive";
+			case E_ERROR_TYPE::UNEXPECTED_END_OF_INCLUDE_PATH:
+				return "Unexpected end of include path";
+			case E_ERROR_TYPE::ANOTHER_ELSE_BLOCK_FOUND:
+				return "#else directive should be last one";
+			case E_ERROR_TYPE::ELIF_BLOCK_AFTER_ELSE_FOUND:
+				return "#elif found after #else block";
+			case E_ERROR_TYPE::UNDEFINED_DIRECTIVE:
+				return "Undefined directive";
+			case E_ERROR_TYPE::INCORRECT_OPERATION_USAGE:
+				return "Incorrect operation usage";
+			case E_ERROR_TYPE::INCORRECT_STRINGIFY_OPERATOR_USAGE:
+				return "Incorrect usage of stringification operation";
+		}
+
+		return "";
+	}
+
+
+	StringInputStream::StringInputStream(const std::string& source) TCPP_NOEXCEPT:
+		IInputStream(), mSourceStr(source)
+	{
+	}
+
+	StringInputStream::StringInputStream(const StringInputStream& inputStream) TCPP_NOEXCEPT:
+		mSourceStr(inputStream.mSourceStr)
+	{
+	}
+	
+	StringInputStream::StringInputStream(StringInputStream&& inputStream) TCPP_NOEXCEPT:
+		mSourceStr(std::move(inputStream.mSourceStr))
+	{
+	}
+
+	std::string StringInputStream::ReadLine() TCPP_NOEXCEPT
+	{
+		std::string::size_type pos = mSourceStr.find_first_of('\n');
+		pos = (pos == std::string::npos) ? pos : (pos + 1);
+
+		std::string currLine = mSourceStr.substr(0, pos);
+		mSourceStr.erase(0, pos);
+
+		return currLine;
+	}
+
+	bool StringInputStream::HasNextLine() const TCPP_NOEXCEPT
+	{
+		return !mSourceStr.empty();
+	}
+
+	StringInputStream& StringInputStream::operator= (const StringInputStream& stream) TCPP_NOEXCEPT
+	{
+		mSourceStr = stream.mSourceStr;
+		return *this;
+	}
+
+	StringInputStream& StringInputStream::operator= (StringInputStream&& stream) TCPP_NOEXCEPT
+	{
+		mSourceStr = std::move(stream.mSourceStr);
+		return *this;
+	}
+
+
+	TokensInputStream::TokensInputStream(TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT:
+		IInputStream(), mpTokensBuffer(pTokensBuffer)
+	{
+	}
+
+	std::string TokensInputStream::ReadLine() TCPP_NOEXCEPT
+	{
+		return "";
+	}
+
+	bool TokensInputStream::HasNextLine() const TCPP_NOEXCEPT
+	{
+		return false;
+	}
+
+	TTokensBufferSharedPtr TokensInputStream::GetTokensBuffer() const TCPP_NOEXCEPT
+	{
+		return mpTokensBuffer;
+	}
+
+
+	static constexpr uint32_t TokensFormatVersion = 6; ///< Should be increased every time when the lexer starts to produce different tokens
+
+
+	static constexpr E_TOKEN_TYPE LastTokenType = E_TOKEN_TYPE::PRAGMA;
+
+
+	static uint64_t ComputeHash(const void* pData, size_t size, uint64_t seed = 14695981039346656037ull) TCPP_NOEXCEPT
+	{
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+		uint64_t hash = seed; // \note FNV-1a
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= pBytes[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+
+	static uint64_t ComputeHash(const std::string& str, uint64_t seed = 14695981039346656037ull) TCPP_NOEXCEPT
+	{
+		return ComputeHash(str.data(), str.length(), seed);
+	}
+
+
+	static std::string KeyToHexString(uint64_t key) TCPP_NOEXCEPT
+	{
+		static const char hexDigits[] = "0123456789abcdef";
+
+		std::string hexStr(16, '0');
+		for (size_t i = 0; i < 16; ++i)
+		{
+			hexStr[15 - i] = hexDigits[(key >> (i * 4)) & 0xF];
+		}
+
+		return hexStr;
+	}
+
+
+	template <typename T>
+	static void AppendBytes(std::string& str, const T& value) TCPP_NOEXCEPT
+	{
+		str.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+
+	static const std::unordered_set<std::string> KeywordsTable
+	{
+		"auto", "double", "int", "struct",
+		"break", "else", "long", "switch",
+		"case", "enum", "register", "typedef",
+		"char", "extern", "return", "union",
+		"const", "float", "short", "unsigned",
+		"continue", "for", "signed", "void",
+		"default", "goto", "sizeof", "volatile",
+		"do", "if", "static", "while"
+	};
+
+
+	const TToken Lexer::mEOFToken = { E_TOKEN_TYPE::END };
+
+	Lexer::Lexer(TInputStreamUniquePtr pIinputStream) TCPP_NOEXCEPT:
+		mDirectivesTable
+		{
+			{ "define", E_TOKEN_TYPE::DEFINE },
+			{ "ifdef", E_TOKEN_TYPE::IFDEF },
+			{ "ifndef", E_TOKEN_TYPE::IFNDEF },
+			{ "if", E_TOKEN_TYPE::IF },
+			{ "else", E_TOKEN_TYPE::ELSE },
+			{ "elif", E_TOKEN_TYPE::ELIF },
+			{ "undef", E_TOKEN_TYPE::UNDEF },
+			{ "endif", E_TOKEN_TYPE::ENDIF },
+			{ "include", E_TOKEN_TYPE::INCLUDE },
+			{ "defined", E_TOKEN_TYPE::DEFINED },
+			{ "pragma", E_TOKEN_TYPE::PRAGMA },
+		}, mCurrLine(), mCurrLineIndex(0)
+	{
+		mConfigHash = _computeConfigHash();
+
+		PushStream(std::move(pIinputStream));
+	}
+
+	bool Lexer::AddCustomDirective(const std::string& directive) TCPP_NOEXCEPT
+	{
+		if (mCustomDirectivesMap.find(directive) != mCustomDirectivesMap.cend())
+		{
+			return false;
+		}
+
+		mCustomDirectivesMap.insert(directive);
+		mConfigHash = _computeConfigHash();
+
+		return true;
+	}
+
+	TToken Lexer::GetNextToken() TCPP_NOEXCEPT
+	{
+		return _getNextTokenInternal(false);
+	}
+
+	TToken Lexer::PeekNextToken(size_t offset)
+	{
+		if (!mTokensQueue.empty() && offset < mTokensQueue.size())
+		{
+			return *std::next(mTokensQueue.begin(), offset);
+		}
+
+		const size_t count = offset - mTokensQueue.size();
+		for (size_t i = 0; i < count; i++)
+		{
+			mTokensQueue.push_back(_getNextTokenInternal(true));
+		}
+
+		if (mTokensQueue.empty())
+		{
+			return GetNextToken();
+		}
+
+		return mTokensQueue.back();
+	}
+
+	bool Lexer::HasNextToken() const TCPP_NOEXCEPT
+	{
+		if (_isReplayingTokens())
+		{
+			const TStreamContext& context = mStreamsContext.top();
+			return (context.mCurrTokenIndex < context.mpTokensBuffer->mTokens.size()) || !mCurrLine.empty() || !mTokensQueue.empty();
+		}
+
+		IInputStream* pCurrInputStream = _getActiveStream();
+		return (pCurrInputStream ? pCurrInputStream->HasNextLine() : false) || !mCurrLine.empty() || !mTokensQueue.empty();
+	}
+
+	void Lexer::AppendFront(const std::vector<TToken>& tokens) TCPP_NOEXCEPT
+	{
+		mTokensQueue.insert(mTokensQueue.begin(), tokens.begin(), tokens.end());
+	}
+
+	void Lexer::PushStream(TInputStreamUniquePtr stream) TCPP_NOEXCEPT
+	{
+		TCPP_ASSERT(stream);
+
+		if (!stream)
+		{
+			return;
+		}
+
+		TStreamContext context;
+		context.mpTokensBuffer = stream->GetTokensBuffer();
+		context.mFirstLineIndex = mCurrLineIndex;
+		context.mpStream = std::move(stream);
+
+		mStreamsContext.push(std::move(context));
+	}
+
+	void Lexer::PushStream(TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT
+	{
+		TCPP_ASSERT(pTokensBuffer);
+
+		if (!pTokensBuffer)
+		{
+			return;
+		}
+
+		PushStream(std::make_unique<TokensInputStream>(pTokensBuffer));
+	}
+
+	void Lexer::PopStream() TCPP_NOEXCEPT
+	{
+		if (mStreamsContext.empty())
+		{
+			return;
+		}
+
+		if (_isReplayingTokens())
+		{
+			/// \note Skip lines of the replayed stream as it was read
+			const TStreamContext& context = mStreamsContext.top();
+			mCurrLineIndex = std::max(mCurrLineIndex, context.mFirstLineIndex + context.mNestedLinesCount + context.mpTokensBuffer->mLinesCount);
+		}
+
+		const size_t firstLineIndex = mStreamsContext.top().mFirstLineIndex;
+
+		mStreamsContext.pop();
+
+		if (_isReplayingTokens())
+		{
+			/// \note Lines of nested streams are counted in the same way as if the parent one was scanned line by line
+			mStreamsContext.top().mNestedLinesCount += mCurrLineIndex - firstLineIndex;
+		}
+	}
+
+	TTokensBufferSharedPtr Lexer::Tokenize(TInputStreamUniquePtr stream) const TCPP_NOEXCEPT
+	{
+		if (!stream)
+		{
+			return nullptr;
+		}
+
+		if (auto pTokensBuffer = stream->GetTokensBuffer())
+		{
+			return pTokensBuffer;
+		}
+
+		Lexer lexer(std::move(stream));
+		lexer.mCustomDirectivesMap = mCustomDirectivesMap;
+		lexer.mConfigHash = mConfigHash;
+
+		auto pTokensBuffer = std::make_shared<TTokensBuffer>();
+
+		while (lexer.HasNextToken())
+		{
+			TToken currToken = lexer.GetNextToken();
+			if (E_TOKEN_TYPE::END == currToken.mType)
+			{
+				continue;
+			}
+
+			pTokensBuffer->mTokens.push_back(std::move(currToken));
+		}
+
+		pTokensBuffer->mLinesCount = lexer.mCurrLineIndex;
+
+		BuildConditionalSkeleton(*pTokensBuffer);
+
+		return pTokensBuffer;
+	}
+
+	TContentSharedPtr Lexer::ReadActiveStream() TCPP_NOEXCEPT
+	{
+		if (mStreamsContext.empty() || _isReplayingTokens() || !mCurrLine.empty() || !mTokensQueue.empty())
+		{
+			return nullptr;
+		}
+
+		TInputStreamUniquePtr pStream = std::move(mStreamsContext.top().mpStream);
+		mStreamsContext.pop();
+
+		std::string content;
+
+		while (pStream->HasNextLine())
+		{
+			content.append(pStream->ReadLine());
+		}
+
+		auto pContent = std::make_shared<const std::string>(std::move(content));
+		PushStream(std::make_unique<SharedContentInputStream>(pContent));
+
+		return pContent;
+	}
+
+	std::shared_ptr<const TCompiledExpression> Lexer::GetPrecompiledCondition() const TCPP_NOEXCEPT
+	{
+		if (!_isReplayingTokens() || !mTokensQueue.empty())
+		{
+			return nullptr;
+		}
+
+		const TStreamContext& context = mStreamsContext.top();
+		const std::vector<TConditionalDirectiveInfo>& directives = context.mpTokensBuffer->mConditionalDirectives;
+
+		if (!context.mCurrTokenIndex)
+		{
+			return nullptr;
+		}
+
+		auto it = std::lower_bound(directives.cbegin(), directives.cend(), context.mCurrTokenIndex - 1, [](const TConditionalDirectiveInfo& directiveInfo, size_t tokenIndex)
+		{
+			return directiveInfo.mTokenIndex < tokenIndex;
+		});
+
+		return (it != directives.cend() && it->mTokenIndex + 1 == context.mCurrTokenIndex) ? it->mpCondition : nullptr;
+	}
+
+	TTokensBufferSharedPtr Lexer::TokenizeActiveStream() TCPP_NOEXCEPT
+	{
+		if (mStreamsContext.empty())
+		{
+			return nullptr;
+		}
+
+		if (_isReplayingTokens())
+		{
+			return mStreamsContext.top().mpTokensBuffer;
+		}
+
+		TInputStreamUniquePtr pStream = std::move(mStreamsContext.top().mpStream);
+		mStreamsContext.pop();
+
+		auto pTokensBuffer = Tokenize(std::move(pStream));
+		PushStream(pTokensBuffer);
+
+		return pTokensBuffer;
+	}
+
+	uint64_t Lexer::GetConfigHash() const TCPP_NOEXCEPT
+	{
+		return mConfigHash;
+	}
+
+	size_t Lexer::GetCurrLineIndex() const TCPP_NOEXCEPT
+	{
+		return mCurrLineIndex;
+	}
+
+	size_t Lexer::GetStreamsCount() const TCPP_NOEXCEPT
+	{
+		return mStreamsContext.size();
+	}
+
+	size_t Lexer::GetCurrPos() const TCPP_NOEXCEPT
+	{
+		return mCurrPos;
+	}
+
+
+	static std::tuple<size_t, char> EatNextChar(std::string& str, size_t pos, size_t count = 1)
+	{
+		str.erase(0, count);
+		return { pos + count, str.empty() ? static_cast<char>(EOF) : str.front() };
+	}
+
+
+	static char PeekNextChar(const std::string& str, size_t step = 1)
+	{
+		return (step < str.length()) ? str[step] : static_cast<char>(EOF);
+	}
+
+
+	static std::string ExtractSingleLineComment(const std::string& currInput) TCPP_NOEXCEPT
+	{
+		std::stringstream ss(currInput);
+		std::string commentStr;
+
+		std::getline(ss, commentStr, '\n');
+		return commentStr;
+	}
+
+
+	static std::string ExtractMultiLineComments(std::string& currInput, const std::function<std::string()>& requestNextLineFunctor) TCPP_NOEXCEPT
+	{
+		std::string input = currInput;
+		std::string commentStr;
+
+		// \note here below all states of DFA are placed
+		std::function<std::string(std::string&)> enterCommentBlock = [&enterCommentBlock, &commentStr, requestNextLineFunctor](std::string& input)
+		{
+			commentStr.append(input.substr(0, 2));
+			input.erase(0, 2); // \note remove /*
+
+			while (input.rfind("*/", 0) != 0 && !input.empty())
+			{
+				commentStr.push_back(input.front());
+				input.erase(0, 1);
+
+				if (input.rfind("//", 0) == 0)
+				{
+					commentStr.append(input.substr(0, 2));
+					input.erase(0, 2);
+				}
+
+				if (input.rfind("/*", 0) == 0)
+				{
+					input = enterCommentBlock(input);
+				}
+
+				if (input.empty() && requestNextLineFunctor)
+				{
+					input = requestNextLineFunctor();
+				}
+			}
+
+			commentStr.append(input.substr(0, 2));
+			input.erase(0, 2); // \note remove */
+
+			return input;
+		};
+
+		std::string::size_type pos = input.find("/*");
+		if (pos != std::string::npos)
+		{
+			std::string restStr = input.substr(pos, std::string::npos);
+			enterCommentBlock(restStr);
+
+			currInput = commentStr + restStr;
+			
+			return commentStr;
+		}
+
+		return commentStr;
+	}
+
+
+	TToken Lexer::_getNextTokenInternal(bool ignoreQueue) TCPP_NOEXCEPT
+	{
+		if (!ignoreQueue && !mTokensQueue.empty())
+		{
+			auto currToken = mTokensQueue.front();
+			mTokensQueue.pop_front();
+
+			return currToken;
+		}
+
+		if (mCurrLine.empty())
+		{
+			if (_isReplayingTokens())
+			{
+				return _replayNextToken(mStreamsContext.top());
+			}
+
+			// \note if it's still empty then we've reached the end of the source
+			if ((mCurrLine = _requestSourceLine()).empty())
+			{
+				return mEOFToken;
+			}
+		}
+
+		return _scanTokens(mCurrLine);
+	}
+
+	TToken Lexer::_replayNextToken(TStreamContext& context) TCPP_NOEXCEPT
+	{
+		const std::vector<TToken>& tokens = context.mpTokensBuffer->mTokens;
+
+		if (context.mCurrTokenIndex >= tokens.size())
+		{
+			mCurrLineIndex = context.mFirstLineIndex + context.mNestedLinesCount + context.mpTokensBuffer->mLinesCount;
+			return mEOFToken;
+		}
+
+		TToken currToken = tokens[context.mCurrTokenIndex++];
+		currToken.mLineId += context.mFirstLineIndex + context.mNestedLinesCount;
+
+		mCurrLineIndex = currToken.mLineId;
+		mCurrPos = currToken.mPos;
+
+		return currToken;
+	}
+
+	enum class E_CONDITIONAL_DIRECTIVE_TYPE : uint8_t
+	{
+		NONE,
+		IF,     ///< #if, #ifdef, #ifndef
+		BRANCH, ///< #elif, #else
+		ENDIF,
+	};
+
+
+	static bool IsIdentifierChar(char ch) TCPP_NOEXCEPT
+	{
+		return ch == '_' || std::isalnum(static_cast<unsigned char>(ch));
+	}
+
+
+	static E_CONDITIONAL_DIRECTIVE_TYPE GetConditionalDirectiveType(const std::string& line, size_t pos) TCPP_NOEXCEPT
+	{
+		while (pos < line.length() && std::isspace(static_cast<unsigned char>(line[pos]))) /// \note Whitespaces between # and the directive are allowed
+		{
+			++pos;
+		}
+
+		size_t endPos = pos;
+		while (endPos < line.length() && IsIdentifierChar(line[endPos]))
+		{
+			++endPos;
+		}
+
+		/// \note The whole name is compared, so identifiers like ifdef_x aren't taken for directives
+		auto isDirective = [&line, pos, endPos](const char* pDirectiveName)
+		{
+			return !line.compare(pos, endPos - pos, pDirectiveName);
+		};
+
+		if (isDirective("if") || isDirective("ifdef") || isDirective("ifndef"))
+		{
+			return E_CONDITIONAL_DIRECTIVE_TYPE::IF;
+		}
+
+		if (isDirective("else") || isDirective("elif"))
+		{
+			return E_CONDITIONAL_DIRECTIVE_TYPE::BRANCH;
+		}
+
+		if (isDirective("endif"))
+		{
+			return E_CONDITIONAL_DIRECTIVE_TYPE::ENDIF;
+		}
+
+		return E_CONDITIONAL_DIRECTIVE_TYPE::NONE;
+	}
+
+
+	bool Lexer::SkipInactiveBlock() TCPP_NOEXCEPT
+	{
+		if (!mTokensQueue.empty())
+		{
+			return false;
+		}
+
+		if (_isReplayingTokens())
+		{
+			_skipInactiveTokens(mStreamsContext.top());
+			return true;
+		}
+
+		std::string currLine = std::move(mCurrLine);
+		mCurrLine.clear();
+
+		size_t nestingLevel = 0;
+		bool isCommentBlock = false;
+
+		while (!currLine.empty() || !(currLine = _requestSourceLine()).empty())
+		{
+			const size_t length = currLine.length();
+
+			/// \note Most of lines contain neither directives nor comments, so they're thrown away at once
+			if (!isCommentBlock && !std::memchr(currLine.data(), '#', length) && !std::memchr(currLine.data(), '/', length))
+			{
+				currLine.clear();
+				continue;
+			}
+
+			for (size_t pos = 0; pos < length; ++pos)
+			{
+				const char ch = currLine[pos];
+
+				if (isCommentBlock)
+				{
+					if (ch == '*' && PeekNextChar(currLine, pos + 1) == '/')
+					{
+						isCommentBlock = false;
+						++pos;
+					}
+
+					continue;
+				}
+
+				switch (ch)
+				{
+					case '/':
+						if (PeekNextChar(currLine, pos + 1) == '/')
+						{
+							pos = length;
+						}
+						else if (PeekNextChar(currLine, pos + 1) == '*')
+						{
+							isCommentBlock = true;
+							++pos;
+						}
+						break;
+					case '\"':
+					case '\'':
+						{
+							/// \note Directives within literals are ignored, unterminated literals are processed as separate symbols
+							size_t endPos = pos + 1;
+							while (endPos < length && currLine[endPos] != ch)
+							{
+								endPos += (currLine[endPos] == '\\') ? 2 : 1;
+							}
+
+							if (endPos < length)
+							{
+								pos = endPos;
+							}
+						}
+						break;
+					case '#':
+						{
+							/// \note Concatenation operators within #define can't start directives, e.g. a##if
+							if (PeekNextChar(currLine, pos + 1) == '#')
+							{
+								++pos;
+								break;
+							}
+
+							const E_CONDITIONAL_DIRECTIVE_TYPE directiveType = GetConditionalDirectiveType(currLine, pos + 1);
+
+							if (E_CONDITIONAL_DIRECTIVE_TYPE::IF == directiveType)
+							{
+								++nestingLevel;
+							}
+							else if (E_CONDITIONAL_DIRECTIVE_TYPE::NONE != directiveType)
+							{
+								if (!nestingLevel)
+								{
+									/// \note The directive is left to be scanned as usual
+									mCurrLine = currLine.substr(pos);
+									mCurrPos = pos;
+
+									return true;
+								}
+
+								nestingLevel -= (E_CONDITIONAL_DIRECTIVE_TYPE::ENDIF == directiveType) ? 1 : 0;
+							}
+						}
+						break;
+				}
+			}
+
+			currLine.clear();
+		}
+
+		return true;
+	}
+
+	void Lexer::_skipInactiveTokens(TStreamContext& context) TCPP_NOEXCEPT
+	{
+		const std::vector<TConditionalDirectiveInfo>& directives = context.mpTokensBuffer->mConditionalDirectives;
+
+		while (context.mNextConditionalIndex < directives.size() && directives[context.mNextConditionalIndex].mTokenIndex < context.mCurrTokenIndex)
+		{
+			++context.mNextConditionalIndex;
+		}
+
+		/// \note There are no conditional directives between the last one and the current token, so the block ends at the same branch
+		if (context.mNextConditionalIndex)
+		{
+			context.mCurrTokenIndex = std::max(context.mCurrTokenIndex, directives[context.mNextConditionalIndex - 1].mNextBranchTokenIndex);
+			return;
+		}
+
+		const std::vector<TToken>& tokens = context.mpTokensBuffer->mTokens;
+
+		size_t nestingLevel = 0;
+
+		for (; context.mCurrTokenIndex < tokens.size(); ++context.mCurrTokenIndex)
+		{
+			switch (tokens[context.mCurrTokenIndex].mType)
+			{
+				case E_TOKEN_TYPE::IF:
+				case E_TOKEN_TYPE::IFDEF:
+				case E_TOKEN_TYPE::IFNDEF:
+					++nestingLevel;
+					break;
+				case E_TOKEN_TYPE::ELIF:
+				case E_TOKEN_TYPE::ELSE:
+					if (!nestingLevel)
+					{
+						return;
+					}
+					break;
+				case E_TOKEN_TYPE::ENDIF:
+					if (!nestingLevel)
+					{
+						return;
+					}
+
+					--nestingLevel;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	TToken Lexer::_scanTokens(std::string& inputLine) TCPP_NOEXCEPT
+	{
+		char ch = '\0';
+
+		static const std::string separators = ",()[]<>\"+-*/&|!=;%^~?:";
+
+		std::string currStr = "";
+
+		while (!inputLine.empty())
+		{
+			ch = inputLine.front();
+
+			if (ch == '.' && PeekNextChar(inputLine, 1) == '.' && PeekNextChar(inputLine, 2) == '.')
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+				}
+
+				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, 3));
+				return { E_TOKEN_TYPE::ELLIPSIS, "...", mCurrLineIndex, mCurrPos };
+			}
+
+			if (ch == '/')
+			{
+				std::string commentStr;
+
+				if (PeekNextChar(inputLine, 1) == '/') // \note Found a single line C++ style comment
+				{
+					commentStr = ExtractSingleLineComment(inputLine);
+				}
+				else if (PeekNextChar(inputLine, 1) == '*') /// \note multi-line commentary
+				{
+					commentStr = ExtractMultiLineComments(inputLine, std::bind(&Lexer::_requestSourceLine, this));
+				}
+
+				if (!commentStr.empty())
+				{
+					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, commentStr.length()));
+					return { E_TOKEN_TYPE::COMMENTARY, commentStr, mCurrLineIndex, mCurrPos };
+				}
+			}
+
+			if (ch == '\n' || ch == '\r')
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex };
+				}
+
+				std::string separatorStr;
+				separatorStr.push_back(ch);
+
+				const char nextCh = PeekNextChar(inputLine, 1);
+				if (ch == '\r' && nextCh == '\n')
+				{
+					separatorStr.push_back(nextCh);
+				}
+
+				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, separatorStr.length()));
+				return { E_TOKEN_TYPE::NEWLINE, separatorStr, mCurrLineIndex, mCurrPos};
+			}
+
+			if (std::isspace(ch))
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+				}
+
+				/// \note The whole run of whitespaces is emitted as a single token
+				std::string::size_type length = 1;
+				while (length < inputLine.length() && std::isspace(inputLine[length]) && inputLine[length] != '\n' && inputLine[length] != '\r')
+				{
+					++length;
+				}
+
+				std::string separatorStr = inputLine.substr(0, length);
+
+				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, length));
+				return { E_TOKEN_TYPE::SPACE, std::move(separatorStr), mCurrLineIndex, mCurrPos };
+			}
+
+			if (ch == '#') // \note it could be # operator or a directive
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+				}
+
+				/// \note Skip whitespaces if there're exist
+				do
+				{
+					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+				} 
+				while (std::isspace(PeekNextChar(inputLine, 0)));
+
+				for (const auto& currDirective : mDirectivesTable)
+				{
+					auto&& currDirectiveStr = std::get<std::string>(currDirective);
+
+					if (inputLine.rfind(currDirectiveStr, 0) == 0)
+					{
+						if (E_TOKEN_TYPE::PRAGMA == std::get<E_TOKEN_TYPE>(currDirective) && mCustomDirectivesMap.find(currDirectiveStr) != mCustomDirectivesMap.cend())
+						{
+							break; // \note A custom handler of #pragma takes precedence over the built-in one
+						}
+
+						inputLine.erase(0, currDirectiveStr.length());
+						mCurrPos += currDirectiveStr.length();
+
+						return { std::get<E_TOKEN_TYPE>(currDirective), "", mCurrLineIndex, mCurrPos };
+					}
+				}
+
+				// \note custom directives
+				for (const auto& currDirectiveStr : mCustomDirectivesMap)
+				{
+					if (inputLine.rfind(currDirectiveStr, 0) == 0)
+					{
+						inputLine.erase(0, currDirectiveStr.length());
+						mCurrPos += currDirectiveStr.length();
+
+						return { E_TOKEN_TYPE::CUSTOM_DIRECTIVE, currDirectiveStr, mCurrLineIndex, mCurrPos };
+					}
+				}
+
+				// \note if we've reached this line it's # operator not directive
+				if (!inputLine.empty())
+				{
+					char nextCh = inputLine.front();
+					switch (nextCh)
+					{
+						case '#':	// \note concatenation operator
+							inputLine.erase(0, 1);
+							++mCurrPos;
+							return { E_TOKEN_TYPE::CONCAT_OP, "", mCurrLineIndex, mCurrPos };
+						default:
+							if (nextCh != ' ') // \note stringification operator
+							{
+								return { E_TOKEN_TYPE::STRINGIZE_OP, "", mCurrLineIndex, mCurrPos };
+							}
+
+							return { E_TOKEN_TYPE::BLOB, "#", mCurrLineIndex, mCurrPos };
+					}
+				}
+			}
+
+			if (ch == '\"' || ch == '\'')
+			{
+				/// \note Find the closing quote, escaped ones are skipped
+				std::string::size_type length = 1;
+				while (length < inputLine.length() && inputLine[length] != ch)
+				{
+					length += (inputLine[length] == '\\') ? 2 : 1;
+				}
+
+				if (length < inputLine.length()) // \note Unterminated literals are processed as separate symbols
+				{
+					// flush current blob
+					if (!currStr.empty())
+					{
+						return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+					}
+
+					std::string literal = inputLine.substr(0, length + 1);
+
+					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, literal.length()));
+					return { (ch == '\"') ? E_TOKEN_TYPE::STRING_LITERAL : E_TOKEN_TYPE::CHAR_LITERAL, std::move(literal), mCurrLineIndex, mCurrPos };
+				}
+			}
+
+			if (std::isdigit(ch))
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+				}
+
+				std::string number;
+				std::string::size_type i = 0;
+
+				if (ch == '0' && !inputLine.empty())
+				{
+					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+
+					number.push_back(ch);
+
+					char nextCh = PeekNextChar(inputLine, 0);
+					if (nextCh == 'x' || nextCh == 'X' || std::isdigit(nextCh))
+					{
+						inputLine.erase(0, 1);
+						++mCurrPos;
+
+						number.push_back(nextCh);
+					}
+				}
+
+				const bool isHexadecimal = (number.length() > 1) && (number[1] == 'x' || number[1] == 'X');
+
+				size_t charsToRemove = 0;
+
+				while ((i < inputLine.length()) && (isHexadecimal ? std::isxdigit(ch = inputLine[i++]) : std::isdigit(ch = inputLine[i++])))
+				{
+					number.push_back(ch);
+					++charsToRemove;
+				}
+
+				/// \note Integer suffixes are parts of the number
+				while ((charsToRemove < inputLine.length()) && (ch = inputLine[charsToRemove]) && std::strchr("uUlL", ch))
+				{
+					number.push_back(ch);
+					++charsToRemove;
+				}
+
+				inputLine.erase(0, charsToRemove);
+				mCurrPos += charsToRemove;
+
+				return { E_TOKEN_TYPE::NUMBER, number, mCurrLineIndex, mCurrPos };
+			}
+
+			if (ch == '_' || std::isalpha(ch)) ///< \note parse identifier
+			{
+				// flush current blob
+				if (!currStr.empty())
+				{
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex };
+				}
+
+				std::string identifier;
+
+				do
+				{
+					identifier.push_back(ch);
+					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+				} while (!inputLine.empty() && (std::isalnum(ch = inputLine.front()) || (ch == '_')));
+
+				return { (KeywordsTable.find(identifier) != KeywordsTable.cend()) ? E_TOKEN_TYPE::KEYWORD : E_TOKEN_TYPE::IDENTIFIER, identifier, mCurrLineIndex, mCurrPos };
+			}
+
+			mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+
+			if ((separators.find_first_of(ch) != std::string::npos))
+			{
+				if (!currStr.empty())
+				{
+					auto separatingToken = _scanSeparatorTokens(ch, inputLine);
+					if (separatingToken.mType != mEOFToken.mType)
+					{
+						mTokensQueue.push_front(separatingToken);
+					}
+
+					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos }; // flush current blob
+				}
+
+				auto separatingToken = _scanSeparatorTokens(ch, inputLine);
+				if (separatingToken.mType != mEOFToken.mType)
+				{
+					return separatingToken;
+				}
+			}
+
+			currStr.push_back(ch);
+		}
+
+		// flush current blob
+		if (!currStr.empty())
+		{
+			return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+		}
+
+		PopStream();
+
+		//\note try to continue preprocessing if there is at least one input stream
+		if (!mStreamsContext.empty())
+		{
+			return GetNextToken();
+		}
+
+		return mEOFToken;
+	}
+
+
+	static bool IsEscapeSequenceAtPos(const std::string& str, std::string::size_type pos)
+	{
+		if (pos + 1 >= str.length() || pos >= str.length() || str[pos] != '\\')
+		{
+			return false;
+		}
+
+		static constexpr char escapeSymbols[] { '\'', '\\', 'n', '\"', 'a', 'b', 'f', 'r', 't', 'v' };
+
+		char testedSymbol = str[pos + 1];
+
+		for (char ch : escapeSymbols)
+		{
+			if (ch == testedSymbol)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::string Lexer::_requestSourceLine() TCPP_NOEXCEPT
+	{
+		IInputStream* pCurrInputStream = _getActiveStream();
+
+		if (!pCurrInputStream || !pCurrInputStream->HasNextLine())
+		{
+			return "";
+		}
+
+		std::string sourceLine = pCurrInputStream->ReadLine();
+		++mCurrLineIndex;
+
+		/// \note join lines that were splitted with backslash sign
+		std::string::size_type pos = 0;
+		while (((pos = sourceLine.find_first_of('\\')) != std::string::npos) 
+			&& (std::isspace(PeekNextChar(sourceLine, pos + 1)) || PeekNextChar(sourceLine, pos + 1) == EOF) && !IsEscapeSequenceAtPos(sourceLine, pos))
+		{
+			if (pCurrInputStream->HasNextLine())
+			{
+				sourceLine.replace(pos ? (pos - 1) : 0, std::string::npos, pCurrInputStream->ReadLine());
+				++mCurrLineIndex;
+
+				continue;
+			}
+
+			sourceLine.erase(sourceLine.begin() + pos, sourceLine.end());
+		}
+
+		return sourceLine;
+	}
+
+	TToken Lexer::_scanSeparatorTokens(char ch, std::string& inputLine) TCPP_NOEXCEPT
+	{
+		switch (ch)
+		{
+			case ',':
+				return { E_TOKEN_TYPE::COMMA, ",", mCurrLineIndex, mCurrPos };
+			case '(':
+				return { E_TOKEN_TYPE::OPEN_BRACKET, "(", mCurrLineIndex, mCurrPos };
+			case ')':
+				return { E_TOKEN_TYPE::CLOSE_BRACKET, ")", mCurrLineIndex, mCurrPos }; 
+			case '[':
+				return { E_TOKEN_TYPE::OPEN_SQUARE_BRACKET, "[", mCurrLineIndex, mCurrPos };
+			case ']':
+				return { E_TOKEN_TYPE::CLOSE_SQUARE_BRACKET, "]", mCurrLineIndex, mCurrPos };
+			case '<':
+				if (!inputLine.empty())
+				{
+					char nextCh = inputLine.front();
+					switch (nextCh)
+					{
+						case '<':
+							inputLine.erase(0, 1);
+							++mCurrPos;
+							return { E_TOKEN_TYPE::LSHIFT, "<<", mCurrLineIndex, mCurrPos };
+						case '=':
+							inputLine.erase(0, 1);
+							++mCurrPos;
+							return { E_TOKEN_TYPE::LE, "<=", mCurrLineIndex, mCurrPos };
+					}					
+				}
+
+				return { E_TOKEN_TYPE::LESS, "<", mCurrLineIndex, mCurrPos };
+			case '>':
+				if (!inputLine.empty())
+				{
+					char nextCh = inputLine.front();
+					switch (nextCh)
+					{
+						case '>':
+							inputLine.erase(0, 1);
+							++mCurrPos;
+							return { E_TOKEN_TYPE::RSHIFT, ">>", mCurrLineIndex, mCurrPos };
+						case '=':
+							inputLine.erase(0, 1);
+							++mCurrPos;
+							return { E_TOKEN_TYPE::GE, ">=", mCurrLineIndex, mCurrPos };
+					}
+				}
+
+				return { E_TOKEN_TYPE::GREATER, ">", mCurrLineIndex, mCurrPos };
+			case '\"':
+				return { E_TOKEN_TYPE::QUOTES, "\"", mCurrLineIndex, mCurrPos };
+			case '+':
+				return { E_TOKEN_TYPE::PLUS, "+", mCurrLineIndex, mCurrPos };
+			case '-':
+				return { E_TOKEN_TYPE::MINUS, "-", mCurrLineIndex, mCurrPos };
+			case '*':
+				return { E_TOKEN_TYPE::STAR, "*", mCurrLineIndex, mCurrPos };
+			case '/':
+				return { E_TOKEN_TYPE::SLASH, "/", mCurrLineIndex, mCurrPos };
+			case '&':
+				if (!inputLine.empty() && inputLine.front() == '&')
+				{
+					inputLine.erase(0, 1);
+					++mCurrPos;
+					return { E_TOKEN_TYPE::AND, "&&", mCurrLineIndex, mCurrPos };
+				}
+
+				return { E_TOKEN_TYPE::AMPERSAND, "&", mCurrLineIndex, mCurrPos };
+			case '|':
+				if (!inputLine.empty() && inputLine.front() == '|')
+				{
+					inputLine.erase(0, 1);
+					++mCurrPos;
+					return { E_TOKEN_TYPE::OR, "||", mCurrLineIndex, mCurrPos };
+				}
+
+				return { E_TOKEN_TYPE::VLINE, "|", mCurrLineIndex, mCurrPos };
+			case '!':
+				if (!inputLine.empty() && inputLine.front() == '=')
+				{
+					inputLine.erase(0, 1);
+					++mCurrPos;
+					return { E_TOKEN_TYPE::NE, "!=", mCurrLineIndex, mCurrPos };
+				}
+
+				return { E_TOKEN_TYPE::NOT, "!", mCurrLineIndex, mCurrPos };
+			case '=':
+				if (!inputLine.empty() && inputLine.front() == '=')
+				{
+					inputLine.erase(0, 1);
+					++mCurrPos;
+					return { E_TOKEN_TYPE::EQ, "==", mCurrLineIndex, mCurrPos };
+				}
+
+				return { E_TOKEN_TYPE::BLOB, "=", mCurrLineIndex, mCurrPos };
+
+			case ';':
+				return { E_TOKEN_TYPE::SEMICOLON, ";", mCurrLineIndex, mCurrPos };
+			case '%':
+				return { E_TOKEN_TYPE::PERCENT, "%", mCurrLineIndex, mCurrPos };
+			case '^':
+				return { E_TOKEN_TYPE::CARET, "^", mCurrLineIndex, mCurrPos };
+			case '~':
+				return { E_TOKEN_TYPE::TILDE, "~", mCurrLineIndex, mCurrPos };
+			case '?':
+				return { E_TOKEN_TYPE::QUESTION, "?", mCurrLineIndex, mCurrPos };
+			case ':':
+				return { E_TOKEN_TYPE::COLON, ":", mCurrLineIndex, mCurrPos };
+		}
+
+		return mEOFToken;
+	}
+
+	IInputStream* Lexer::_getActiveStream() const TCPP_NOEXCEPT
+	{
+		return mStreamsContext.empty() ? nullptr : mStreamsContext.top().mpStream.get();
+	}
+
+	bool Lexer::_isReplayingTokens() const TCPP_NOEXCEPT
+	{
+		return !mStreamsContext.empty() && mStreamsContext.top().mpTokensBuffer;
+	}
+
+	uint64_t Lexer::_computeConfigHash() const TCPP_NOEXCEPT
+	{
+		uint64_t hash = ComputeHash(&TokensFormatVersion, sizeof(TokensFormatVersion));
+
+		std::vector<std::string> keywords{ KeywordsTable.cbegin(), KeywordsTable.cend() };
+		std::sort(keywords.begin(), keywords.end());
+
+		for (const std::string& currKeyword : keywords)
+		{
+			hash = ComputeHash(currKeyword + " ", hash);
+		}
+
+		for (const auto& currDirective : mDirectivesTable)
+		{
+			hash = ComputeHash(std::get<std::string>(currDirective) + " ", hash);
+		}
+
+		std::vector<std::string> customDirectives{ mCustomDirectivesMap.cbegin(), mCustomDirectivesMap.cend() };
+		std::sort(customDirectives.begin(), customDirectives.end());
+
+		for (const std::string& currDirective : customDirectives)
+		{
+			hash = ComputeHash("#" + currDirective, hash);
+		}
+
+		return hash;
+	}
+
+
+	typedef struct TFileEntryInfo
+	{
+		std::string mPath;
+		size_t      mSize = 0;
+		time_t      mModificationTime = 0;
+	} TFileEntryInfo, *TFileEntryInfoPtr;
+
+
+	static bool CreateDirectoryIfMissing(const std::string& path) TCPP_NOEXCEPT
+	{
+		struct stat info;
+		if (!stat(path.c_str(), &info))
+		{
+			return (info.st_mode & S_IFDIR) != 0;
+		}
+
+#if defined(_WIN32)
+		return !_mkdir(path.c_str());
+#else
+		return !mkdir(path.c_str(), 0755);
+#endif
+	}
+
+
+	static bool ReadFileContent(const std::string& path, std::string& content) TCPP_NOEXCEPT
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		const std::streamoff size = file.tellg();
+		if (size < 0)
+		{
+			return false;
+		}
+
+		content.resize(static_cast<size_t>(size));
+
+		file.seekg(0, std::ios::beg);
+		return static_cast<bool>(file.read(&content[0], size));
+	}
+
+
+	/*!
+		\brief The function writes content into a temporary file first, then renames it. So other readers 
+		never observe partially written files
+	*/
+
+	static bool WriteFileAtomically(const std::string& path, const std::string& content) TCPP_NOEXCEPT
+	{
+#if defined(_WIN32)
+		const auto processId = _getpid();
+#else
+		const auto processId = getpid();
+#endif
+
+		const std::string tempPath = path + "." + std::to_string(processId) + "_" +
+			std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "_" +
+			std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open() || !file.write(content.data(), static_cast<std::streamsize>(content.length())))
+			{
+				std::remove(tempPath.c_str());
+				return false;
+			}
+		}
+
+		if (std::rename(tempPath.c_str(), path.c_str()))
+		{
+#if defined(_WIN32)
+			/// \note rename doesn't replace existing files on Windows
+			std::remove(path.c_str());
+			if (!std::rename(tempPath.c_str(), path.c_str()))
+			{
+				return true;
+			}
+#endif
+			std::remove(tempPath.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+
+	static std::vector<TFileEntryInfo> ListDirectoryFiles(const std::string& directory, const std::string& extension) TCPP_NOEXCEPT
+	{
+		std::vector<TFileEntryInfo> files;
+
+		auto addFile = [&files, &directory, &extension](const std::string& filename)
+		{
+			if (filename.length() <= extension.length() || filename.compare(filename.length() - extension.length(), extension.length(), extension))
+			{
+				return;
+			}
+
+			TFileEntryInfo fileInfo;
+			fileInfo.mPath = directory + "/" + filename;
+
+			struct stat info;
+			if (stat(fileInfo.mPath.c_str(), &info))
+			{
+				return;
+			}
+
+			fileInfo.mSize = static_cast<size_t>(info.st_size);
+			fileInfo.mModificationTime = info.st_mtime;
+
+			files.push_back(fileInfo);
+		};
+
+#if defined(_WIN32)
+		_finddata_t fileData;
+		intptr_t handle = _findfirst((directory + "/*" + extension).c_str(), &fileData);
+		if (handle == -1)
+		{
+			return files;
+		}
+
+		do
+		{
+			addFile(fileData.name);
+		} 
+		while (!_findnext(handle, &fileData));
+
+		_findclose(handle);
+#else
+		DIR* pDirectory = opendir(directory.c_str());
+		if (!pDirectory)
+		{
+			return files;
+		}
+
+		while (dirent* pEntry = readdir(pDirectory))
+		{
+			addFile(pEntry->d_name);
+		}
+
+		closedir(pDirectory);
+#endif
+
+		return files;
+	}
+
+
+	static void TouchFile(const std::string& path) TCPP_NOEXCEPT
+	{
+#if defined(_WIN32)
+		_utime(path.c_str(), nullptr);
+#else
+		utime(path.c_str(), nullptr);
+#endif
+	}
+
+
+	static size_t GetFileSize(const std::string& path) TCPP_NOEXCEPT ///< Returns 0 if the file doesn't exist
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) ? 0 : static_cast<size_t>(info.st_size);
+	}
+
+
+	/*!
+		\brief The function removes least recently modified files with the given extension until their total size 
+		fits into the limit. The actual size is recomputed every time, because entries could be changed by other 
+		instances and processes
+
+		\return The total size of remaining files
+	*/
+
+	static size_t TrimCacheDirectory(const std::string& directory, const std::string& extension, size_t maxSizeInBytes) TCPP_NOEXCEPT
+	{
+		std::vector<TFileEntryInfo> entries = ListDirectoryFiles(directory, extension);
+
+		size_t currSizeInBytes = 0;
+		for (const TFileEntryInfo& currEntry : entries)
+		{
+			currSizeInBytes += currEntry.mSize;
+		}
+
+		if (currSizeInBytes <= maxSizeInBytes)
+		{
+			return currSizeInBytes;
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const TFileEntryInfo& left, const TFileEntryInfo& right)
+		{
+			return left.mModificationTime < right.mModificationTime;
+		});
+
+		for (const TFileEntryInfo& currEntry : entries)
+		{
+			if (currSizeInBytes <= maxSizeInBytes)
+			{
+				break;
+			}
+
+			if (!std::remove(currEntry.mPath.c_str()))
+			{
+				currSizeInBytes -= std::min(currSizeInBytes, currEntry.mSize);
+			}
+		}
+
+		return currSizeInBytes;
+	}
+
+
+	static const std::string DiskTokensCacheEntryExtension = ".tcpptok";
+
+	static constexpr char DiskTokensCacheMagic[8] = { 'T', 'C', 'P', 'P', 'T', 'O', 'K', '\0' };
+
+	typedef struct TDiskTokensCacheHeader
+	{
+		char     mMagic[8];
+		uint32_t mVersion;
+		uint32_t mTokensCount;
+		uint64_t mKey;
+		uint64_t mLinesCount;
+		uint64_t mStringsPoolSize;
+		uint64_t mChecksum; ///< Hash of token records and the strings pool
+	} TDiskTokensCacheHeader, *TDiskTokensCacheHeaderPtr;
+
+	typedef struct TDiskTokenRecord
+	{
+		uint32_t mType;
+		uint32_t mLineId;
+		uint32_t mPos;
+		uint32_t mOffset; ///< Offset of the token's view within the strings pool
+		uint32_t mLength;
+	} TDiskTokenRecord, *TDiskTokenRecordPtr;
+
+
+	DiskTokensCache::DiskTokensCache(const std::string& directory, size_t maxSizeInBytes) TCPP_NOEXCEPT:
+		mDirectory(directory), mMaxSizeInBytes(maxSizeInBytes), mCurrSizeInBytes(0)
+	{
+		CreateDirectoryIfMissing(mDirectory);
+		mCurrSizeInBytes = TrimCacheDirectory(mDirectory, DiskTokensCacheEntryExtension, mMaxSizeInBytes);
+	}
+
+	TTokensBufferSharedPtr DiskTokensCache::GetTokens(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT
+	{
+		const uint64_t key = ComputeKey(source, lexer);
+
+		if (auto pTokensBuffer = Load(key))
+		{
+			return pTokensBuffer;
+		}
+
+		auto pTokensBuffer = lexer.Tokenize(std::make_unique<StringInputStream>(source));
+		Store(key, *pTokensBuffer);
+
+		return pTokensBuffer;
+	}
+
+	TTokensBufferSharedPtr DiskTokensCache::Load(uint64_t key) TCPP_NOEXCEPT
+	{
+		const std::string path = _getEntryPath(key);
+
+		std::string content;
+		if (!ReadFileContent(path, content))
+		{
+			return nullptr;
+		}
+
+		auto removeCorruptedEntry = [this, &path, &content]
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (!std::remove(path.c_str()))
+			{
+				mCurrSizeInBytes -= std::min(mCurrSizeInBytes, content.length());
+			}
+
+			return nullptr;
+		};
+
+		TDiskTokensCacheHeader header;
+		if (content.length() < sizeof(header))
+		{
+			return removeCorruptedEntry();
+		}
+
+		memcpy(&header, content.data(), sizeof(header));
+
+		if (memcmp(header.mMagic, DiskTokensCacheMagic, sizeof(header.mMagic)) || header.mVersion != TokensFormatVersion || header.mKey != key)
+		{
+			return removeCorruptedEntry();
+		}
+
+		const uint64_t recordsSize = static_cast<uint64_t>(header.mTokensCount) * sizeof(TDiskTokenRecord);
+		if (content.length() != sizeof(header) + recordsSize + header.mStringsPoolSize)
+		{
+			return removeCorruptedEntry();
+		}
+
+		const char* pPayload = content.data() + sizeof(header);
+		const char* pStringsPool = pPayload + recordsSize;
+
+		if (ComputeHash(pPayload, content.length() - sizeof(header)) != header.mChecksum)
+		{
+			return removeCorruptedEntry();
+		}
+
+		auto pTokensBuffer = std::make_shared<TTokensBuffer>();
+		pTokensBuffer->mLinesCount = static_cast<size_t>(header.mLinesCount);
+		pTokensBuffer->mTokens.reserve(header.mTokensCount);
+
+		TDiskTokenRecord currRecord;
+
+		for (uint32_t i = 0; i < header.mTokensCount; ++i)
+		{
+			memcpy(&currRecord, pPayload + i * sizeof(TDiskTokenRecord), sizeof(TDiskTokenRecord));
+
+			if (static_cast<uint64_t>(currRecord.mOffset) + currRecord.mLength > header.mStringsPoolSize || currRecord.mType > static_cast<uint32_t>(LastTokenType))
+			{
+				return removeCorruptedEntry();
+			}
+
+			pTokensBuffer->mTokens.push_back({ static_cast<E_TOKEN_TYPE>(currRecord.mType), std::string(pStringsPool + currRecord.mOffset, currRecord.mLength), currRecord.mLineId, currRecord.mPos });
+		}
+
+		BuildConditionalSkeleton(*pTokensBuffer);
+
+		TouchFile(path); /// \note Update modification time to keep the entry longer
+
+		return pTokensBuffer;
+	}
+
+	bool DiskTokensCache::Store(uint64_t key, const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT
+	{
+		std::string stringsPool;
+		std::vector<TDiskTokenRecord> records;
+		records.reserve(tokensBuffer.mTokens.size());
+
+		for (const TToken& currToken : tokensBuffer.mTokens)
+		{
+			records.push_back({ static_cast<uint32_t>(currToken.mType), static_cast<uint32_t>(currToken.mLineId), static_cast<uint32_t>(currToken.mPos), 
+								static_cast<uint32_t>(stringsPool.length()), static_cast<uint32_t>(currToken.mRawView.length()) });
+
+			stringsPool.append(currToken.mRawView);
+		}
+
+		TDiskTokensCacheHeader header;
+		memcpy(header.mMagic, DiskTokensCacheMagic, sizeof(header.mMagic));
+		header.mVersion = TokensFormatVersion;
+		header.mTokensCount = static_cast<uint32_t>(records.size());
+		header.mKey = key;
+		header.mLinesCount = tokensBuffer.mLinesCount;
+		header.mStringsPoolSize = stringsPool.length();
+
+		std::string content(sizeof(header), '\0');
+		content.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TDiskTokenRecord));
+		content.append(stringsPool);
+
+		header.mChecksum = ComputeHash(content.data() + sizeof(header), content.length() - sizeof(header));
+		memcpy(&content[0], &header, sizeof(header));
+
+		if (content.length() > mMaxSizeInBytes)
+		{
+			return false;
+		}
+
+		const std::string path = _getEntryPath(key);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		const size_t prevSize = GetFileSize(path); // \note An existing entry is overwritten
+		if (!WriteFileAtomically(path, content))
+		{
+			return false;
+		}
+
+		mCurrSizeInBytes -= std::min(mCurrSizeInBytes, prevSize);
+		mCurrSizeInBytes += content.length();
+
+		if (mCurrSizeInBytes > mMaxSizeInBytes)
+		{
+			mCurrSizeInBytes = TrimCacheDirectory(mDirectory, DiskTokensCacheEntryExtension, mMaxSizeInBytes);
+		}
+
+		return true;
+	}
+
+	void DiskTokensCache::Clear() TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		for (const TFileEntryInfo& currEntry : ListDirectoryFiles(mDirectory, DiskTokensCacheEntryExtension))
+		{
+			std::remove(currEntry.mPath.c_str());
+		}
+
+		mCurrSizeInBytes = 0;
+	}
+
+	uint64_t DiskTokensCache::ComputeKey(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT
+	{
+		return ComputeHash(source, lexer.GetConfigHash());
+	}
+
+	size_t DiskTokensCache::GetSize() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mCurrSizeInBytes;
+	}
+
+	std::string DiskTokensCache::_getEntryPath(uint64_t key) const TCPP_NOEXCEPT
+	{
+		return mDirectory + "/" + KeyToHexString(key) + DiskTokensCacheEntryExtension;
+	}
+
+
+	static std::string ReadAllLines(IInputStream& stream) TCPP_NOEXCEPT
+	{
+		std::string content;
+
+		while (stream.HasNextLine())
+		{
+			content.append(stream.ReadLine());
+		}
+
+		return content;
+	}
+
+
+	/*!
+		\brief The function computes a hash of the stream's content or its tokens. A plain stream is read entirely,
+		so it's replaced with a stream over the read content. 0 is returned for a missing stream
+	*/
+
+	static uint64_t ComputeStreamHash(TInputStreamUniquePtr& pStream) TCPP_NOEXCEPT
+	{
+		if (!pStream)
+		{
+			return 0;
+		}
+
+		uint64_t hash = 0;
+
+		if (auto pTokensBuffer = pStream->GetTokensBuffer())
+		{
+			hash = ComputeHash(&pTokensBuffer->mLinesCount, sizeof(pTokensBuffer->mLinesCount));
+
+			for (const TToken& currToken : pTokensBuffer->mTokens)
+			{
+				hash = ComputeHash(&currToken.mType, sizeof(currToken.mType), hash);
+				hash = ComputeHash(currToken.mRawView + " ", hash);
+			}
+		}
+		else
+		{
+			auto pContent = std::make_shared<const std::string>(ReadAllLines(*pStream));
+
+			hash = ComputeHash(*pContent);
+			pStream = std::make_unique<SharedContentInputStream>(pContent);
+		}
+
+		return std::max<uint64_t>(hash, 1);
+	}
+
+
+	static size_t GetTokensBufferSize(const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT
+	{
+		size_t size = sizeof(TTokensBuffer) + tokensBuffer.mTokens.capacity() * sizeof(TToken);
+
+		for (const TToken& currToken : tokensBuffer.mTokens)
+		{
+			size += currToken.mRawView.length();
+		}
+
+		return size;
+	}
+
+
+	TokensCache::TokensCache(size_t memoryBudgetInBytes) TCPP_NOEXCEPT:
+		mEntries(memoryBudgetInBytes)
+	{
+	}
+
+	TTokensBufferSharedPtr TokensCache::GetTokens(const std::string& source, const Lexer& lexer) TCPP_NOEXCEPT
+	{
+		const std::string key = "#" + KeyToHexString(ComputeHash(source, lexer.GetConfigHash()));
+
+		if (auto pTokensBuffer = _find(key))
+		{
+			return pTokensBuffer;
+		}
+
+		auto pTokensBuffer = lexer.Tokenize(std::make_unique<StringInputStream>(source));
+		_insert(key, pTokensBuffer);
+
+		return pTokensBuffer;
+	}
+
+	TTokensBufferSharedPtr TokensCache::GetTokens(const std::string& fileIdentity, const Lexer& lexer, const TStreamFactory& streamFactory) TCPP_NOEXCEPT
+	{
+		const std::string key = fileIdentity + "#" + KeyToHexString(lexer.GetConfigHash());
+
+		if (auto pTokensBuffer = _find(key))
+		{
+			return pTokensBuffer;
+		}
+
+		/// \note The lock isn't held while the file is tokenized, so concurrent misses of the same key could do the same work twice
+		auto pTokensBuffer = lexer.Tokenize(streamFactory ? streamFactory() : nullptr);
+		if (!pTokensBuffer)
+		{
+			return nullptr;
+		}
+
+		_insert(key, pTokensBuffer);
+
+		return pTokensBuffer;
+	}
+
+	void TokensCache::Invalidate(const std::string& fileIdentity, const Lexer& lexer) TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.Remove(fileIdentity + "#" + KeyToHexString(lexer.GetConfigHash()));
+	}
+
+	void TokensCache::Clear() TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.Clear();
+	}
+
+	size_t TokensCache::GetSize() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mEntries.GetSize();
+	}
+
+	TCacheStats TokensCache::GetStats() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mStats;
+	}
+
+	TTokensBufferSharedPtr TokensCache::_find(const std::string& key) TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		const TTokensBufferSharedPtr* ppTokensBuffer = mEntries.Find(key);
+		if (!ppTokensBuffer)
+		{
+			++mStats.mMissesCount;
+			return nullptr;
+		}
+
+		++mStats.mHitsCount;
+
+		return *ppTokensBuffer;
+	}
+
+	void TokensCache::_insert(const std::string& key, TTokensBufferSharedPtr pTokensBuffer) TCPP_NOEXCEPT
+	{
+		const size_t size = GetTokensBufferSize(*pTokensBuffer);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.Insert(key, pTokensBuffer, size);
+	}
+
+
+	SharedContentInputStream::SharedContentInputStream(TContentSharedPtr pContent) TCPP_NOEXCEPT:
+		IInputStream(), mpContent(pContent ? pContent : std::make_shared<const std::string>()), mCurrPos(0)
+	{
+	}
+
+	std::string SharedContentInputStream::ReadLine() TCPP_NOEXCEPT
+	{
+		const std::string& content = *mpContent;
+
+		std::string::size_type pos = content.find_first_of('\n', mCurrPos);
+		pos = (pos == std::string::npos) ? content.length() : (pos + 1);
+
+		std::string currLine = content.substr(mCurrPos, pos - mCurrPos);
+		mCurrPos = pos;
+
+		return currLine;
+	}
+
+	bool SharedContentInputStream::HasNextLine() const TCPP_NOEXCEPT
+	{
+		return mCurrPos < mpContent->length();
+	}
+
+
+	IncludeContentCache::IncludeContentCache(size_t memoryBudgetInBytes, size_t shardsCount, bool checkFileStamps) TCPP_NOEXCEPT:
+		mpShards(std::make_unique<TShard[]>(std::max<size_t>(shardsCount, 1))), mShardsCount(std::max<size_t>(shardsCount, 1)),
+		mCheckFileStamps(checkFileStamps)
+	{
+		for (size_t i = 0; i < mShardsCount; ++i)
+		{
+			mpShards[i].mEntries = LRUCache<std::string, TCacheEntry>(memoryBudgetInBytes / mShardsCount);
+		}
+	}
+
+	TContentSharedPtr IncludeContentCache::GetContent(const std::string& path) TCPP_NOEXCEPT
+	{
+		TFileEntryInfo fileInfo;
+		fileInfo.mPath = path;
+
+		if (mCheckFileStamps)
+		{
+			struct stat info;
+			if (stat(path.c_str(), &info))
+			{
+				return nullptr;
+			}
+
+			fileInfo.mSize = static_cast<size_t>(info.st_size);
+			fileInfo.mModificationTime = info.st_mtime;
+		}
+
+		TShard& shard = _getShard(path);
+
+		{
+			std::lock_guard<std::mutex> lock(shard.mMutex);
+
+			const TCacheEntry* pEntry = shard.mEntries.Peek(path);
+			if (pEntry && (!mCheckFileStamps || (pEntry->mSize == fileInfo.mSize && pEntry->mModificationTime == fileInfo.mModificationTime)))
+			{
+				++shard.mStats.mHitsCount;
+				return shard.mEntries.Find(path)->mpContent;
+			}
+
+			++shard.mStats.mMissesCount;
+		}
+
+		/// \note The file is read without the lock, so other files of the shard are available meanwhile
+		std::string content;
+		if (!ReadFileContent(path, content))
+		{
+			return nullptr;
+		}
+
+		auto pContent = std::make_shared<const std::string>(std::move(content));
+
+		std::lock_guard<std::mutex> lock(shard.mMutex);
+		shard.mEntries.Insert(path, { pContent, fileInfo.mSize, fileInfo.mModificationTime }, pContent->length());
+
+		return pContent;
+	}
+
+	TInputStreamUniquePtr IncludeContentCache::OpenStream(const std::string& path) TCPP_NOEXCEPT
+	{
+		auto pContent = GetContent(path);
+		return pContent ? std::make_unique<SharedContentInputStream>(pContent) : nullptr;
+	}
+
+	void IncludeContentCache::Invalidate(const std::string& path) TCPP_NOEXCEPT
+	{
+		TShard& shard = _getShard(path);
+
+		std::lock_guard<std::mutex> lock(shard.mMutex);
+		shard.mEntries.Remove(path);
+	}
+
+	void IncludeContentCache::Clear() TCPP_NOEXCEPT
+	{
+		for (size_t i = 0; i < mShardsCount; ++i)
+		{
+			TShard& shard = mpShards[i];
+
+			std::lock_guard<std::mutex> lock(shard.mMutex);
+			shard.mEntries.Clear();
+		}
+	}
+
+	size_t IncludeContentCache::GetSize() const TCPP_NOEXCEPT
+	{
+		size_t size = 0;
+
+		for (size_t i = 0; i < mShardsCount; ++i)
+		{
+			std::lock_guard<std::mutex> lock(mpShards[i].mMutex);
+			size += mpShards[i].mEntries.GetSize();
+		}
+
+		return size;
+	}
+
+	TCacheStats IncludeContentCache::GetStats() const TCPP_NOEXCEPT
+	{
+		TCacheStats stats;
+
+		for (size_t i = 0; i < mShardsCount; ++i)
+		{
+			std::lock_guard<std::mutex> lock(mpShards[i].mMutex);
+
+			stats.mHitsCount += mpShards[i].mStats.mHitsCount;
+			stats.mMissesCount += mpShards[i].mStats.mMissesCount;
+		}
+
+		return stats;
+	}
+
+	IncludeContentCache::TShard& IncludeContentCache::_getShard(const std::string& path) const TCPP_NOEXCEPT
+	{
+		return mpShards[std::hash<std::string>{}(path) % mShardsCount];
+	}
+
+
+	WorkersPool::WorkersPool(size_t workersCount) TCPP_NOEXCEPT:
+		mIsStopped(false)
+	{
+		if (!workersCount)
+		{
+			workersCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+		}
+
+		for (size_t i = 0; i < workersCount; ++i)
+		{
+			mWorkers.emplace_back(&WorkersPool::_processTasks, this);
+		}
+	}
+
+	WorkersPool::~WorkersPool() TCPP_NOEXCEPT
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mIsStopped = true;
+		}
+
+		mTasksCondition.notify_all();
+
+		for (std::thread& currWorker : mWorkers)
+		{
+			currWorker.join();
+		}
+	}
+
+	size_t WorkersPool::GetWorkersCount() const TCPP_NOEXCEPT
+	{
+		return mWorkers.size();
+	}
+
+	void WorkersPool::_processTasks() TCPP_NOEXCEPT
+	{
+		while (true)
+		{
+			TTask currTask;
+
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mTasksCondition.wait(lock, [this] { return mIsStopped || !mTasks.empty(); });
+
+				if (mTasks.empty()) // \note The pool is stopped and all tasks are completed
+				{
+					return;
+				}
+
+				currTask = std::move(mTasks.front());
+				mTasks.pop_front();
+			}
+
+			currTask();
+		}
+	}
+
+
+	/*!
+		\brief The function returns paths of all #include directives of the buffer in the order of their appearance. 
+		Conditional blocks aren't taken into account
+	*/
+
+	static std::vector<std::tuple<std::string, bool>> FindIncludeDirectives(const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT
+	{
+		std::vector<std::tuple<std::string, bool>> includes;
+
+		const std::vector<TToken>& tokens = tokensBuffer.mTokens;
+
+		for (size_t i = 0; i < tokens.size(); ++i)
+		{
+			if (E_TOKEN_TYPE::INCLUDE != tokens[i].mType)
+			{
+				continue;
+			}
+
+			while (++i < tokens.size() && E_TOKEN_TYPE::SPACE == tokens[i].mType);
+
+			if (i >= tokens.size())
+			{
+				break;
+			}
+
+			if (E_TOKEN_TYPE::STRING_LITERAL == tokens[i].mType)
+			{
+				includes.emplace_back(tokens[i].mRawView.substr(1, tokens[i].mRawView.length() - 2), false);
+				continue;
+			}
+
+			if (E_TOKEN_TYPE::LESS != tokens[i].mType)
+			{
+				continue;
+			}
+
+			std::string path;
+
+			while (++i < tokens.size() && E_TOKEN_TYPE::GREATER != tokens[i].mType && E_TOKEN_TYPE::NEWLINE != tokens[i].mType)
+			{
+				path.append(tokens[i].mRawView);
+			}
+
+			if (i < tokens.size() && E_TOKEN_TYPE::GREATER == tokens[i].mType)
+			{
+				includes.emplace_back(path, true);
+			}
+		}
+
+		return includes;
+	}
+
+
+	static std::string GetIncludeKey(const std::string& path, bool isSystemPathInclusion) TCPP_NOEXCEPT
+	{
+		return (isSystemPathInclusion ? "<" : "\"") + path;
+	}
+
+
+	static const size_t FilterBitsPerSlot = 8;
+
+
+	SymbolsTable::SymbolsTable() TCPP_NOEXCEPT:
+		mpState(), mpReadsLog(nullptr), mpReadsSet(nullptr)
+	{
+		_rebuild(16);
+	}
+
+	SymbolsTable::SymbolsTable(const SymbolsTable& table) TCPP_NOEXCEPT:
+		mpState(table.mpState), mpReadsLog(nullptr), mpReadsSet(nullptr)
+	{
+	}
+
+	bool SymbolsTable::Add(const TMacroDesc& macroDesc) TCPP_NOEXCEPT
+	{
+		const uint64_t hash = ComputeHash(macroDesc.mName);
+
+		if (_mayContain(hash) && mpState->mSlots[_findSlotIndex(macroDesc.mName.data(), macroDesc.mName.length(), hash)].mMacroIndex)
+		{
+			return false;
+		}
+
+		mpState.Detach();
+
+		mpState->mMacros.push_back(macroDesc);
+		_updateVersion(macroDesc.mName);
+
+		if (2 * mpState->mMacros.size() > mpState->mSlots.size()) // \note Keep the load factor below 0.5, the new definition is inserted during rebuilding
+		{
+			_rebuild(2 * mpState->mSlots.size());
+			return true;
+		}
+
+		TSlot& slot = mpState->mSlots[_findSlotIndex(macroDesc.mName.data(), macroDesc.mName.length(), hash)];
+		slot.mHash = hash;
+		slot.mMacroIndex = static_cast<uint32_t>(mpState->mMacros.size());
+
+		_addToFilter(hash);
+
+		return true;
+	}
+
+	bool SymbolsTable::Remove(const std::string& macroName) TCPP_NOEXCEPT
+	{
+		const uint64_t hash = ComputeHash(macroName);
+		if (!_mayContain(hash))
+		{
+			return false;
+		}
+
+		const size_t mask = mpState->mSlots.size() - 1;
+
+		size_t currSlotIndex = _findSlotIndex(macroName.data(), macroName.length(), hash);
+		if (!mpState->mSlots[currSlotIndex].mMacroIndex)
+		{
+			return false;
+		}
+
+		const size_t macroIndex = mpState->mSlots[currSlotIndex].mMacroIndex - 1;
+
+		mpState.Detach();
+
+		_updateVersion(macroName);
+
+		/// \note Move the last definition into the freed place of the dense array
+		if (macroIndex + 1 != mpState->mMacros.size())
+		{
+			const TMacroDesc& lastMacro = mpState->mMacros.back();
+
+			mpState->mSlots[_findSlotIndex(lastMacro.mName.data(), lastMacro.mName.length(), ComputeHash(lastMacro.mName))].mMacroIndex = static_cast<uint32_t>(macroIndex + 1);
+			mpState->mMacros[macroIndex] = std::move(mpState->mMacros.back());
+		}
+
+		mpState->mMacros.pop_back();
+
+		/// \note Backward shift deletion, so probe sequences stay valid without tombstones
+		mpState->mSlots[currSlotIndex] = TSlot();
+
+		for (size_t nextSlotIndex = (currSlotIndex + 1) & mask; mpState->mSlots[nextSlotIndex].mMacroIndex; nextSlotIndex = (nextSlotIndex + 1) & mask)
+		{
+			const size_t desiredSlotIndex = mpState->mSlots[nextSlotIndex].mHash & mask;
+
+			const bool canBeShifted = (currSlotIndex <= nextSlotIndex) ?
+				(desiredSlotIndex <= currSlotIndex || desiredSlotIndex > nextSlotIndex) :
+				(desiredSlotIndex <= currSlotIndex && desiredSlotIndex > nextSlotIndex);
+
+			if (canBeShifted)
+			{
+				mpState->mSlots[currSlotIndex] = mpState->mSlots[nextSlotIndex];
+				mpState->mSlots[nextSlotIndex] = TSlot();
+				currSlotIndex = nextSlotIndex;
+			}
+		}
+
+		if (++mpState->mRemovalsCount > mpState->mMacros.size())
+		{
+			_rebuild(mpState->mSlots.size());
+		}
+
+		return true;
+	}
+
+	const TMacroDesc* SymbolsTable::Find(const char* pName, size_t length) const TCPP_NOEXCEPT
+	{
+		const uint64_t hash = ComputeHash(pName, length);
+
+		/// \note Misses are logged too, because a macro which is defined later changes the output
+		_logRead(pName, length, hash);
+
+		if (!_mayContain(hash))
+		{
+			return nullptr;
+		}
+
+		const uint32_t macroIndex = mpState->mSlots[_findSlotIndex(pName, length, hash)].mMacroIndex;
+		return macroIndex ? &mpState->mMacros[macroIndex - 1] : nullptr;
+	}
+
+	const TMacroDesc* SymbolsTable::Find(const std::string& macroName) const TCPP_NOEXCEPT
+	{
+		return Find(macroName.data(), macroName.length());
+	}
+
+	bool SymbolsTable::Contains(const std::string& macroName) const TCPP_NOEXCEPT
+	{
+		return Find(macroName) != nullptr;
+	}
+
+	uint64_t SymbolsTable::GetVersion(const std::string& macroName) const TCPP_NOEXCEPT
+	{
+		if (mpReadsLog || mpReadsSet)
+		{
+			_logRead(macroName.data(), macroName.length(), ComputeHash(macroName));
+		}
+
+		auto it = mpState->mVersionsTable.find(macroName);
+		return (it == mpState->mVersionsTable.cend()) ? 0 : it->second;
+	}
+
+	const std::vector<TMacroDesc>& SymbolsTable::GetMacros() const TCPP_NOEXCEPT
+	{
+		return mpState->mMacros;
+	}
+
+	void SymbolsTable::SetReadsLog(TReadsTable* pReadsLog) TCPP_NOEXCEPT
+	{
+		mpReadsLog = pReadsLog;
+	}
+
+	void SymbolsTable::SetReadsSet(TReadsTable* pReadsSet) TCPP_NOEXCEPT
+	{
+		mpReadsSet = pReadsSet;
+	}
+
+	SymbolsTable& SymbolsTable::operator= (const SymbolsTable& table) TCPP_NOEXCEPT
+	{
+		mpState = table.mpState;
+		return *this;
+	}
+
+	void SymbolsTable::_updateVersion(const std::string& macroName) TCPP_NOEXCEPT
+	{
+		mpState->mVersionsTable[macroName] = ++mpState->mChangesCount;
+	}
+
+	void SymbolsTable::_logRead(const char* pName, size_t length, uint64_t hash) const TCPP_NOEXCEPT
+	{
+		/// \note Most of lookups repeat names which are logged already, they cost a probe without copying of the name
+		for (TReadsTable* pReads : { mpReadsLog, mpReadsSet })
+		{
+			if (pReads && pReads->find(hash) == pReads->cend())
+			{
+				pReads->emplace(hash, std::string(pName, length));
+			}
+		}
+	}
+
+	size_t SymbolsTable::_findSlotIndex(const char* pName, size_t length, uint64_t hash) const TCPP_NOEXCEPT
+	{
+		const size_t mask = mpState->mSlots.size() - 1;
+
+		for (size_t slotIndex = hash & mask; ; slotIndex = (slotIndex + 1) & mask)
+		{
+			const TSlot& slot = mpState->mSlots[slotIndex];
+			if (!slot.mMacroIndex)
+			{
+				return slotIndex;
+			}
+
+			if (slot.mHash != hash)
+			{
+				continue;
+			}
+
+			const std::string& name = mpState->mMacros[slot.mMacroIndex - 1].mName;
+			if (name.length() == length && !std::memcmp(name.data(), pName, length))
+			{
+				return slotIndex;
+			}
+		}
+	}
+
+	void SymbolsTable::_rebuild(size_t slotsCount) TCPP_NOEXCEPT
+	{
+		mpState->mSlots.assign(slotsCount, TSlot());
+		mpState->mFilterWords.assign(slotsCount * FilterBitsPerSlot / 64, 0);
+		mpState->mRemovalsCount = 0;
+
+		for (size_t i = 0; i < mpState->mMacros.size(); ++i)
+		{
+			const std::string& name = mpState->mMacros[i].mName;
+			const uint64_t hash = ComputeHash(name);
+
+			TSlot& slot = mpState->mSlots[_findSlotIndex(name.data(), name.length(), hash)];
+			slot.mHash = hash;
+			slot.mMacroIndex = static_cast<uint32_t>(i + 1);
+
+			_addToFilter(hash);
+		}
+	}
+
+	void SymbolsTable::_addToFilter(uint64_t hash) TCPP_NOEXCEPT
+	{
+		const size_t mask = mpState->mFilterWords.size() * 64 - 1;
+
+		const size_t firstBit = hash & mask;
+		const size_t secondBit = (hash >> 32) & mask;
+
+		mpState->mFilterWords[firstBit / 64] |= 1ull << (firstBit % 64);
+		mpState->mFilterWords[secondBit / 64] |= 1ull << (secondBit % 64);
+	}
+
+	bool SymbolsTable::_mayContain(uint64_t hash) const TCPP_NOEXCEPT
+	{
+		const size_t mask = mpState->mFilterWords.size() * 64 - 1;
+
+		const size_t firstBit = hash & mask;
+		const size_t secondBit = (hash >> 32) & mask;
+
+		return (mpState->mFilterWords[firstBit / 64] & (1ull << (firstBit % 64))) && (mpState->mFilterWords[secondBit / 64] & (1ull << (secondBit % 64)));
+	}
+
+
+	static uint64_t PackHideSetPair(uint32_t first, uint32_t second) TCPP_NOEXCEPT
+	{
+		return (static_cast<uint64_t>(first) << 32) | second;
+	}
+
+
+	HideSetsTable::HideSetsTable() TCPP_NOEXCEPT:
+		mpState()
+	{
+		mpState->mHideSets.resize(1);
+		mpState->mHideSetsTable.emplace(TMacroIdsArray(), 0);
+	}
+
+	HideSetsTable::TMacroId HideSetsTable::GetMacroId(const std::string& macroName) TCPP_NOEXCEPT
+	{
+		auto it = mpState->mMacrosIds.find(macroName);
+		if (it != mpState->mMacrosIds.cend())
+		{
+			return it->second;
+		}
+
+		TState& state = mpState.Detach();
+		return state.mMacrosIds.emplace(macroName, static_cast<TMacroId>(state.mMacrosIds.size())).first->second;
+	}
+
+	HideSetsTable::THideSetId HideSetsTable::Add(THideSetId hideSetId, TMacroId macroId) TCPP_NOEXCEPT
+	{
+		if (Contains(hideSetId, macroId))
+		{
+			return hideSetId;
+		}
+
+		TMacroIdsArray macroIds = mpState->mHideSets[hideSetId];
+		macroIds.insert(std::lower_bound(macroIds.begin(), macroIds.end(), macroId), macroId);
+
+		return _intern(std::move(macroIds));
+	}
+
+	HideSetsTable::THideSetId HideSetsTable::Union(THideSetId leftHideSetId, THideSetId rightHideSetId) TCPP_NOEXCEPT
+	{
+		if (leftHideSetId == rightHideSetId || !rightHideSetId)
+		{
+			return leftHideSetId;
+		}
+
+		if (!leftHideSetId)
+		{
+			return rightHideSetId;
+		}
+
+		const uint64_t key = PackHideSetPair(std::min(leftHideSetId, rightHideSetId), std::max(leftHideSetId, rightHideSetId));
+
+		auto it = mpState->mUnionsCache.find(key);
+		if (it != mpState->mUnionsCache.cend())
+		{
+			return it->second;
+		}
+
+		const TMacroIdsArray& left = mpState->mHideSets[leftHideSetId];
+		const TMacroIdsArray& right = mpState->mHideSets[rightHideSetId];
+
+		TMacroIdsArray macroIds;
+		std::set_union(left.cbegin(), left.cend(), right.cbegin(), right.cend(), std::back_inserter(macroIds));
+
+		const THideSetId hideSetId = _intern(std::move(macroIds));
+		mpState.Detach().mUnionsCache.emplace(key, hideSetId);
+
+		return hideSetId;
+	}
+
+	HideSetsTable::THideSetId HideSetsTable::Intersect(THideSetId leftHideSetId, THideSetId rightHideSetId) TCPP_NOEXCEPT
+	{
+		if (leftHideSetId == rightHideSetId || !leftHideSetId || !rightHideSetId)
+		{
+			return std::min(leftHideSetId, rightHideSetId);
+		}
+
+		const TMacroIdsArray& left = mpState->mHideSets[leftHideSetId];
+		const TMacroIdsArray& right = mpState->mHideSets[rightHideSetId];
+
+		TMacroIdsArray macroIds;
+		std::set_intersection(left.cbegin(), left.cend(), right.cbegin(), right.cend(), std::back_inserter(macroIds));
+
+		return _intern(std::move(macroIds));
+	}
+
+	bool HideSetsTable::Contains(THideSetId hideSetId, TMacroId macroId) const TCPP_NOEXCEPT
+	{
+		return hideSetId && mpState->mMembershipTable.find(PackHideSetPair(hideSetId, macroId)) != mpState->mMembershipTable.cend();
+	}
+
+	HideSetsTable::THideSetId HideSetsTable::_intern(TMacroIdsArray&& macroIds) TCPP_NOEXCEPT
+	{
+		auto it = mpState->mHideSetsTable.find(macroIds);
+		if (it != mpState->mHideSetsTable.cend())
+		{
+			return it->second;
+		}
+
+		mpState.Detach();
+
+		const THideSetId hideSetId = static_cast<THideSetId>(mpState->mHideSets.size());
+
+		for (TMacroId currMacroId : macroIds)
+		{
+			mpState->mMembershipTable.insert(PackHideSetPair(hideSetId, currMacroId));
+		}
+
+		mpState->mHideSetsTable.emplace(macroIds, hideSetId);
+		mpState->mHideSets.push_back(std::move(macroIds));
+
+		return hideSetId;
+	}
+
+
+	static const std::vector<std::string> BuiltInDefines
+	{
+		"__LINE__",
+		"__VA_ARGS__",
+	};
+
+
+	OutputCache::OutputCache(size_t memoryBudgetInBytes, std::shared_ptr<DiskOutputCache> pDiskCache) TCPP_NOEXCEPT:
+		mEntries(memoryBudgetInBytes), mpDiskCache(pDiskCache)
+	{
+	}
+
+	OutputCache::TOutputEntrySharedPtr OutputCache::Find(const std::string& key, const TEntryValidator& validator) TCPP_NOEXCEPT
+	{
+		TOutputEntrySharedPtr pEntry;
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (const TOutputEntrySharedPtr* ppEntry = mEntries.Peek(key))
+			{
+				pEntry = *ppEntry;
+			}
+		}
+
+		bool isLoadedFromDisk = false;
+
+		if (!pEntry && mpDiskCache)
+		{
+			pEntry = mpDiskCache->Load(key);
+			isLoadedFromDisk = static_cast<bool>(pEntry);
+		}
+
+		const bool isValid = pEntry && (!validator || validator(*pEntry));
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (!isValid)
+			{
+				++mStats.mMissesCount;
+				return nullptr;
+			}
+
+			++mStats.mHitsCount;
+
+			mEntries.Find(key); // \note Mark the entry as the most recently used one
+		}
+
+		if (isLoadedFromDisk)
+		{
+			_insert(key, pEntry);
+		}
+
+		return pEntry;
+	}
+
+	void OutputCache::Store(const std::string& key, TOutputEntrySharedPtr pEntry) TCPP_NOEXCEPT
+	{
+		if (!pEntry)
+		{
+			return;
+		}
+
+		_insert(key, pEntry);
+
+		if (mpDiskCache)
+		{
+			mpDiskCache->Store(key, *pEntry);
+		}
+	}
+
+	void OutputCache::Clear() TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.Clear();
+	}
+
+	size_t OutputCache::GetSize() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mEntries.GetSize();
+	}
+
+	TCacheStats OutputCache::GetStats() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mStats;
+	}
+
+	void OutputCache::_insert(const std::string& key, TOutputEntrySharedPtr pEntry) TCPP_NOEXCEPT
+	{
+		size_t size = key.length() + pEntry->mOutput.length();
+
+		for (const TIncludeRecord& currInclude : pEntry->mIncludes)
+		{
+			size += sizeof(TIncludeRecord) + currInclude.mPath.length();
+		}
+
+		for (const TMacroDesc& currMacro : pEntry->mMacros)
+		{
+			size += sizeof(TMacroDesc) + currMacro.mValue.size() * sizeof(TToken);
+		}
+
+		for (const std::string& currMacroName : pEntry->mMacroDependencies)
+		{
+			size += sizeof(std::string) + currMacroName.length();
+		}
+
+		for (const TConditionalRegionInfo& currRegion : pEntry->mConditionalRegions)
+		{
+			size += sizeof(TConditionalRegionInfo) + currRegion.mFileId.length() + currRegion.mMacros.size() * sizeof(std::string);
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.Insert(key, pEntry, size);
+	}
+
+
+	static const std::string DiskOutputCacheEntryExtension = ".tcppout";
+
+	static constexpr char DiskOutputCacheMagic[8] = { 'T', 'C', 'P', 'P', 'O', 'U', 'T', '\0' };
+	static constexpr uint32_t DiskOutputCacheEntryVersion = 2; ///< Should be increased every time when the layout of an entry is changed
+
+	typedef struct TDiskOutputCacheHeader
+	{
+		char     mMagic[8];
+		uint32_t mVersion;
+		uint32_t mEntryVersion;
+		uint64_t mPayloadSize;
+		uint64_t mChecksum; ///< Hash of the payload
+	} TDiskOutputCacheHeader, *TDiskOutputCacheHeaderPtr;
+
+
+	DiskOutputCache::DiskOutputCache(const std::string& directory, size_t maxSizeInBytes) TCPP_NOEXCEPT:
+		mDirectory(directory), mMaxSizeInBytes(maxSizeInBytes), mCurrSizeInBytes(0)
+	{
+		CreateDirectoryIfMissing(mDirectory);
+		mCurrSizeInBytes = TrimCacheDirectory(mDirectory, DiskOutputCacheEntryExtension, mMaxSizeInBytes);
+	}
+
+	OutputCache::TOutputEntrySharedPtr DiskOutputCache::Load(const std::string& key) TCPP_NOEXCEPT
+	{
+		const std::string path = _getEntryPath(key);
+
+		std::string content;
+		if (!ReadFileContent(path, content))
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			++mStats.mMissesCount;
+			return nullptr;
+		}
+
+		auto removeCorruptedEntry = [this, &path, &content]
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (!std::remove(path.c_str()))
+			{
+				mCurrSizeInBytes -= std::min(mCurrSizeInBytes, content.length());
+			}
+
+			++mStats.mMissesCount;
+			return nullptr;
+		};
+
+		TDiskOutputCacheHeader header;
+		if (content.length() < sizeof(header))
+		{
+			return removeCorruptedEntry();
+		}
+
+		memcpy(&header, content.data(), sizeof(header));
+
+		if (memcmp(header.mMagic, DiskOutputCacheMagic, sizeof(header.mMagic)) || header.mVersion != TokensFormatVersion || header.mEntryVersion != DiskOutputCacheEntryVersion ||
+			header.mPayloadSize != content.length() - sizeof(header) || ComputeHash(content.data() + sizeof(header), content.length() - sizeof(header)) != header.mChecksum)
+		{
+			return removeCorruptedEntry();
+		}
+
+		size_t offset = sizeof(header);
+
+		auto readBytes = [&content, &offset](void* pDest, size_t size)
+		{
+			if (size > content.length() - offset)
+			{
+				return false;
+			}
+
+			memcpy(pDest, content.data() + offset, size);
+			offset += size;
+
+			return true;
+		};
+
+		auto readString = [&content, &offset, &readBytes](std::string& str)
+		{
+			uint64_t length = 0;
+			if (!readBytes(&length, sizeof(length)) || length > content.length() - offset)
+			{
+				return false;
+			}
+
+			str.assign(content, offset, static_cast<size_t>(length));
+			offset += static_cast<size_t>(length);
+
+			return true;
+		};
+
+		auto readCount = [&content, &offset, &readBytes](uint64_t& count)
+		{
+			return readBytes(&count, sizeof(count)) && count <= content.length() - offset; // \note Every element takes at least a byte
+		};
+
+		auto pEntry = std::make_shared<OutputCache::TOutputEntry>();
+
+		std::string storedKey;
+		uint64_t includesCount = 0;
+
+		if (!readString(storedKey) || storedKey != key || !readCount(includesCount))
+		{
+			return removeCorruptedEntry();
+		}
+
+		for (uint64_t i = 0; i < includesCount; ++i)
+		{
+			OutputCache::TIncludeRecord includeRecord;
+			if (!readString(includeRecord.mPath) || !readBytes(&includeRecord.mIsSystemPathInclusion, sizeof(bool)) || !readBytes(&includeRecord.mContentHash, sizeof(uint64_t)))
+			{
+				return removeCorruptedEntry();
+			}
+
+			pEntry->mIncludes.push_back(includeRecord);
+		}
+
+		uint64_t macrosCount = 0;
+		if (!readCount(macrosCount))
+		{
+			return removeCorruptedEntry();
+		}
+
+		for (uint64_t i = 0; i < macrosCount; ++i)
+		{
+			TMacroDesc macroDesc;
+
+			uint64_t argsCount = 0;
+			if (!readString(macroDesc.mName) || !readCount(argsCount))
+			{
+				return removeCorruptedEntry();
+			}
+
+			macroDesc.mArgsNames.resize(static_cast<size_t>(argsCount));
+
+			for (std::string& currArgName : macroDesc.mArgsNames)
+			{
+				if (!readString(currArgName))
+				{
+					return removeCorruptedEntry();
+				}
+			}
+
+			uint64_t tokensCount = 0;
+			if (!readBytes(&macroDesc.mVariadic, sizeof(bool)) || !readBytes(&macroDesc.mHasImplicitValue, sizeof(bool)) || !readCount(tokensCount))
+			{
+				return removeCorruptedEntry();
+			}
+
+			for (uint64_t j = 0; j < tokensCount; ++j)
+			{
+				uint32_t type = 0;
+				uint32_t lineId = 0;
+				uint32_t pos = 0;
+				std::string rawView;
+
+				if (!readBytes(&type, sizeof(type)) || type > static_cast<uint32_t>(LastTokenType) || !readString(rawView) || 
+					!readBytes(&lineId, sizeof(lineId)) || !readBytes(&pos, sizeof(pos)))
+				{
+					return removeCorruptedEntry();
+				}
+
+				macroDesc.mValue.push_back({ static_cast<E_TOKEN_TYPE>(type), rawView, lineId, pos });
+			}
+
+			if (!macroDesc.mArgsNames.empty())
+			{
+				macroDesc.mBodyChunks = CompileMacroBody(macroDesc);
+			}
+
+			pEntry->mMacros.push_back(macroDesc);
+		}
+
+		uint64_t dependenciesCount = 0;
+		if (!readCount(dependenciesCount))
+		{
+			return removeCorruptedEntry();
+		}
+
+		pEntry->mMacroDependencies.resize(static_cast<size_t>(dependenciesCount));
+
+		for (std::string& currMacroName : pEntry->mMacroDependencies)
+		{
+			if (!readString(currMacroName))
+			{
+				return removeCorruptedEntry();
+			}
+		}
+
+		uint64_t regionsCount = 0;
+		if (!readCount(regionsCount))
+		{
+			return removeCorruptedEntry();
+		}
+
+		for (uint64_t i = 0; i < regionsCount; ++i)
+		{
+			TConditionalRegionInfo regionInfo;
+
+			uint64_t line = 0;
+			uint32_t directiveType = 0;
+			uint64_t regionMacrosCount = 0;
+
+			if (!readString(regionInfo.mFileId) || !readBytes(&line, sizeof(line)) || !readBytes(&directiveType, sizeof(directiveType)) || 
+				directiveType > static_cast<uint32_t>(LastTokenType) || !readBytes(&regionInfo.mIsActive, sizeof(bool)) || !readCount(regionMacrosCount))
+			{
+				return removeCorruptedEntry();
+			}
+
+			regionInfo.mLine = static_cast<size_t>(line);
+			regionInfo.mDirectiveType = static_cast<E_TOKEN_TYPE>(directiveType);
+			regionInfo.mMacros.resize(static_cast<size_t>(regionMacrosCount));
+
+			for (std::string& currMacroName : regionInfo.mMacros)
+			{
+				if (!readString(currMacroName))
+				{
+					return removeCorruptedEntry();
+				}
+			}
+
+			pEntry->mConditionalRegions.push_back(std::move(regionInfo));
+		}
+
+		if (!readString(pEntry->mOutput) || offset != content.length())
+		{
+			return removeCorruptedEntry();
+		}
+
+		TouchFile(path); /// \note Update modification time to keep the entry longer
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mStats.mHitsCount;
+
+		return pEntry;
+	}
+
+	bool DiskOutputCache::Store(const std::string& key, const OutputCache::TOutputEntry& entry) TCPP_NOEXCEPT
+	{
+		std::string content(sizeof(TDiskOutputCacheHeader), '\0');
+
+		auto appendString = [&content](const std::string& str)
+		{
+			AppendBytes(content, static_cast<uint64_t>(str.length()));
+			content.append(str);
+		};
+
+		appendString(key);
+		AppendBytes(content, static_cast<uint64_t>(entry.mIncludes.size()));
+
+		for (const OutputCache::TIncludeRecord& currInclude : entry.mIncludes)
+		{
+			appendString(currInclude.mPath);
+			AppendBytes(content, currInclude.mIsSystemPathInclusion);
+			AppendBytes(content, currInclude.mContentHash);
+		}
+
+		AppendBytes(content, static_cast<uint64_t>(entry.mMacros.size()));
+
+		for (const TMacroDesc& currMacro : entry.mMacros)
+		{
+			appendString(currMacro.mName);
+			AppendBytes(content, static_cast<uint64_t>(currMacro.mArgsNames.size()));
+
+			for (const std::string& currArgName : currMacro.mArgsNames)
+			{
+				appendString(currArgName);
+			}
+
+			AppendBytes(content, currMacro.mVariadic);
+			AppendBytes(content, currMacro.mHasImplicitValue);
+			AppendBytes(content, static_cast<uint64_t>(currMacro.mValue.size()));
+
+			for (const TToken& currToken : currMacro.mValue)
+			{
+				AppendBytes(content, static_cast<uint32_t>(currToken.mType));
+				appendString(currToken.mRawView);
+				AppendBytes(content, static_cast<uint32_t>(currToken.mLineId));
+				AppendBytes(content, static_cast<uint32_t>(currToken.mPos));
+			}
+		}
+
+		AppendBytes(content, static_cast<uint64_t>(entry.mMacroDependencies.size()));
+
+		for (const std::string& currMacroName : entry.mMacroDependencies)
+		{
+			appendString(currMacroName);
+		}
+
+		AppendBytes(content, static_cast<uint64_t>(entry.mConditionalRegions.size()));
+
+		for (const TConditionalRegionInfo& currRegion : entry.mConditionalRegions)
+		{
+			appendString(currRegion.mFileId);
+			AppendBytes(content, static_cast<uint64_t>(currRegion.mLine));
+			AppendBytes(content, static_cast<uint32_t>(currRegion.mDirectiveType));
+			AppendBytes(content, currRegion.mIsActive);
+			AppendBytes(content, static_cast<uint64_t>(currRegion.mMacros.size()));
+
+			for (const std::string& currMacroName : currRegion.mMacros)
+			{
+				appendString(currMacroName);
+			}
+		}
+
+		appendString(entry.mOutput);
+
+		TDiskOutputCacheHeader header;
+		memcpy(header.mMagic, DiskOutputCacheMagic, sizeof(header.mMagic));
+		header.mVersion = TokensFormatVersion;
+		header.mEntryVersion = DiskOutputCacheEntryVersion;
+		header.mPayloadSize = content.length() - sizeof(header);
+		header.mChecksum = ComputeHash(content.data() + sizeof(header), content.length() - sizeof(header));
+
+		memcpy(&content[0], &header, sizeof(header));
+
+		if (content.length() > mMaxSizeInBytes)
+		{
+			return false;
+		}
+
+		const std::string path = _getEntryPath(key);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		const size_t prevSize = GetFileSize(path); // \note An existing entry is overwritten
+		if (!WriteFileAtomically(path, content))
+		{
+			return false;
+		}
+
+		mCurrSizeInBytes -= std::min(mCurrSizeInBytes, prevSize);
+		mCurrSizeInBytes += content.length();
+
+		if (mCurrSizeInBytes > mMaxSizeInBytes)
+		{
+			mCurrSizeInBytes = TrimCacheDirectory(mDirectory, DiskOutputCacheEntryExtension, mMaxSizeInBytes);
+		}
+
+		return true;
+	}
+
+	void DiskOutputCache::Clear() TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		for (const TFileEntryInfo& currEntry : ListDirectoryFiles(mDirectory, DiskOutputCacheEntryExtension))
+		{
+			std::remove(currEntry.mPath.c_str());
+		}
+
+		mCurrSizeInBytes = 0;
+	}
+
+	size_t DiskOutputCache::GetSize() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mCurrSizeInBytes;
+	}
+
+	TCacheStats DiskOutputCache::GetStats() const TCPP_NOEXCEPT
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mStats;
+	}
+
+	std::string DiskOutputCache::_getEntryPath(const std::string& key) const TCPP_NOEXCEPT
+	{
+		return mDirectory + "/" + key + DiskOutputCacheEntryExtension;
+	}
+
+
+	Preprocessor::Preprocessor(Lexer& lexer, const TPreprocessorConfigInfo& config) TCPP_NOEXCEPT:
+		mpLexer(&lexer), mConfig(config), mOnErrorCallback(), mOnIncludeCallback(config.mOnIncludeCallback), mOnResolveIncludeCallback(config.mOnResolveIncludeCallback), 
+		mErrorsCount(0), mpOutputCache(config.mpOutputCache), mpTokensCache(config.mpTokensCache), mpConditionsCache(),
+		mpExpansionsCache(TExpansionsCache(config.mExpansionsCacheCapacity)), mpIncludeGuardsTable(), mMemoizeIncludedFiles(config.mMemoizeIncludedFiles), 
+		mSkipCommentsTokens(config.mSkipComments), mTrackMacroDependencies(config.mTrackMacroDependencies), mIsPrefetchingStopped(false)
+	{
+		/// \note Errors are counted, outputs with errors aren't cached
+		mOnErrorCallback = [this, onErrorCallback = config.mOnErrorCallback](const TErrorInfo& errorInfo)
+		{
+			++mErrorsCount;
+
+			if (onErrorCallback)
+			{
+				onErrorCallback(errorInfo);
+			}
+		};
+
+		for (auto&& currSystemDefine : BuiltInDefines)
+		{
+			mSymTable.Add({ currSystemDefine });
+		}
+
+		if (config.mSpeculativeLexingWorkersCount)
+		{
+			mpWorkersPool = std::make_unique<WorkersPool>(config.mSpeculativeLexingWorkersCount);
+		}
+	}
+
+	Preprocessor::~Preprocessor() TCPP_NOEXCEPT
+	{
+		{
+			std::lock_guard<std::mutex> lock(mPrefetchMutex);
+			mIsPrefetchingStopped = true;
+		}
+
+		mpWorkersPool = nullptr; // \note Wait for all background tasks
+	}
+
+	bool Preprocessor::AddCustomDirectiveHandler(const std::string& directive, const TDirectiveHandler& handler) TCPP_NOEXCEPT
+	{
+		if ((mCustomDirectivesHandlersMap.find(directive) != mCustomDirectivesHandlersMap.cend()) ||
+			!mpLexer->AddCustomDirective(directive))
+		{
+			return false;
+		}
+
+		mCustomDirectivesHandlersMap.insert({ directive, handler });
+
+		return true;
+	}
+
+
+	std::unique_ptr<Preprocessor> Preprocessor::Fork(Lexer& lexer) const TCPP_NOEXCEPT
+	{
+		auto pFork = std::make_unique<Preprocessor>(lexer, mConfig);
+
+		pFork->mCustomDirectivesHandlersMap = mCustomDirectivesHandlersMap;
+
+		for (auto&& currHandler : mCustomDirectivesHandlersMap)
+		{
+			lexer.AddCustomDirective(currHandler.first); // \note The lexer may know the directive already, e.g. if it's used by other forks
+		}
+
+		pFork->mSymTable = mSymTable;
+		pFork->mHideSets = mHideSets; // \note Hide sets of cached expansions should be resolved by the same table
+
+		pFork->mpConditionsCache = mpConditionsCache;
+		pFork->mpExpansionsCache = mpExpansionsCache;
+		pFork->mpIncludeGuardsTable = mpIncludeGuardsTable;
+
+		return pFork;
+	}
+
+	bool Preprocessor::AddMacro(const TMacroDesc& macroDesc) TCPP_NOEXCEPT
+	{
+		TMacroDesc desc = macroDesc;
+
+		if (!desc.mArgsNames.empty() && desc.mBodyChunks.empty())
+		{
+			desc.mBodyChunks = CompileMacroBody(desc);
+		}
+
+		return mSymTable.Add(desc);
+	}
+
+
+	static void AddMacroRead(SymbolsTable::TReadsTable& reads, const std::string& macroName) TCPP_NOEXCEPT
+	{
+		reads.emplace(ComputeHash(macroName), macroName);
+	}
+
+
+	/*!
+		\brief The function returns a hash of the macro's definition, 0 is returned for an undefined macro
+	*/
+
+	static uint64_t ComputeMacroFingerprint(const TMacroDesc* pMacroDesc) TCPP_NOEXCEPT
+	{
+		if (!pMacroDesc)
+		{
+			return 0;
+		}
+
+		std::string definition;
+
+		for (const std::string& currArgName : pMacroDesc->mArgsNames)
+		{
+			definition.append(currArgName).push_back(',');
+		}
+
+		AppendBytes(definition, pMacroDesc->mVariadic);
+		AppendBytes(definition, pMacroDesc->mHasImplicitValue);
+
+		for (const TToken& currToken : pMacroDesc->mValue)
+		{
+			AppendBytes(definition, currToken.mType);
+			definition.append(currToken.mRawView).push_back('\0');
+		}
+
+		return std::max<uint64_t>(ComputeHash(definition), 1);
+	}
+
+
+	static bool inline IsParentBlockActive(const Preprocessor::TIfStack& conditionalsContext) TCPP_NOEXCEPT
+	{
+		return conditionalsContext.empty() ? true : (conditionalsContext.top().mIsParentBlockActive && !conditionalsContext.top().mShouldBeSkipped);
+	}
+
+
+	std::string Preprocessor::Process() TCPP_NOEXCEPT
+	{
+		TCPP_ASSERT(mpLexer);
+
+		mIncludesManifest.clear();
+		mErrorsCount = 0;
+
+		mIncludedFilesOutputs.clear(); // \note Files aren't requested when their outputs are replayed, so they're recorded only within a single processing
+
+		mMacroDependencies.clear();
+		mConditionalRegions.clear();
+
+		const std::string outputCacheKey = _computeOutputCacheKey();
+
+		if (!outputCacheKey.empty())
+		{
+			if (auto pEntry = mpOutputCache->Find(outputCacheKey, [this](auto&& entry) { return _isOutputEntryValid(entry); }))
+			{
+				mpLexer->PopStream(); // \note The source is consumed as if it was processed
+
+				_restoreSymbolsTable(pEntry->mMacros);
+
+				for (const std::string& currMacroName : pEntry->mMacroDependencies)
+				{
+					AddMacroRead(mMacroDependencies, currMacroName);
+				}
+
+				mConditionalRegions = pEntry->mConditionalRegions;
+
+				return pEntry->mOutput;
+			}
+		}
+
+		if (mTrackMacroDependencies)
+		{
+			mSymTable.SetReadsSet(&mMacroDependencies);
+		}
+
+		std::string processedStr;
+
+		if (mpWorkersPool)
+		{
+			/// \note The source is scanned at once to find out its #include directives as early as possible
+			if (auto pTokensBuffer = mpLexer->TokenizeActiveStream())
+			{
+				_prefetchIncludes(*pTokensBuffer);
+			}
+		}
+
+		auto appendString = [&processedStr, this](const std::string& str)
+		{
+			if (_shouldTokenBeSkipped())
+			{
+				return;
+			}
+
+			processedStr.append(str);
+		};
+
+		// \note first stage of preprocessing, expand macros and include directives
+		while (_hasNextToken())
+		{
+			auto currToken = _getNextToken();
+
+			_finishInclusions(mpLexer->GetStreamsCount(), processedStr, false); // \note Streams which have been closed by the lexer itself
+
+			const size_t conditionalDepth = mConditionalBlocksStack.size();
+			const size_t inclusionsCount = mInclusionsStack.size(); // \note The token belongs to the file which was read before the directive
+			const size_t directiveLine = mpLexer->GetCurrLineIndex();
+			const size_t tokenOutputOffset = processedStr.length();
+			std::string guardMacroName;
+
+			switch (currToken.mType)
+			{
+				case E_TOKEN_TYPE::DEFINE:
+					_createMacroDefinition();
+					break;
+				case E_TOKEN_TYPE::UNDEF:
+					currToken = mpLexer->GetNextToken();
+					_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+
+					currToken = mpLexer->GetNextToken();
+					_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
+
+					_removeMacroDefinition(currToken.mRawView);
+					break;
+				case E_TOKEN_TYPE::IF:
+					_trackConditionalRegion(currToken.mType, directiveLine, [this] { mConditionalBlocksStack.push(_processIfConditional()); });
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::IFNDEF:
+					_trackConditionalRegion(currToken.mType, directiveLine, [this, &guardMacroName] { mConditionalBlocksStack.push(_processIfndefConditional(guardMacroName)); });
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::IFDEF:
+					_trackConditionalRegion(currToken.mType, directiveLine, [this] { mConditionalBlocksStack.push(_processIfdefConditional()); });
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::ELIF:
+					_trackConditionalRegion(currToken.mType, directiveLine, [this] { _processElifConditional(mConditionalBlocksStack.top()); });
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::ELSE:
+					_trackConditionalRegion(currToken.mType, directiveLine, [this] { _processElseConditional(mConditionalBlocksStack.top()); });
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::ENDIF:
+					if (mConditionalBlocksStack.empty())
+					{
+						mOnErrorCallback({ E_ERROR_TYPE::UNBALANCED_ENDIF, mpLexer->GetCurrLineIndex() });
+					}
+					else
+					{
+						mConditionalBlocksStack.pop();
+					}
+
+					_skipInactiveBlock();
+					break;
+				case E_TOKEN_TYPE::INCLUDE:
+					appendString(_processInclusion(processedStr.length()));
+					break;
+				case E_TOKEN_TYPE::PRAGMA:
+					appendString(_processPragma());
+					break;
+				case E_TOKEN_TYPE::IDENTIFIER: // \note try to expand some macro here
+					{
+						const TMacroDesc* pMacroDesc = mSymTable.Find(currToken.mRawView);
+
+						/// \note If an operand of ## is an object-like macro it's not expanded
+						if (pMacroDesc && !mHideSets.Contains(currToken.mHideSetId, mHideSets.GetMacroId(pMacroDesc->mName)) &&
+							(!pMacroDesc->mArgsNames.empty() || E_TOKEN_TYPE::CONCAT_OP != _peekNextToken().mType))
+						{
+							_pushExpansionFrame(_expandMacroDefinition(*pMacroDesc, currToken, [this] { return _getNextToken(); }));
+						}
+						else
+						{
+							appendString(currToken.mRawView);
+						}
+					}
+					break;
+				case E_TOKEN_TYPE::CONCAT_OP:
+					while (!processedStr.empty() && (processedStr.back() == ' ' || processedStr.back() == '\t')) // \note Remove trailing whitespaces of the processed source
+					{
+						processedStr.erase(processedStr.length() - 1);
+					}
+
+					if (!mInclusionsStack.empty() && processedStr.length() < mInclusionsStack.back().mOutputOffset)
+					{
+						mInclusionsStack.back().mIsMemoizable = false; // \note The output of the includer has been changed
+					}
+
+					while ((currToken = _getNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+
+					appendString(currToken.mRawView);
+					break;
+				case E_TOKEN_TYPE::STRINGIZE_OP:
+					{
+						if (!currToken.mHideSetId) // \note The operator is allowed only within macro's expansions
+						{
+							mOnErrorCallback({ E_ERROR_TYPE::INCORRECT_OPERATION_USAGE, mpLexer->GetCurrLineIndex() });
+							continue;
+						}
+
+						appendString("\"" + (currToken = _getNextToken()).mRawView + "\"");
+					}
+					break;
+				case E_TOKEN_TYPE::CUSTOM_DIRECTIVE:
+					{
+						auto customDirectiveIter = mCustomDirectivesHandlersMap.find(currToken.mRawView);
+						if (customDirectiveIter != mCustomDirectivesHandlersMap.cend())
+						{
+							if (!mInclusionsStack.empty())
+							{
+								mInclusionsStack.back().mIsMemoizable = false; // \note Handlers could depend on anything
+							}
+
+							appendString(customDirectiveIter->second(*this, *mpLexer, processedStr));
+						}
+						else
+						{
+							mOnErrorCallback({ E_ERROR_TYPE::UNDEFINED_DIRECTIVE, mpLexer->GetCurrLineIndex() });
+						}
+					}
+					break;
+				default:
+					if (E_TOKEN_TYPE::COMMENTARY == currToken.mType && mSkipCommentsTokens)
+					{
+						break;
+					}
+
+					appendString(currToken.mRawView);
+					break;
+			}
+
+			if (inclusionsCount)
+			{
+				_updateInclusionState(mInclusionsStack[inclusionsCount - 1], currToken.mType, conditionalDepth, guardMacroName, processedStr, tokenOutputOffset);
+			}
+
+			if (mMemoizeIncludedFiles && !mInclusionsStack.empty())
+			{
+				_flushMacroReads();
+
+				const bool isIncluderBlockChanged = conditionalDepth <= mInclusionsStack.back().mConditionalDepth &&
+					(E_TOKEN_TYPE::ELSE == currToken.mType || E_TOKEN_TYPE::ELIF == currToken.mType || E_TOKEN_TYPE::ENDIF == currToken.mType);
+
+				if (isIncluderBlockChanged)
+				{
+					mInclusionsStack.back().mIsMemoizable = false;
+				}
+			}
+
+			/// \note A file which ends with #include is exhausted together with the included one
+			while (!_hasNextToken() && mpLexer->GetStreamsCount())
+			{
+				mpLexer->PopStream();
+			}
+
+			_finishInclusions(mpLexer->GetStreamsCount(), processedStr, true);
+		}
+
+		_finishInclusions(0, processedStr, false);
+
+		mSymTable.SetReadsSet(nullptr);
+
+		if (!outputCacheKey.empty() && !mErrorsCount)
+		{
+			auto pEntry = std::make_shared<OutputCache::TOutputEntry>();
+			pEntry->mIncludes = std::move(mIncludesManifest);
+			pEntry->mMacros = mSymTable.GetMacros();
+			pEntry->mOutput = processedStr;
+
+			if (mTrackMacroDependencies)
+			{
+				for (auto&& currMacroRead : mMacroDependencies)
+				{
+					pEntry->mMacroDependencies.push_back(currMacroRead.second);
+				}
+
+				pEntry->mConditionalRegions = mConditionalRegions;
+			}
+
+			mpOutputCache->Store(outputCacheKey, pEntry);
+		}
+
+		return processedStr;
+	}
+	
+	Preprocessor::TSymTable Preprocessor::GetSymbolsTable() const TCPP_NOEXCEPT
+	{
+		return mSymTable.GetMacros();
+	}
+
+	TCacheStats Preprocessor::GetConditionsCacheStats() const TCPP_NOEXCEPT
+	{
+		return mConditionsCacheStats;
+	}
+
+	TCacheStats Preprocessor::GetExpansionsCacheStats() const TCPP_NOEXCEPT
+	{
+		return mExpansionsCacheStats;
+	}
+
+	std::vector<std::string> Preprocessor::GetMacroDependencies() const TCPP_NOEXCEPT
+	{
+		std::vector<std::string> dependencies;
+
+		for (auto&& currMacroRead : mMacroDependencies)
+		{
+			const std::string& currMacroName = currMacroRead.second;
+
+			if (std::find(BuiltInDefines.cbegin(), BuiltInDefines.cend(), currMacroName) == BuiltInDefines.cend())
+			{
+				dependencies.push_back(currMacroName);
+			}
+		}
+
+		std::sort(dependencies.begin(), dependencies.end());
+
+		return dependencies;
+	}
+
+	const std::vector<Preprocessor::TConditionalRegionInfo>& Preprocessor::GetConditionalRegions() const TCPP_NOEXCEPT
+	{
+		return mConditionalRegions;
+	}
+
+	TCacheStats Preprocessor::GetIncludedFilesCacheStats() const TCPP_NOEXCEPT
+	{
+		return mIncludedFilesCacheStats;
+	}
+
+	void Preprocessor::_createMacroDefinition() TCPP_NOEXCEPT
+	{
+		TMacroDesc macroDesc;
+		
+		auto currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+
+		currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
+
+		macroDesc.mName = currToken.mRawView;
+
+		auto extractValue = [this](TMacroDesc& desc, Lexer& lexer)
+		{
+			TToken currToken;
+
+			while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+
+			if (currToken.mType != E_TOKEN_TYPE::NEWLINE)
+			{
+				desc.mValue.push_back(currToken);
+
+				const bool isStringificationOperator = currToken.mType == E_TOKEN_TYPE::STRINGIZE_OP;
+
+				while ((currToken = lexer.GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
+				{
+					if (E_TOKEN_TYPE::IDENTIFIER == currToken.mType && currToken.mRawView == desc.mName)
+					{
+						desc.mValue.emplace_back(TToken{ E_TOKEN_TYPE::BLOB, currToken.mRawView }); // \note Prevent self recursion
+						continue;
+					}
+
+					if (E_TOKEN_TYPE::IDENTIFIER == currToken.mType && isStringificationOperator) // \note Validate argument of the operator
+					{
+						auto&& macroArgs = desc.mArgsNames;
+						
+						if (std::find(macroArgs.cbegin(), macroArgs.cend(), currToken.mRawView) == macroArgs.cend())
+						{
+							mOnErrorCallback({ E_ERROR_TYPE::INCORRECT_STRINGIFY_OPERATOR_USAGE, mpLexer->GetCurrLineIndex() });
+						}
+					}
+
+					desc.mValue.push_back(currToken);
+				}
+			}
+
+			if (desc.mValue.empty())
+			{
+				desc.mValue.push_back({ E_TOKEN_TYPE::NUMBER, "1", mpLexer->GetCurrLineIndex() });
+				desc.mHasImplicitValue = true;
+			}
+
+			_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+		};
+
+		currToken = mpLexer->GetNextToken();
+		switch (currToken.mType)
+		{
+			case E_TOKEN_TYPE::SPACE:	// object like macro
+				extractValue(macroDesc, *mpLexer);
+				break;
+			case E_TOKEN_TYPE::NEWLINE:
+			case E_TOKEN_TYPE::END:
+				macroDesc.mValue.push_back({ E_TOKEN_TYPE::NUMBER, "1", mpLexer->GetCurrLineIndex() });
+				macroDesc.mHasImplicitValue = true;
+				break;
+			case E_TOKEN_TYPE::OPEN_BRACKET: // function line macro
+				{
+					// \note parse arguments
+					while (true)
+					{
+						while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+
+						switch (currToken.mType)
+						{
+						case E_TOKEN_TYPE::IDENTIFIER:
+							macroDesc.mArgsNames.push_back(currToken.mRawView);
+							break;
+						case E_TOKEN_TYPE::ELLIPSIS:
+							macroDesc.mArgsNames.push_back("__VA_ARGS__");
+							macroDesc.mVariadic = true;
+							break;
+						default:
+							mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
+						}
+
+						while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE);
+						if (macroDesc.mVariadic)
+						{
+							_expect(E_TOKEN_TYPE::CLOSE_BRACKET, currToken.mType);
+							break;
+						}
+						if (currToken.mType == E_TOKEN_TYPE::CLOSE_BRACKET)
+						{
+							break;
+						}
+
+						_expect(E_TOKEN_TYPE::COMMA, currToken.mType);
+					}
+					
+					// \note parse macro's value
+					extractValue(macroDesc, *mpLexer);
+				}
+				break;
+			default:
+				mOnErrorCallback({ E_ERROR_TYPE::INVALID_MACRO_DEFINITION, mpLexer->GetCurrLineIndex() });
+				break;
+		}
+		
+		if (_shouldTokenBeSkipped())
+		{
+			return;
+		}
+
+		if (!macroDesc.mArgsNames.empty())
+		{
+			macroDesc.mBodyChunks = CompileMacroBody(macroDesc);
+		}
+
+		_recordMacroChange(macroDesc.mName);
+
+		if (mTrackMacroDependencies)
+		{
+			AddMacroRead(mMacroDependencies, macroDesc.mName); // \note A redefinition changes the output with an error
+		}
+
+		if (!mSymTable.Add(macroDesc))
+		{
+			mOnErrorCallback({ E_ERROR_TYPE::MACRO_ALREADY_DEFINED, mpLexer->GetCurrLineIndex() });
+		}
+	}
+
+	void Preprocessor::_removeMacroDefinition(const std::string& macroName) TCPP_NOEXCEPT
+	{
+		if (_shouldTokenBeSkipped())
+		{
+			return;
+		}
+
+		_recordMacroChange(macroName);
+
+		if (mTrackMacroDependencies)
+		{
+			AddMacroRead(mMacroDependencies, macroName);
+		}
+
+		if (!mSymTable.Remove(macroName))
+		{
+			mOnErrorCallback({ E_ERROR_TYPE::UNDEFINED_MACRO, mpLexer->GetCurrLineIndex() });
+			return;
+		}
+
+		auto currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+	}
+
+	Preprocessor::TTokensSequencePtr Preprocessor::_expandMacroDefinition(const TMacroDesc& macroDesc, const TToken& idToken, const std::function<TToken()>& getNextTokenCallback,
+																		 TExpansionDependencies* pDependencies) const TCPP_NOEXCEPT
+	{
+		// \note expand object like macro with simple replacement
+		if (macroDesc.mArgsNames.empty())
+		{
+			static const std::unordered_map<std::string, std::function<TToken(const TToken&)>> systemMacrosTable
+			{
+				{ BuiltInDefines[0], [](const TToken& idToken) { return TToken {E_TOKEN_TYPE::BLOB, std::to_string(idToken.mLineId)}; }}, // __LINE__
+				{ BuiltInDefines[1], [](const TToken& idToken) { return TToken { E_TOKEN_TYPE::BLOB, idToken.mRawView }; } }, // __VA_ARGS__
+			};
+
+			auto iter = systemMacrosTable.find(macroDesc.mName);
+			if (iter != systemMacrosTable.cend())
+			{
+				if (pDependencies)
+				{
+					pDependencies->mIsCacheable = false;
+				}
+
+				return std::make_shared<std::vector<TToken>>(1, iter->second(idToken));
+			}
+
+			const HideSetsTable::TMacroId macroId = mHideSets.GetMacroId(macroDesc.mName);
+			const HideSetsTable::THideSetId hideSetId = mHideSets.Add(idToken.mHideSetId, macroId);
+
+			std::string cacheKey;
+			AppendBytes(cacheKey, macroId);
+			AppendBytes(cacheKey, mSymTable.GetVersion(macroDesc.mName));
+			AppendBytes(cacheKey, hideSetId);
+
+			if (auto pCachedTokens = _findExpansion(cacheKey, pDependencies))
+			{
+				return pCachedTokens;
+			}
+
+			std::vector<TToken> replacementList{ macroDesc.mValue.cbegin(), macroDesc.mValue.cend() };
+
+			for (auto& currToken : replacementList)
+			{
+				currToken.mHideSetId = mHideSets.Union(currToken.mHideSetId, hideSetId);
+			}
+
+			return _storeExpansion(std::move(cacheKey), std::move(replacementList), {}, pDependencies);
+		}
+
+		// \note function like macro's case
+		auto currToken = getNextTokenCallback();
+
+		while (currToken.mType == E_TOKEN_TYPE::SPACE) { currToken = getNextTokenCallback(); } // \note skip space tokens
+		
+		if (E_TOKEN_TYPE::OPEN_BRACKET != currToken.mType)
+		{
+			return std::make_shared<std::vector<TToken>>(std::initializer_list<TToken> { { E_TOKEN_TYPE::BLOB, macroDesc.mName }, currToken }); // \note Function like macro without brackets are is not expanded
+		}
+
+		_expect(E_TOKEN_TYPE::OPEN_BRACKET, currToken.mType);
+
+		/// \note Tokens of all arguments are captured into a single buffer, commas between arguments are kept there too
+		std::vector<TToken> argsTokens;
+		std::vector<TMacroArgument> args;
+
+		uint8_t currNestingLevel = 0;
+
+		// \note read all arguments values
+		while (true)
+		{
+			const size_t firstArgTokenIndex = argsTokens.size();
+
+			bool hasAnySpace = false;
+			while ((currToken = getNextTokenCallback()).mType == E_TOKEN_TYPE::SPACE) // \note skip space tokens
 			{
-				std::string commentStr;
+				hasAnySpace = true;
+			}
+
+			if (E_TOKEN_TYPE::CLOSE_BRACKET == currToken.mType || E_TOKEN_TYPE::COMMA == currToken.mType)
+			{
+				if (hasAnySpace)
+				{
+					argsTokens.push_back({ E_TOKEN_TYPE::SPACE, " " });
+				}
+				else
+				{
+					break; // \note There should be at least one space for empty argument
+				}
+			}
+			else
+			{
+				argsTokens.push_back(currToken);
+			}
+
+			if (E_TOKEN_TYPE::CLOSE_BRACKET != currToken.mType)
+			{
+				if (E_TOKEN_TYPE::OPEN_BRACKET == currToken.mType)
+				{
+					++currNestingLevel;
+				}
+
+				hasAnySpace = false;
+				while ((currToken = getNextTokenCallback()).mType == E_TOKEN_TYPE::SPACE)
+				{
+					hasAnySpace = true;
+				}
+
+				if (hasAnySpace && (currNestingLevel || (currToken.mType != E_TOKEN_TYPE::COMMA && currToken.mType != E_TOKEN_TYPE::CLOSE_BRACKET)))
+				{
+					argsTokens.push_back({ E_TOKEN_TYPE::SPACE, " " }); // \note Spaces after the first token are kept unless they end the argument
+				}
+
+				while ((currToken.mType != E_TOKEN_TYPE::COMMA &&
+					currToken.mType != E_TOKEN_TYPE::NEWLINE &&
+					currToken.mType != E_TOKEN_TYPE::CLOSE_BRACKET) || currNestingLevel)
+				{
+					switch (currToken.mType)
+					{
+					case E_TOKEN_TYPE::OPEN_BRACKET:
+						++currNestingLevel;
+						break;
+					case E_TOKEN_TYPE::CLOSE_BRACKET:
+						--currNestingLevel;
+						break;
+					default:
+						break;
+					}
+
+					argsTokens.push_back(currToken);
+					currToken = getNextTokenCallback();
+				}
+
+				if (currToken.mType != E_TOKEN_TYPE::COMMA && currToken.mType != E_TOKEN_TYPE::CLOSE_BRACKET)
+				{
+					_expect(E_TOKEN_TYPE::COMMA, currToken.mType);
+				}
+			}
+
+			args.push_back({ firstArgTokenIndex, argsTokens.size() - firstArgTokenIndex });
+
+			if (currToken.mType == E_TOKEN_TYPE::CLOSE_BRACKET)
+			{
+				break;
+			}
+
+			argsTokens.push_back(currToken);
+		}
+
+		if(macroDesc.mVariadic ?
+			(args.size() + 1 < macroDesc.mArgsNames.size()) :
+			(args.size()    != macroDesc.mArgsNames.size()))
+		{
+			mOnErrorCallback({ E_ERROR_TYPE::INCONSISTENT_MACRO_ARITY, mpLexer->GetCurrLineIndex() });
+		}
+
+		const HideSetsTable::TMacroId macroId = mHideSets.GetMacroId(macroDesc.mName);
+
+		// \note Prosser's algorithm: the expansion is hidden from macros which are hidden for both the name and the closing bracket
+		const HideSetsTable::THideSetId hideSetId = mHideSets.Add(mHideSets.Intersect(idToken.mHideSetId, currToken.mHideSetId), macroId);
+
+		// \note The variadic parameter takes all the rest arguments with commas between them
+		const auto& argsList = macroDesc.mArgsNames;
+
+		if (macroDesc.mVariadic && args.size() > argsList.size())
+		{
+			const TMacroArgument lastArg = args.back();
+
+			args.resize(argsList.size());
+			args.back().mTokensCount = lastArg.mFirstTokenIndex + lastArg.mTokensCount - args.back().mFirstTokenIndex;
+		}
+
+		std::string cacheKey;
+		AppendBytes(cacheKey, macroId);
+		AppendBytes(cacheKey, mSymTable.GetVersion(macroDesc.mName));
+		AppendBytes(cacheKey, hideSetId);
+
+		for (const TMacroArgument& currArg : args)
+		{
+			AppendBytes(cacheKey, currArg.mTokensCount);
+
+			for (size_t i = currArg.mFirstTokenIndex; i < currArg.mFirstTokenIndex + currArg.mTokensCount; ++i)
+			{
+				const TToken& currArgToken = argsTokens[i];
+
+				AppendBytes(cacheKey, currArgToken.mType);
+				AppendBytes(cacheKey, currArgToken.mHideSetId);
+				AppendBytes(cacheKey, currArgToken.mRawView.length());
+				cacheKey.append(currArgToken.mRawView);
+			}
+		}
+
+		if (auto pCachedTokens = _findExpansion(cacheKey, pDependencies))
+		{
+			return pCachedTokens;
+		}
+
+		std::vector<TMacroBodyChunk> compiledBodyChunks; // \note Definitions which weren't created with #define aren't precompiled
+		if (macroDesc.mBodyChunks.empty())
+		{
+			compiledBodyChunks = CompileMacroBody(macroDesc);
+		}
+
+		const std::vector<TMacroBodyChunk>& bodyChunks = macroDesc.mBodyChunks.empty() ? compiledBodyChunks : macroDesc.mBodyChunks;
+
+		std::vector<TToken> replacementList;
+		replacementList.reserve(macroDesc.mValue.size());
+
+		/// \note An argument is pre-expanded lazily when it's met first time outside of # and ## operators, the result is reused for other occurrences
+		std::vector<TTokensSequencePtr> expandedArgs(args.size());
+		TExpansionDependencies dependencies;
+
+		for (const TMacroBodyChunk& currChunk : bodyChunks)
+		{
+			auto firstTokenIt = macroDesc.mValue.cbegin() + currChunk.mFirstTokenIndex;
+
+			if (currChunk.mTokensCount)
+			{
+				replacementList.insert(replacementList.end(), firstTokenIt, firstTokenIt + currChunk.mTokensCount);
+				continue;
+			}
+
+			if (currChunk.mArgIndex >= args.size()) // \note Parameters without arguments are left as is
+			{
+				replacementList.push_back(*firstTokenIt);
+				continue;
+			}
+
+			auto firstArgTokenIt = argsTokens.cbegin() + args[currChunk.mArgIndex].mFirstTokenIndex;
+			auto lastArgTokenIt = firstArgTokenIt + args[currChunk.mArgIndex].mTokensCount;
+
+			if (currChunk.mIsConcatenated)
+			{
+				replacementList.insert(replacementList.end(), firstArgTokenIt, lastArgTokenIt); // \note The argument's tokens are spliced to be rescanned later
+				continue;
+			}
+
+			if (!currChunk.mIsStringized)
+			{
+				TTokensSequencePtr& pExpandedArg = expandedArgs[currChunk.mArgIndex];
+				if (!pExpandedArg)
+				{
+					pExpandedArg = std::make_shared<const std::vector<TToken>>(_expandMacroArg(firstArgTokenIt, lastArgTokenIt, dependencies));
+				}
+
+				replacementList.insert(replacementList.end(), pExpandedArg->cbegin(), pExpandedArg->cend());
+				continue;
+			}
+
+			/// \note A stringized argument is flattened into the single token which follows the operator
+			replacementList.push_back(*firstTokenIt);
+			replacementList.back().mRawView.clear();
+
+			for (auto it = firstArgTokenIt; it != lastArgTokenIt; ++it)
+			{
+				replacementList.back().mRawView.append(it->mRawView);
+			}
+		}
+
+		for (auto& currToken : replacementList)
+		{
+			currToken.mHideSetId = mHideSets.Union(currToken.mHideSetId, hideSetId);
+		}
+
+		return _storeExpansion(std::move(cacheKey), std::move(replacementList), std::move(dependencies), pDependencies);
+	}
+
+	std::vector<TToken> Preprocessor::_expandMacroArg(std::vector<TToken>::const_iterator firstTokenIt, std::vector<TToken>::const_iterator lastTokenIt, 
+													   TExpansionDependencies& dependencies) const TCPP_NOEXCEPT
+	{
+		/// \note The argument is expanded as if it formed the rest of the file, so its own frames are used instead of the lexer
+		TExpansionFramesStack frames;
+		frames.push_back({ std::make_shared<const std::vector<TToken>>(firstTokenIt, lastTokenIt), 0 });
+
+		auto getNextToken = [&frames]
+		{
+			while (!frames.empty() && frames.back().mCurrTokenIndex >= frames.back().mpTokens->size())
+			{
+				frames.pop_back();
+			}
+
+			return frames.empty() ? TToken { E_TOKEN_TYPE::END } : (*frames.back().mpTokens)[frames.back().mCurrTokenIndex++];
+		};
+
+		/// \note Checks whether pending tokens start with a bracketed list of arguments (isInvocation), or with ## operator otherwise
+		auto startsWith = [&frames](bool isInvocation)
+		{
+			uint32_t currNestingLevel = 0;
+
+			for (auto frameIt = frames.crbegin(); frameIt != frames.crend(); ++frameIt)
+			{
+				const std::vector<TToken>& tokens = *frameIt->mpTokens;
+
+				for (size_t i = frameIt->mCurrTokenIndex; i < tokens.size(); ++i)
+				{
+					const E_TOKEN_TYPE currType = tokens[i].mType;
+
+					if (E_TOKEN_TYPE::SPACE == currType && !currNestingLevel)
+					{
+						continue;
+					}
+
+					if (!isInvocation)
+					{
+						return E_TOKEN_TYPE::CONCAT_OP == currType;
+					}
+
+					if (!currNestingLevel && E_TOKEN_TYPE::OPEN_BRACKET != currType)
+					{
+						return false;
+					}
+
+					currNestingLevel += (E_TOKEN_TYPE::OPEN_BRACKET == currType) ? 1 : ((E_TOKEN_TYPE::CLOSE_BRACKET == currType) ? -1 : 0);
+
+					if (!currNestingLevel)
+					{
+						return true;
+					}
+				}
+			}
+
+			return false;
+		};
+
+		std::vector<TToken> expandedTokens;
+		expandedTokens.reserve(frames.back().mpTokens->size());
+
+		TToken currToken;
+
+		while ((currToken = getNextToken()).mType != E_TOKEN_TYPE::END)
+		{
+			if (E_TOKEN_TYPE::IDENTIFIER != currToken.mType)
+			{
+				expandedTokens.push_back(std::move(currToken));
+				continue;
+			}
+
+			const TMacroDesc* pMacroDesc = mSymTable.Find(currToken.mRawView);
+			dependencies.mReadMacrosVersions.emplace_back(currToken.mRawView, mSymTable.GetVersion(currToken.mRawView));
+
+			/// \note Function-like macros without complete invocations and operands of ## are left as is
+			const bool isFunctionLikeMacro = pMacroDesc && !pMacroDesc->mArgsNames.empty();
+
+			if (!pMacroDesc || mHideSets.Contains(currToken.mHideSetId, mHideSets.GetMacroId(pMacroDesc->mName)) ||
+				(isFunctionLikeMacro ? !startsWith(true) : startsWith(false)))
+			{
+				expandedTokens.push_back(std::move(currToken));
+				continue;
+			}
+
+			auto pExpandedTokens = _expandMacroDefinition(*pMacroDesc, currToken, getNextToken, &dependencies);
+			if (!pExpandedTokens->empty())
+			{
+				frames.push_back({ pExpandedTokens, 0 });
+			}
+		}
+
+		return expandedTokens;
+	}
+
+	Preprocessor::TTokensSequencePtr Preprocessor::_findExpansion(const std::string& cacheKey, TExpansionDependencies* pDependencies) const TCPP_NOEXCEPT
+	{
+		/// \note The order of entries isn't updated while the cache is shared with forks, so it's never copied on reads
+		const TExpansionCacheEntry* pEntry = mpExpansionsCache.IsFrozen() ? mpExpansionsCache->Peek(cacheKey) : mpExpansionsCache->Find(cacheKey);
+
+		const bool isEntryValid = pEntry && 
+			std::all_of(pEntry->mDependencies.mReadMacrosVersions.cbegin(), pEntry->mDependencies.mReadMacrosVersions.cend(), [this](auto&& entry)
+			{
+				return mSymTable.GetVersion(std::get<std::string>(entry)) == std::get<uint64_t>(entry);
+			});
+
+		if (!isEntryValid)
+		{
+			++mExpansionsCacheStats.mMissesCount;
+			return nullptr;
+		}
+
+		++mExpansionsCacheStats.mHitsCount;
+
+		if (pDependencies) // \note The caller's result depends on the same macros
+		{
+			const auto& readMacrosVersions = pEntry->mDependencies.mReadMacrosVersions;
+			pDependencies->mReadMacrosVersions.insert(pDependencies->mReadMacrosVersions.end(), readMacrosVersions.cbegin(), readMacrosVersions.cend());
+		}
+
+		return pEntry->mpTokens;
+	}
+
+	Preprocessor::TTokensSequencePtr Preprocessor::_storeExpansion(std::string&& cacheKey, std::vector<TToken>&& replacementList, TExpansionDependencies&& dependencies, 
+																  TExpansionDependencies* pDependencies) const TCPP_NOEXCEPT
+	{
+		auto pTokens = std::make_shared<const std::vector<TToken>>(std::move(replacementList));
+
+		if (pDependencies)
+		{
+			const auto& readMacrosVersions = dependencies.mReadMacrosVersions;
+
+			pDependencies->mReadMacrosVersions.insert(pDependencies->mReadMacrosVersions.end(), readMacrosVersions.cbegin(), readMacrosVersions.cend());
+			pDependencies->mIsCacheable = pDependencies->mIsCacheable && dependencies.mIsCacheable;
+		}
+
+		if (!dependencies.mIsCacheable)
+		{
+			return pTokens;
+		}
+
+		mpExpansionsCache.Detach().Insert(cacheKey, { pTokens, std::move(dependencies) }, 1);
+
+		return pTokens;
+	}
+
+	TToken Preprocessor::_getNextToken() TCPP_NOEXCEPT
+	{
+		if (mExpansionFrames.empty())
+		{
+			return mpLexer->GetNextToken();
+		}
+
+		TExpansionFrame& currFrame = mExpansionFrames.back();
+		TToken currToken = (*currFrame.mpTokens)[currFrame.mCurrTokenIndex++];
+
+		/// \note Exhausted frames are popped at once, so the stack doesn't grow when an expansion ends with another macro
+		if (currFrame.mCurrTokenIndex >= currFrame.mpTokens->size())
+		{
+			mExpansionFrames.pop_back();
+		}
+
+		return currToken;
+	}
+
+	TToken Preprocessor::_peekNextToken() const TCPP_NOEXCEPT
+	{
+		if (mExpansionFrames.empty())
+		{
+			return mpLexer->PeekNextToken();
+		}
+
+		/// \note Within expansions spaces are skipped, so operands of ## aren't expanded even if the operator is separated with spaces
+		for (auto frameIt = mExpansionFrames.crbegin(); frameIt != mExpansionFrames.crend(); ++frameIt)
+		{
+			const std::vector<TToken>& tokens = *frameIt->mpTokens;
+
+			for (size_t i = frameIt->mCurrTokenIndex; i < tokens.size(); ++i)
+			{
+				if (E_TOKEN_TYPE::SPACE != tokens[i].mType)
+				{
+					return tokens[i];
+				}
+			}
+		}
+
+		return mpLexer->PeekNextToken();
+	}
+
+	bool Preprocessor::_hasNextToken() const TCPP_NOEXCEPT
+	{
+		return !mExpansionFrames.empty() || mpLexer->HasNextToken();
+	}
+
+	void Preprocessor::_pushExpansionFrame(const TTokensSequencePtr& pTokens) TCPP_NOEXCEPT
+	{
+		if (pTokens->empty())
+		{
+			return;
+		}
+
+		mExpansionFrames.push_back({ pTokens, 0 });
+	}
+
+	void Preprocessor::_expect(const E_TOKEN_TYPE& expectedType, const E_TOKEN_TYPE& actualType) const TCPP_NOEXCEPT
+	{
+		if (expectedType == actualType)
+		{
+			return;
+		}
+
+		mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
+	}
 
-				if (PeekNextChar(inputLine, 1) == '/') // \note Found a single line C++ style comment
-				{
-					commentStr = ExtractSingleLineComment(inputLine);
-				}
-				else if (PeekNextChar(inputLine, 1) == '*') /// \note multi-line commentary
+	std::string Preprocessor::_processInclusion(size_t outputOffset) TCPP_NOEXCEPT
+	{
+		if (_shouldTokenBeSkipped())
+		{
+			return "";
+		}
+
+		TToken currToken;
+
+		while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+		
+		if (currToken.mType != E_TOKEN_TYPE::LESS && currToken.mType != E_TOKEN_TYPE::QUOTES && currToken.mType != E_TOKEN_TYPE::STRING_LITERAL)
+		{
+			while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::NEWLINE); // \note skip to end of current line
+
+			mOnErrorCallback({ E_ERROR_TYPE::INVALID_INCLUDE_DIRECTIVE, mpLexer->GetCurrLineIndex() });
+			return "";
+		}
+
+		bool isSystemPathInclusion = currToken.mType == E_TOKEN_TYPE::LESS;
+		
+		std::string path;
+
+		if (E_TOKEN_TYPE::STRING_LITERAL == currToken.mType)
+		{
+			path = currToken.mRawView.substr(1, currToken.mRawView.length() - 2); // \note The literal's quotes are dropped
+		}
+		else
+		{
+			while (true)
+			{
+				if ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::QUOTES ||
+					currToken.mType == E_TOKEN_TYPE::GREATER)
 				{
-					commentStr = ExtractMultiLineComments(inputLine, std::bind(&Lexer::_requestSourceLine, this));
+					break;
 				}
 
-				if (!commentStr.empty())
+				if (currToken.mType == E_TOKEN_TYPE::NEWLINE)
 				{
-					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, commentStr.length()));
-					return { E_TOKEN_TYPE::COMMENTARY, commentStr, mCurrLineIndex, mCurrPos };
+					mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_END_OF_INCLUDE_PATH, mpLexer->GetCurrLineIndex() });
+					break;
 				}
+
+				path.append(currToken.mRawView);
 			}
+		}
 
-			if (ch == '\n' || ch == '\r')
+		while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE);
+		
+		if (E_TOKEN_TYPE::NEWLINE != currToken.mType && E_TOKEN_TYPE::END != currToken.mType)
+		{
+			mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
+		}
+
+		if (!mOnIncludeCallback)
+		{
+			return "";
+		}
+
+		const std::string fileId = mOnResolveIncludeCallback ? mOnResolveIncludeCallback(path, isSystemPathInclusion) : GetIncludeKey(path, isSystemPathInclusion);
+
+		auto guardIt = fileId.empty() ? mpIncludeGuardsTable->cend() : mpIncludeGuardsTable->find(fileId);
+		if (guardIt != mpIncludeGuardsTable->cend() && (guardIt->second.mIsOnce || mSymTable.Contains(guardIt->second.mGuardMacroName)))
+		{
+			/// \note The file would be skipped entirely, so it's not even opened. An empty buffer keeps lines' numbers
+			auto pLinesBuffer = std::make_shared<TTokensBuffer>();
+			pLinesBuffer->mLinesCount = guardIt->second.mLinesCount;
+
+			mpLexer->PushStream(pLinesBuffer);
+
+			if (!mInclusionsStack.empty())
 			{
-				// flush current blob
-				if (!currStr.empty())
-				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex };
-				}
+				mInclusionsStack.back().mNestedLinesCount += pLinesBuffer->mLinesCount;
+			}
 
-				std::string separatorStr;
-				separatorStr.push_back(ch);
+			return guardIt->second.mOutput;
+		}
 
-				const char nextCh = PeekNextChar(inputLine, 1);
-				if (ch == '\r' && nextCh == '\n')
-				{
-					separatorStr.push_back(nextCh);
-				}
+		if (const TIncludedFileOutput* pFileOutput = _findIncludedFileOutput(fileId))
+		{
+			_flushMacroReads();
 
-				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos, separatorStr.length()));
-				return { E_TOKEN_TYPE::NEWLINE, separatorStr, mCurrLineIndex, mCurrPos};
+			for (const std::string& currMacroName : pFileOutput->mRemovedMacros)
+			{
+				_recordMacroChange(currMacroName);
+				mSymTable.Remove(currMacroName);
 			}
 
-			if (std::isspace(ch))
+			for (const TMacroDesc& currMacro : pFileOutput->mDefinedMacros)
 			{
-				// flush current blob
-				if (!currStr.empty())
+				_recordMacroChange(currMacro.mName);
+
+				mSymTable.Remove(currMacro.mName);
+				mSymTable.Add(currMacro);
+			}
+
+			if (mTrackMacroDependencies)
+			{
+				const std::vector<std::string> enclosingDependencies = mConditionalBlocksStack.empty() ? std::vector<std::string>() : mConditionalBlocksStack.top().mDependencies;
+
+				for (TConditionalRegionInfo regionInfo : pFileOutput->mConditionalRegions)
 				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+					regionInfo.mMacros.insert(regionInfo.mMacros.end(), enclosingDependencies.cbegin(), enclosingDependencies.cend());
+					std::sort(regionInfo.mMacros.begin(), regionInfo.mMacros.end());
+					regionInfo.mMacros.erase(std::unique(regionInfo.mMacros.begin(), regionInfo.mMacros.end()), regionInfo.mMacros.end());
+
+					mConditionalRegions.push_back(std::move(regionInfo));
 				}
+			}
 
-				std::string separatorStr;
-				separatorStr.push_back(inputLine.front());
+			/// \note An empty buffer moves the lexer over the same amount of lines as the file would take
+			auto pLinesBuffer = std::make_shared<TTokensBuffer>();
+			pLinesBuffer->mLinesCount = pFileOutput->mLinesCount;
 
-				mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
-				return { E_TOKEN_TYPE::SPACE, std::move(separatorStr), mCurrLineIndex, mCurrPos };
+			mpLexer->PushStream(pLinesBuffer);
+
+			if (!mInclusionsStack.empty())
+			{
+				mInclusionsStack.back().mNestedLinesCount += pLinesBuffer->mLinesCount;
 			}
 
-			if (ch == '#') // \note it could be # operator or a directive
+			return pFileOutput->mOutput;
+		}
+
+		const size_t streamsCount = mpLexer->GetStreamsCount();
+
+		if (mpWorkersPool)
+		{
+			std::shared_future<TLexedInclude> prefetchedInclude;
+
 			{
-				// flush current blob
-				if (!currStr.empty())
+				std::lock_guard<std::mutex> lock(mPrefetchMutex);
+
+				auto it = mPrefetchedIncludes.find(GetIncludeKey(path, isSystemPathInclusion));
+				if (it != mPrefetchedIncludes.cend())
 				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+					prefetchedInclude = it->second;
 				}
+			}
 
-				/// \note Skip whitespaces if there're exist
-				do
-				{
-					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
-				} 
-				while (std::isspace(PeekNextChar(inputLine, 0)));
+			const TLexedInclude lexedInclude = prefetchedInclude.valid() ? prefetchedInclude.get() : _lexIncludedFile(path, isSystemPathInclusion);
+			const TTokensBufferSharedPtr& pTokensBuffer = lexedInclude.mpTokensBuffer;
 
-				for (const auto& currDirective : mDirectivesTable)
-				{
-					auto&& currDirectiveStr = std::get<std::string>(currDirective);
+			if (mpOutputCache)
+			{
+				mIncludesManifest.push_back({ path, isSystemPathInclusion, lexedInclude.mContentHash });
+			}
 
-					if (inputLine.rfind(currDirectiveStr, 0) == 0)
-					{
-						inputLine.erase(0, currDirectiveStr.length());
-						mCurrPos += currDirectiveStr.length();
+			if (!pTokensBuffer)
+			{
+				return "";
+			}
 
-						return { std::get<E_TOKEN_TYPE>(currDirective), "", mCurrLineIndex, mCurrPos };
-					}
-				}
+			if (!prefetchedInclude.valid())
+			{
+				std::promise<TLexedInclude> tokensPromise;
+				tokensPromise.set_value(lexedInclude);
 
-				// \note custom directives
-				for (const auto& currDirectiveStr : mCustomDirectivesMap)
 				{
-					if (inputLine.rfind(currDirectiveStr, 0) == 0)
-					{
-						inputLine.erase(0, currDirectiveStr.length());
-						mCurrPos += currDirectiveStr.length();
-
-						return { E_TOKEN_TYPE::CUSTOM_DIRECTIVE, currDirectiveStr, mCurrLineIndex, mCurrPos };
-					}
+					std::lock_guard<std::mutex> lock(mPrefetchMutex);
+					mPrefetchedIncludes.emplace(GetIncludeKey(path, isSystemPathInclusion), tokensPromise.get_future().share());
 				}
 
-				// \note if we've reached this line it's # operator not directive
-				if (!inputLine.empty())
-				{
-					char nextCh = inputLine.front();
-					switch (nextCh)
-					{
-						case '#':	// \note concatenation operator
-							inputLine.erase(0, 1);
-							++mCurrPos;
-							return { E_TOKEN_TYPE::CONCAT_OP, "", mCurrLineIndex, mCurrPos };
-						default:
-							if (nextCh != ' ') // \note stringification operator
-							{
-								return { E_TOKEN_TYPE::STRINGIZE_OP, "", mCurrLineIndex, mCurrPos };
-							}
+				_prefetchIncludes(*pTokensBuffer);
+			}
 
-							return { E_TOKEN_TYPE::BLOB, "#", mCurrLineIndex, mCurrPos };
-					}
-				}
+			mpLexer->PushStream(pTokensBuffer);
+		}
+		else
+		{
+			TInputStreamUniquePtr pStream = mOnIncludeCallback(path, isSystemPathInclusion);
+
+			if (mpOutputCache)
+			{
+				mIncludesManifest.push_back({ path, isSystemPathInclusion, ComputeStreamHash(pStream) });
 			}
 
-			if (std::isdigit(ch))
+			if (!pStream)
 			{
-				// flush current blob
-				if (!currStr.empty())
-				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
-				}
+				return "";
+			}
 
-				std::string number;
-				std::string::size_type i = 0;
+			if (mpTokensCache && !pStream->GetTokensBuffer())
+			{
+				/// \note Reading of the file is much cheaper than its scanning, so the content's hash is used as a key.
+				/// Lines of the stream are expected to keep their line terminators like StringInputStream does
+				mpLexer->PushStream(mpTokensCache->GetTokens(ReadAllLines(*pStream), *mpLexer));
+			}
+			else
+			{
+				mpLexer->PushStream(std::move(pStream));
+			}
+		}
 
-				if (ch == '0' && !inputLine.empty())
-				{
-					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+		if (fileId.empty() || mpLexer->GetStreamsCount() <= streamsCount)
+		{
+			if (mpLexer->GetStreamsCount() > streamsCount && !mInclusionsStack.empty())
+			{
+				mInclusionsStack.back().mHasUntrackedInclusions = true;
+			}
 
-					number.push_back(ch);
+			return "";
+		}
 
-					char nextCh = inputLine.front();
-					if (nextCh == 'x' || std::isdigit(nextCh))
-					{
-						inputLine.erase(0, 1);
-						++mCurrPos;
+		_flushMacroReads(); // \note Reads of the directive belong to the includer
 
-						number.push_back(nextCh);
-					}
-					else
-					{
-						return { E_TOKEN_TYPE::NUMBER, number, mCurrLineIndex, mCurrPos };
-					}
-				}
+		TInclusionState inclusionState;
+		inclusionState.mFileId = fileId;
+		inclusionState.mStreamsCount = mpLexer->GetStreamsCount();
+		inclusionState.mConditionalDepth = mConditionalBlocksStack.size();
+		inclusionState.mOutputOffset = outputOffset;
+		inclusionState.mFirstLineIndex = mpLexer->GetCurrLineIndex();
+		inclusionState.mErrorsCount = mErrorsCount;
 
-				uint8_t charsToRemove = 0;
+		if (mTrackMacroDependencies)
+		{
+			inclusionState.mConditionalRegionsOffset = mConditionalRegions.size();
+			inclusionState.mEnclosingDependencies = mConditionalBlocksStack.empty() ? std::vector<std::string>() : mConditionalBlocksStack.top().mDependencies;
+		}
 
-				while ((i < inputLine.length()) && std::isdigit(ch = inputLine[i++]))
-				{
-					number.push_back(ch);
-					++charsToRemove;
-				}
+		mInclusionsStack.push_back(std::move(inclusionState));
 
-				inputLine.erase(0, charsToRemove);
-				mCurrPos += charsToRemove;
+		if (mMemoizeIncludedFiles)
+		{
+			mSymTable.SetReadsLog(&mMacroReadsLog);
+		}
 
-				return { E_TOKEN_TYPE::NUMBER, number, mCurrLineIndex, mCurrPos };
+		return "";
+	}
+
+	std::string Preprocessor::_computeOutputCacheKey() TCPP_NOEXCEPT
+	{
+		if (!mpOutputCache)
+		{
+			return "";
+		}
+
+		auto pContent = mpLexer->ReadActiveStream();
+		if (!pContent)
+		{
+			return "";
+		}
+
+		std::string config;
+		AppendBytes(config, mpLexer->GetConfigHash());
+		AppendBytes(config, mSkipCommentsTokens);
+		AppendBytes(config, mTrackMacroDependencies); // \note Entries of runs without tracking have no dependencies to restore
+
+		std::vector<std::string> customDirectives;
+		for (auto&& currHandler : mCustomDirectivesHandlersMap)
+		{
+			customDirectives.push_back(currHandler.first);
+		}
+
+		std::sort(customDirectives.begin(), customDirectives.end());
+
+		for (const std::string& currDirective : customDirectives)
+		{
+			config.append(currDirective).push_back('\0');
+		}
+
+		TSymTable macros = mSymTable.GetMacros();
+		std::sort(macros.begin(), macros.end(), [](auto&& left, auto&& right) { return left.mName < right.mName; });
+
+		for (const TMacroDesc& currMacro : macros)
+		{
+			config.append(currMacro.mName).push_back('\0');
+
+			AppendBytes(config, currMacro.mArgsNames.size());
+			for (const std::string& currArgName : currMacro.mArgsNames)
+			{
+				config.append(currArgName).push_back('\0');
 			}
 
-			if (ch == '_' || std::isalpha(ch)) ///< \note parse identifier
+			AppendBytes(config, currMacro.mVariadic);
+			AppendBytes(config, currMacro.mHasImplicitValue);
+			AppendBytes(config, currMacro.mValue.size());
+
+			for (const TToken& currToken : currMacro.mValue)
 			{
-				// flush current blob
-				if (!currStr.empty())
-				{
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex };
-				}
+				AppendBytes(config, currToken.mType);
+				AppendBytes(config, currToken.mRawView.length());
+				config.append(currToken.mRawView);
+			}
+		}
 
-				std::string identifier;
+		/// \note Two hashes with different seeds give a 128-bit key
+		const uint64_t firstHash = ComputeHash(config, ComputeHash(*pContent));
+		const uint64_t secondHash = ComputeHash(config, ComputeHash(*pContent, 0x9E3779B97F4A7C15ull));
 
-				do
-				{
-					identifier.push_back(ch);
-					mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
-				} while (!inputLine.empty() && (std::isalnum(ch = inputLine.front()) || (ch == '_')));
+		return KeyToHexString(firstHash) + KeyToHexString(secondHash);
+	}
 
-				return { (keywordsMap.find(identifier) != keywordsMap.cend()) ? E_TOKEN_TYPE::KEYWORD : E_TOKEN_TYPE::IDENTIFIER, identifier, mCurrLineIndex, mCurrPos };
+	bool Preprocessor::_isOutputEntryValid(const OutputCache::TOutputEntry& entry) const TCPP_NOEXCEPT
+	{
+		return std::all_of(entry.mIncludes.cbegin(), entry.mIncludes.cend(), [this](const OutputCache::TIncludeRecord& includeRecord)
+		{
+			if (!mOnIncludeCallback)
+			{
+				return false;
 			}
 
-			mCurrPos = std::get<size_t>(EatNextChar(inputLine, mCurrPos));
+			TInputStreamUniquePtr pStream = mOnIncludeCallback(includeRecord.mPath, includeRecord.mIsSystemPathInclusion);
+			return ComputeStreamHash(pStream) == includeRecord.mContentHash;
+		});
+	}
 
-			if ((separators.find_first_of(ch) != std::string::npos))
+	static bool IsSameMacroDefinition(const TMacroDesc& left, const TMacroDesc& right) TCPP_NOEXCEPT
+	{
+		return left.mArgsNames == right.mArgsNames && left.mVariadic == right.mVariadic && left.mHasImplicitValue == right.mHasImplicitValue &&
+			std::equal(left.mValue.cbegin(), left.mValue.cend(), right.mValue.cbegin(), right.mValue.cend(), [](const TToken& leftToken, const TToken& rightToken)
 			{
-				if (!currStr.empty())
-				{
-					auto separatingToken = _scanSeparatorTokens(ch, inputLine);
-					if (separatingToken.mType != mEOFToken.mType)
-					{
-						mTokensQueue.push_front(separatingToken);
-					}
+				return leftToken.mType == rightToken.mType && leftToken.mRawView == rightToken.mRawView;
+			});
+	}
+
+	void Preprocessor::_restoreSymbolsTable(const TSymTable& macros) TCPP_NOEXCEPT
+	{
+		std::unordered_set<std::string> macrosNames;
+
+		for (const TMacroDesc& currMacro : macros)
+		{
+			macrosNames.insert(currMacro.mName);
+		}
 
-					return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos }; // flush current blob
-				}
+		std::vector<std::string> removedMacros;
 
-				auto separatingToken = _scanSeparatorTokens(ch, inputLine);
-				if (separatingToken.mType != mEOFToken.mType)
-				{
-					return separatingToken;
-				}
+		for (const TMacroDesc& currMacro : mSymTable.GetMacros())
+		{
+			if (macrosNames.find(currMacro.mName) == macrosNames.cend())
+			{
+				removedMacros.push_back(currMacro.mName);
 			}
+		}
 
-			currStr.push_back(ch);
+		for (const std::string& currMacroName : removedMacros)
+		{
+			mSymTable.Remove(currMacroName);
 		}
 
-		// flush current blob
-		if (!currStr.empty())
+		for (const TMacroDesc& currMacro : macros)
 		{
-			return { E_TOKEN_TYPE::BLOB, currStr, mCurrLineIndex, mCurrPos };
+			const TMacroDesc* pCurrMacro = mSymTable.Find(currMacro.mName);
+			if (pCurrMacro && IsSameMacroDefinition(*pCurrMacro, currMacro))
+			{
+				continue;
+			}
+
+			mSymTable.Remove(currMacro.mName);
+			mSymTable.Add(currMacro);
 		}
+	}
 
-		PopStream();
+	std::string Preprocessor::_processPragma() TCPP_NOEXCEPT
+	{
+		std::string pragmaStr;
 
-		//\note try to continue preprocessing if there is at least one input stream
-		if (!mStreamsContext.empty())
+		TToken currToken;
+
+		while ((currToken = mpLexer->GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE && currToken.mType != E_TOKEN_TYPE::END)
 		{
-			return GetNextToken();
+			pragmaStr.append(currToken.mRawView);
 		}
 
-		return mEOFToken;
-	}
+		const size_t firstCharPos = pragmaStr.find_first_not_of(" \t");
+		const size_t lastCharPos = pragmaStr.find_last_not_of(" \t");
 
+		if (firstCharPos == std::string::npos || pragmaStr.compare(firstCharPos, lastCharPos - firstCharPos + 1, "once"))
+		{
+			/// \note Other pragmas are kept for a compiler together with their original line terminators
+			return "#pragma" + pragmaStr + ((E_TOKEN_TYPE::NEWLINE == currToken.mType) ? currToken.mRawView : "");
+		}
 
-	static bool IsEscapeSequenceAtPos(const std::string& str, std::string::size_type pos)
-	{
-		if (pos + 1 >= str.length() || pos >= str.length() || str[pos] != '\\')
+		if (!mInclusionsStack.empty() && !_shouldTokenBeSkipped())
 		{
-			return false;
+			mInclusionsStack.back().mIsOnce = true;
 		}
 
-		static constexpr char escapeSymbols[] { '\'', '\\', 'n', '\"', 'a', 'b', 'f', 'r', 't', 'v' };
+		return "";
+	}
 
-		char testedSymbol = str[pos + 1];
+	void Preprocessor::_updateInclusionState(TInclusionState& state, E_TOKEN_TYPE tokenType, size_t conditionalDepth, const std::string& guardMacroName, 
+		const std::string& output, size_t tokenOutputOffset) TCPP_NOEXCEPT
+	{
+		if (E_INCLUDE_GUARD_STATE::NONE == state.mGuardState)
+		{
+			return;
+		}
 
-		for (char ch : escapeSymbols)
+		if (E_TOKEN_TYPE::SPACE == tokenType || E_TOKEN_TYPE::NEWLINE == tokenType || E_TOKEN_TYPE::END == tokenType ||
+			(E_TOKEN_TYPE::COMMENTARY == tokenType && mSkipCommentsTokens))
 		{
-			if (ch == testedSymbol)
+			/// \note The file still writes whitespaces outside of the guard when it's included again, so they're replayed on skipping
+			if (E_INCLUDE_GUARD_STATE::INSIDE_GUARD != state.mGuardState && conditionalDepth <= state.mConditionalDepth && tokenOutputOffset < output.length())
 			{
-				return true;
+				state.mUnguardedOutput.append(output, tokenOutputOffset, std::string::npos);
 			}
+
+			return;
 		}
 
-		return false;
-	}
+		/// \note The guard is the only thing which is allowed at the top level of the file
+		if (conditionalDepth <= state.mConditionalDepth)
+		{
+			const bool isGuardOpened = E_INCLUDE_GUARD_STATE::AWAIT_IFNDEF == state.mGuardState && E_TOKEN_TYPE::IFNDEF == tokenType;
 
-	std::string Lexer::_requestSourceLine() TCPP_NOEXCEPT
-	{
-		IInputStream* pCurrInputStream = _getActiveStream();
+			state.mGuardState = isGuardOpened ? E_INCLUDE_GUARD_STATE::INSIDE_GUARD : E_INCLUDE_GUARD_STATE::NONE;
+			state.mGuardMacroName = isGuardOpened ? guardMacroName : "";
 
-		if (!pCurrInputStream->HasNextLine())
+			return;
+		}
+
+		if (conditionalDepth > state.mConditionalDepth + 1 || E_INCLUDE_GUARD_STATE::INSIDE_GUARD != state.mGuardState)
 		{
-			return "";
+			return;
 		}
 
-		std::string sourceLine = pCurrInputStream->ReadLine();
-		++mCurrLineIndex;
+		switch (tokenType)
+		{
+			case E_TOKEN_TYPE::ELSE:
+			case E_TOKEN_TYPE::ELIF:
+				state.mGuardState = E_INCLUDE_GUARD_STATE::NONE;
+				break;
+			case E_TOKEN_TYPE::ENDIF:
+				state.mGuardState = E_INCLUDE_GUARD_STATE::AFTER_GUARD;
+				break;
+			default:
+				break;
+		}
+	}
 
-		/// \note join lines that were splitted with backslash sign
-		std::string::size_type pos = 0;
-		while (((pos = sourceLine.find_first_of('\\')) != std::string::npos) 
-			&& (std::isspace(PeekNextChar(sourceLine, pos + 1)) || PeekNextChar(sourceLine, pos + 1) == EOF) && !IsEscapeSequenceAtPos(sourceLine, pos))
+	void Preprocessor::_finishInclusions(size_t streamsCount, const std::string& output, bool isLinesCountKnown) TCPP_NOEXCEPT
+	{
+		while (!mInclusionsStack.empty() && mInclusionsStack.back().mStreamsCount > streamsCount)
 		{
-			if (pCurrInputStream->HasNextLine())
+			const TInclusionState& state = mInclusionsStack.back();
+
+			/// \note A skipped file moves the lexer over its own lines. A guarded file isn't skipped if they're unknown, 
+			/// but #pragma once is kept anyway and all lines which have been read are used then
+			const size_t linesCount = mpLexer->GetCurrLineIndex() - state.mFirstLineIndex;
+			const bool isOwnLinesCountKnown = isLinesCountKnown && !state.mHasUntrackedInclusions;
+			const size_t ownLinesCount = isOwnLinesCountKnown ? linesCount - state.mNestedLinesCount : linesCount;
+
+			if (state.mIsOnce)
 			{
-				sourceLine.replace(pos ? (pos - 1) : 0, std::string::npos, pCurrInputStream->ReadLine());
-				++mCurrLineIndex;
+				mpIncludeGuardsTable.Detach()[state.mFileId] = { "", true, "", ownLinesCount };
+			}
+			else if (isOwnLinesCountKnown && E_INCLUDE_GUARD_STATE::AFTER_GUARD == state.mGuardState)
+			{
+				mpIncludeGuardsTable.Detach()[state.mFileId] = { state.mGuardMacroName, false, state.mUnguardedOutput, ownLinesCount };
+			}
 
-				continue;
+			if (mMemoizeIncludedFiles)
+			{
+				_flushMacroReads();
+				_storeIncludedFileOutput(state, output, isLinesCountKnown);
 			}
 
-			sourceLine.erase(sourceLine.begin() + pos, sourceLine.end());
+			mInclusionsStack.pop_back();
+
+			if (!mInclusionsStack.empty())
+			{
+				mInclusionsStack.back().mNestedLinesCount += linesCount;
+				mInclusionsStack.back().mHasUntrackedInclusions |= !isLinesCountKnown;
+			}
 		}
 
-		return sourceLine;
+		if (mInclusionsStack.empty())
+		{
+			mSymTable.SetReadsLog(nullptr);
+		}
 	}
 
-	TToken Lexer::_scanSeparatorTokens(char ch, std::string& inputLine) TCPP_NOEXCEPT
+	static const size_t MaxIncludedFileOutputsCount = 8; ///< Amount of recorded outputs per file
+
+	const Preprocessor::TIncludedFileOutput* Preprocessor::_findIncludedFileOutput(const std::string& fileId) TCPP_NOEXCEPT
 	{
-		switch (ch)
+		if (!mMemoizeIncludedFiles || fileId.empty())
 		{
-			case ',':
-				return { E_TOKEN_TYPE::COMMA, ",", mCurrLineIndex, mCurrPos };
-			case '(':
-				return { E_TOKEN_TYPE::OPEN_BRACKET, "(", mCurrLineIndex, mCurrPos };
-			case ')':
-				return { E_TOKEN_TYPE::CLOSE_BRACKET, ")", mCurrLineIndex, mCurrPos }; 
-			case '[':
-				return { E_TOKEN_TYPE::OPEN_SQUARE_BRACKET, "[", mCurrLineIndex, mCurrPos };
-			case ']':
-				return { E_TOKEN_TYPE::CLOSE_SQUARE_BRACKET, "]", mCurrLineIndex, mCurrPos };
-			case '<':
-				if (!inputLine.empty())
-				{
-					char nextCh = inputLine.front();
-					switch (nextCh)
-					{
-						case '<':
-							inputLine.erase(0, 1);
-							++mCurrPos;
-							return { E_TOKEN_TYPE::LSHIFT, "<<", mCurrLineIndex, mCurrPos };
-						case '=':
-							inputLine.erase(0, 1);
-							++mCurrPos;
-							return { E_TOKEN_TYPE::LE, "<=", mCurrLineIndex, mCurrPos };
-					}					
-				}
+			return nullptr;
+		}
 
-				return { E_TOKEN_TYPE::LESS, "<", mCurrLineIndex, mCurrPos };
-			case '>':
-				if (!inputLine.empty())
+		auto it = mIncludedFilesOutputs.find(fileId);
+		if (it != mIncludedFilesOutputs.cend())
+		{
+			/// \note Lookups are logged as reads of the includer, so its own record depends on the same macros
+			for (const TIncludedFileOutput& currOutput : it->second)
+			{
+				const bool isOutputValid = std::all_of(currOutput.mReadMacros.cbegin(), currOutput.mReadMacros.cend(), [this](auto&& entry)
 				{
-					char nextCh = inputLine.front();
-					switch (nextCh)
-					{
-						case '>':
-							inputLine.erase(0, 1);
-							++mCurrPos;
-							return { E_TOKEN_TYPE::RSHIFT, ">>", mCurrLineIndex, mCurrPos };
-						case '=':
-							inputLine.erase(0, 1);
-							++mCurrPos;
-							return { E_TOKEN_TYPE::GE, ">=", mCurrLineIndex, mCurrPos };
-					}
-				}
+					return ComputeMacroFingerprint(mSymTable.Find(std::get<std::string>(entry))) == std::get<uint64_t>(entry);
+				});
 
-				return { E_TOKEN_TYPE::GREATER, ">", mCurrLineIndex, mCurrPos };
-			case '\"':
-				return { E_TOKEN_TYPE::QUOTES, "\"", mCurrLineIndex, mCurrPos };
-			case '+':
-				return { E_TOKEN_TYPE::PLUS, "+", mCurrLineIndex, mCurrPos };
-			case '-':
-				return { E_TOKEN_TYPE::MINUS, "-", mCurrLineIndex, mCurrPos };
-			case '*':
-				return { E_TOKEN_TYPE::STAR, "*", mCurrLineIndex, mCurrPos };
-			case '/':
-				return { E_TOKEN_TYPE::SLASH, "/", mCurrLineIndex, mCurrPos };
-			case '&':
-				if (!inputLine.empty() && inputLine.front() == '&')
+				if (isOutputValid)
 				{
-					inputLine.erase(0, 1);
-					++mCurrPos;
-					return { E_TOKEN_TYPE::AND, "&&", mCurrLineIndex, mCurrPos };
+					++mIncludedFilesCacheStats.mHitsCount;
+					return &currOutput;
 				}
+			}
+		}
 
-				return { E_TOKEN_TYPE::AMPERSAND, "&", mCurrLineIndex, mCurrPos };
-			case '|':
-				if (!inputLine.empty() && inputLine.front() == '|')
-				{
-					inputLine.erase(0, 1);
-					++mCurrPos;
-					return { E_TOKEN_TYPE::OR, "||", mCurrLineIndex, mCurrPos };
-				}
+		++mIncludedFilesCacheStats.mMissesCount;
+		return nullptr;
+	}
 
-				return { E_TOKEN_TYPE::VLINE, "|", mCurrLineIndex, mCurrPos };
-			case '!':
-				if (!inputLine.empty() && inputLine.front() == '=')
-				{
-					inputLine.erase(0, 1);
-					++mCurrPos;
-					return { E_TOKEN_TYPE::NE, "!=", mCurrLineIndex, mCurrPos };
-				}
+	void Preprocessor::_storeIncludedFileOutput(const TInclusionState& state, const std::string& output, bool isLinesCountKnown) TCPP_NOEXCEPT
+	{
+		TInclusionState* pIncluderState = (mInclusionsStack.size() > 1) ? &mInclusionsStack[mInclusionsStack.size() - 2] : nullptr;
 
-				return { E_TOKEN_TYPE::NOT, "!", mCurrLineIndex, mCurrPos };
-			case '=':
-				if (!inputLine.empty() && inputLine.front() == '=')
-				{
-					inputLine.erase(0, 1);
-					++mCurrPos;
-					return { E_TOKEN_TYPE::EQ, "==", mCurrLineIndex, mCurrPos };
-				}
+		/// \note Files which mark themselves with #pragma once or leave conditional blocks unbalanced can't be replayed
+		const bool isMemoizable = state.mIsMemoizable && isLinesCountKnown && !state.mIsOnce && state.mErrorsCount == mErrorsCount && 
+			state.mConditionalDepth == mConditionalBlocksStack.size() && output.length() >= state.mOutputOffset;
 
-				return { E_TOKEN_TYPE::BLOB, "=", mCurrLineIndex, mCurrPos };
+		if (!isMemoizable)
+		{
+			if (pIncluderState)
+			{
+				pIncluderState->mIsMemoizable = false;
+			}
 
-			case ';':
-				return { E_TOKEN_TYPE::SEMICOLON, ";", mCurrLineIndex, mCurrPos };
+			return;
 		}
 
-		return mEOFToken;
+		TIncludedFileOutput fileOutput;
+		fileOutput.mOutput = output.substr(state.mOutputOffset);
+		fileOutput.mLinesCount = mpLexer->GetCurrLineIndex() - state.mFirstLineIndex;
+
+		for (auto&& currRead : state.mReadMacros)
+		{
+			fileOutput.mReadMacros.emplace_back(currRead.first, currRead.second);
+		}
+
+		mSymTable.SetReadsLog(nullptr);
+
+		for (const std::string& currMacroName : state.mChangedMacros)
+		{
+			if (const TMacroDesc* pMacroDesc = mSymTable.Find(currMacroName))
+			{
+				fileOutput.mDefinedMacros.push_back(*pMacroDesc);
+			}
+			else
+			{
+				fileOutput.mRemovedMacros.push_back(currMacroName);
+			}
+		}
+
+		mSymTable.SetReadsLog(&mMacroReadsLog);
+
+		if (mTrackMacroDependencies)
+		{
+			/// \note Enclosing blocks may differ at the replay, a macro is kept only if the file has consulted it too
+			auto isEnclosingDependency = [&state](const std::string& macroName)
+			{
+				return std::binary_search(state.mEnclosingDependencies.cbegin(), state.mEnclosingDependencies.cend(), macroName) &&
+					state.mReadMacros.find(macroName) == state.mReadMacros.cend() && state.mChangedMacros.find(macroName) == state.mChangedMacros.cend();
+			};
+
+			for (size_t i = state.mConditionalRegionsOffset; i < mConditionalRegions.size(); ++i)
+			{
+				TConditionalRegionInfo regionInfo = mConditionalRegions[i];
+				regionInfo.mMacros.erase(std::remove_if(regionInfo.mMacros.begin(), regionInfo.mMacros.end(), isEnclosingDependency), regionInfo.mMacros.end());
+
+				fileOutput.mConditionalRegions.push_back(std::move(regionInfo));
+			}
+		}
+
+		auto& fileOutputs = mIncludedFilesOutputs[state.mFileId];
+		if (fileOutputs.size() >= MaxIncludedFileOutputsCount)
+		{
+			fileOutputs.erase(fileOutputs.begin());
+		}
+
+		fileOutputs.push_back(std::move(fileOutput));
+
+		if (!pIncluderState)
+		{
+			return;
+		}
+
+		/// \note The includer depends on everything the file has read unless the includer has changed it before
+		for (auto&& currRead : state.mReadMacros)
+		{
+			if (pIncluderState->mChangedMacros.find(currRead.first) == pIncluderState->mChangedMacros.cend())
+			{
+				pIncluderState->mReadMacros.emplace(currRead.first, currRead.second);
+			}
+		}
+
+		pIncluderState->mChangedMacros.insert(state.mChangedMacros.cbegin(), state.mChangedMacros.cend());
 	}
 
-	IInputStream* Lexer::_getActiveStream() const TCPP_NOEXCEPT
+	void Preprocessor::_flushMacroReads() TCPP_NOEXCEPT
 	{
-		return mStreamsContext.empty() ? nullptr : mStreamsContext.top().get();
-	}
+		if (mMacroReadsLog.empty())
+		{
+			return;
+		}
 
+		if (mInclusionsStack.empty())
+		{
+			mMacroReadsLog.clear();
+			return;
+		}
 
-	static const std::vector<std::string> BuiltInDefines
-	{
-		"__LINE__",
-		"__VA_ARGS__",
-	};
+		TInclusionState& state = mInclusionsStack.back();
 
+		mSymTable.SetReadsLog(nullptr);
 
-	Preprocessor::Preprocessor(Lexer& lexer, const TPreprocessorConfigInfo& config) TCPP_NOEXCEPT:
-		mpLexer(&lexer), mOnErrorCallback(config.mOnErrorCallback), mOnIncludeCallback(config.mOnIncludeCallback), mSkipCommentsTokens(config.mSkipComments)
-	{
-		for (auto&& currSystemDefine : BuiltInDefines)
+		for (auto&& currMacroRead : mMacroReadsLog)
 		{
-			mSymTable.push_back({ currSystemDefine });
+			const std::string& currMacroName = currMacroRead.second;
+
+			if (std::find(BuiltInDefines.cbegin(), BuiltInDefines.cend(), currMacroName) != BuiltInDefines.cend())
+			{
+				state.mIsMemoizable = false; // \note Values of built-in macros depend on the position within the file
+				continue;
+			}
+
+			if (state.mChangedMacros.find(currMacroName) == state.mChangedMacros.cend())
+			{
+				state.mReadMacros.emplace(currMacroName, ComputeMacroFingerprint(mSymTable.Find(currMacroName)));
+			}
 		}
+
+		mMacroReadsLog.clear();
+
+		mSymTable.SetReadsLog(&mMacroReadsLog);
 	}
 
-	bool Preprocessor::AddCustomDirectiveHandler(const std::string& directive, const TDirectiveHandler& handler) TCPP_NOEXCEPT
+	void Preprocessor::_recordMacroChange(const std::string& macroName) TCPP_NOEXCEPT
 	{
-		if ((mCustomDirectivesHandlersMap.find(directive) != mCustomDirectivesHandlersMap.cend()) ||
-			!mpLexer->AddCustomDirective(directive))
+		if (!mMemoizeIncludedFiles || mInclusionsStack.empty())
 		{
-			return false;
+			return;
 		}
 
-		mCustomDirectivesHandlersMap.insert({ directive, handler });
+		/// \note A definition depends on the previous state of the macro, because redefinitions are reported as errors
+		AddMacroRead(mMacroReadsLog, macroName);
+		_flushMacroReads();
 
-		return true;
+		mInclusionsStack.back().mChangedMacros.insert(macroName);
 	}
 
-
-	static bool inline IsParentBlockActive(const Preprocessor::TIfStack& conditionalsContext) TCPP_NOEXCEPT
+	Preprocessor::TLexedInclude Preprocessor::_lexIncludedFile(const std::string& path, bool isSystemPathInclusion) const TCPP_NOEXCEPT
 	{
-		return conditionalsContext.empty() ? true : (conditionalsContext.top().mIsParentBlockActive && !conditionalsContext.top().mShouldBeSkipped);
-	}
+		TLexedInclude lexedInclude;
 
+		TInputStreamUniquePtr pStream = mOnIncludeCallback(path, isSystemPathInclusion);
 
-	std::string Preprocessor::Process() TCPP_NOEXCEPT
-	{
-		TCPP_ASSERT(mpLexer);
+		if (mpOutputCache)
+		{
+			/// \note The hash is computed here, because tokens don't keep the content and the file shouldn't be requested twice
+			lexedInclude.mContentHash = ComputeStreamHash(pStream);
+		}
 
-		std::string processedStr;
+		if (!pStream)
+		{
+			return lexedInclude;
+		}
 
-		auto appendString = [&processedStr, this](const std::string& str)
+		if (mpTokensCache && !pStream->GetTokensBuffer())
 		{
-			if (_shouldTokenBeSkipped())
-			{
-				return;
-			}
+			lexedInclude.mpTokensBuffer = mpTokensCache->GetTokens(ReadAllLines(*pStream), *mpLexer);
+		}
+		else
+		{
+			lexedInclude.mpTokensBuffer = mpLexer->Tokenize(std::move(pStream));
+		}
 
-			processedStr.append(str);
-		};
+		return lexedInclude;
+	}
 
-		// \note first stage of preprocessing, expand macros and include directives
-		while (mpLexer->HasNextToken())
+	void Preprocessor::_prefetchIncludes(const TTokensBuffer& tokensBuffer) TCPP_NOEXCEPT
+	{
+		for (auto&& currInclude : FindIncludeDirectives(tokensBuffer))
 		{
-			auto currToken = mpLexer->GetNextToken();
+			const std::string& path = std::get<std::string>(currInclude);
+			const bool isSystemPathInclusion = std::get<bool>(currInclude);
 
-			switch (currToken.mType)
-			{
-				case E_TOKEN_TYPE::DEFINE:
-					_createMacroDefinition();
-					break;
-				case E_TOKEN_TYPE::UNDEF:
-					currToken = mpLexer->GetNextToken();
-					_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+			std::lock_guard<std::mutex> lock(mPrefetchMutex);
 
-					currToken = mpLexer->GetNextToken();
-					_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
+			const std::string key = GetIncludeKey(path, isSystemPathInclusion);
 
-					_removeMacroDefinition(currToken.mRawView);
-					break;
-				case E_TOKEN_TYPE::IF:
-					mConditionalBlocksStack.push(_processIfConditional());
-					break;
-				case E_TOKEN_TYPE::IFNDEF:
-					mConditionalBlocksStack.push(_processIfndefConditional());
-					break;
-				case E_TOKEN_TYPE::IFDEF:
-					mConditionalBlocksStack.push(_processIfdefConditional());
-					break;
-				case E_TOKEN_TYPE::ELIF:
-					_processElifConditional(mConditionalBlocksStack.top());
-					break;
-				case E_TOKEN_TYPE::ELSE:
-					_processElseConditional(mConditionalBlocksStack.top());
-					break;
-				case E_TOKEN_TYPE::ENDIF:
-					if (mConditionalBlocksStack.empty())
-					{
-						mOnErrorCallback({ E_ERROR_TYPE::UNBALANCED_ENDIF, mpLexer->GetCurrLineIndex() });
-					}
-					else
+			if (mIsPrefetchingStopped || mPrefetchedIncludes.find(key) != mPrefetchedIncludes.cend())
+			{
+				continue;
+			}
+
+			mPrefetchedIncludes.emplace(key, mpWorkersPool->Submit([this, path, isSystemPathInclusion]() -> TLexedInclude
+			{
+				{
+					std::lock_guard<std::mutex> lock(mPrefetchMutex);
+					if (mIsPrefetchingStopped)
 					{
-						mConditionalBlocksStack.pop();
+						return {};
 					}
-					break;
-				case E_TOKEN_TYPE::INCLUDE:
-					_processInclusion();
-					break;
-				case E_TOKEN_TYPE::IDENTIFIER: // \note try to expand some macro here
-					{
-						auto iter = std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&currToken](auto&& item)
-						{
-							return item.mName == currToken.mRawView;
-						});
+				}
 
-						auto contextIter = std::find_if(mContextStack.cbegin(), mContextStack.cend(), [&currToken](auto&& item)
-						{
-							return item == currToken.mRawView;
-						});
+				TLexedInclude lexedInclude = _lexIncludedFile(path, isSystemPathInclusion);
+				if (lexedInclude.mpTokensBuffer)
+				{
+					_prefetchIncludes(*lexedInclude.mpTokensBuffer); // \note Nested includes are resolved ahead of time too
+				}
 
-						if (iter != mSymTable.cend() && contextIter == mContextStack.cend())
-						{
-							mpLexer->AppendFront(_expandMacroDefinition(*iter, currToken, [this] { return mpLexer->GetNextToken(); }));
-						}
-						else
-						{
-							appendString(currToken.mRawView);
-						}
-					}
-					break;
-				case E_TOKEN_TYPE::REJECT_MACRO:
-					mContextStack.erase(std::remove_if(mContextStack.begin(), mContextStack.end(), [&currToken](auto&& item)
-					{
-						return item == currToken.mRawView;
-					}), mContextStack.end());
-					break;
-				case E_TOKEN_TYPE::CONCAT_OP:
-					while (processedStr.back() == ' ') // \note Remove last character in the processed source if it was a whitespace
-					{
-						processedStr.erase(processedStr.length() - 1);
-					}
+				return lexedInclude;
+			}));
+		}
+	}
 
-					while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+	Preprocessor::TIfStackEntry Preprocessor::_processIfConditional() TCPP_NOEXCEPT
+	{
+		const auto pPrecompiledCondition = mpLexer->GetPrecompiledCondition();
 
-					appendString(currToken.mRawView);
-					break;
-				case E_TOKEN_TYPE::STRINGIZE_OP:
-					{
-						if (mContextStack.empty())
-						{
-							mOnErrorCallback({ E_ERROR_TYPE::INCORRECT_OPERATION_USAGE, mpLexer->GetCurrLineIndex() });
-							continue;
-						}
+		auto currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
 
-						appendString("\"" + (currToken = mpLexer->GetNextToken()).mRawView + "\"");
-					}
-					break;
-				case E_TOKEN_TYPE::CUSTOM_DIRECTIVE:
-					{
-						auto customDirectiveIter = mCustomDirectivesHandlersMap.find(currToken.mRawView);
-						if (customDirectiveIter != mCustomDirectivesHandlersMap.cend())
-						{
-							appendString(customDirectiveIter->second(*this, *mpLexer, processedStr));
-						}
-						else
-						{
-							mOnErrorCallback({ E_ERROR_TYPE::UNDEFINED_DIRECTIVE, mpLexer->GetCurrLineIndex() });
-						}
-					}
-					break;
-				default:
-					if (E_TOKEN_TYPE::COMMENTARY == currToken.mType && mSkipCommentsTokens)
-					{
-						break;
-					}
+		std::vector<TToken> expressionTokens;
 
-					appendString(currToken.mRawView);
-					break;
+		while ((currToken = mpLexer->GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
+		{
+			if (E_TOKEN_TYPE::SPACE == currToken.mType) 
+			{ 
+				continue; 
 			}
 
-			if (!mpLexer->HasNextToken())
-			{
-				mpLexer->PopStream();
-			}
+			expressionTokens.push_back(currToken);
 		}
 
-		return processedStr;
-	}
-	
-	Preprocessor::TSymTable Preprocessor::GetSymbolsTable() const TCPP_NOEXCEPT
-	{
-		return mSymTable;
+		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+
+		const bool isParentBlockActive = IsParentBlockActive(mConditionalBlocksStack);
+		
+		// \note IsDisabledBlockProcessed is used to inherit disabled state for nested blocks
+		return TIfStackEntry(!isParentBlockActive || !_evaluateExpression(expressionTokens, pPrecompiledCondition), isParentBlockActive);
 	}
 
-	void Preprocessor::_createMacroDefinition() TCPP_NOEXCEPT
+
+	Preprocessor::TIfStackEntry Preprocessor::_processIfdefConditional() TCPP_NOEXCEPT
 	{
-		TMacroDesc macroDesc;
-		
 		auto currToken = mpLexer->GetNextToken();
 		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
 
 		currToken = mpLexer->GetNextToken();
 		_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
 
-		macroDesc.mName = currToken.mRawView;
-
-		auto extractValue = [this](TMacroDesc& desc, Lexer& lexer)
-		{
-			TToken currToken;
-
-			while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
-
-			if (currToken.mType != E_TOKEN_TYPE::NEWLINE)
-			{
-				desc.mValue.push_back(currToken);
+		std::string macroIdentifier = currToken.mRawView;
 
-				const bool isStringificationOperator = currToken.mType == E_TOKEN_TYPE::STRINGIZE_OP;
+		currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
 
-				while ((currToken = lexer.GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
-				{
-					if (E_TOKEN_TYPE::IDENTIFIER == currToken.mType && currToken.mRawView == desc.mName)
-					{
-						desc.mValue.emplace_back(TToken{ E_TOKEN_TYPE::BLOB, currToken.mRawView }); // \note Prevent self recursion
-						continue;
-					}
+		bool skip = !mSymTable.Contains(macroIdentifier);
 
-					if (E_TOKEN_TYPE::IDENTIFIER == currToken.mType && isStringificationOperator) // \note Validate argument of the operator
-					{
-						auto&& macroArgs = desc.mArgsNames;
-						
-						if (std::find(macroArgs.cbegin(), macroArgs.cend(), currToken.mRawView) == macroArgs.cend())
-						{
-							mOnErrorCallback({ E_ERROR_TYPE::INCORRECT_STRINGIFY_OPERATOR_USAGE, mpLexer->GetCurrLineIndex() });
-						}
-					}
+		// \note IsParentBlockActive is used to inherit disabled state for nested blocks
+		return TIfStackEntry(skip, IsParentBlockActive(mConditionalBlocksStack));
+	}
 
-					desc.mValue.push_back(currToken);
-				}
-			}
+	Preprocessor::TIfStackEntry Preprocessor::_processIfndefConditional(std::string& macroIdentifier) TCPP_NOEXCEPT
+	{
+		auto currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
 
-			if (desc.mValue.empty())
-			{
-				desc.mValue.push_back({ E_TOKEN_TYPE::NUMBER, "1", mpLexer->GetCurrLineIndex() });
-			}
+		currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
 
-			_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
-		};
+		macroIdentifier = currToken.mRawView;
 
 		currToken = mpLexer->GetNextToken();
-		switch (currToken.mType)
-		{
-			case E_TOKEN_TYPE::SPACE:	// object like macro
-				extractValue(macroDesc, *mpLexer);
-				break;
-			case E_TOKEN_TYPE::NEWLINE:
-			case E_TOKEN_TYPE::END:
-				macroDesc.mValue.push_back({ E_TOKEN_TYPE::NUMBER, "1", mpLexer->GetCurrLineIndex() });
-				break;
-			case E_TOKEN_TYPE::OPEN_BRACKET: // function line macro
-				{
-					// \note parse arguments
-					while (true)
-					{
-						while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
+		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
 
-						switch (currToken.mType)
-						{
-						case E_TOKEN_TYPE::IDENTIFIER:
-							macroDesc.mArgsNames.push_back(currToken.mRawView);
-							break;
-						case E_TOKEN_TYPE::ELLIPSIS:
-							macroDesc.mArgsNames.push_back("__VA_ARGS__");
-							macroDesc.mVariadic = true;
-							break;
-						default:
-							mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
-						}
+		bool skip = mSymTable.Contains(macroIdentifier);
 
-						while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE);
-						if (macroDesc.mVariadic)
-						{
-							_expect(E_TOKEN_TYPE::CLOSE_BRACKET, currToken.mType);
-							break;
-						}
-						if (currToken.mType == E_TOKEN_TYPE::CLOSE_BRACKET)
-						{
-							break;
-						}
+		// \note IsParentBlockActive is used to inherit disabled state for nested blocks
+		return TIfStackEntry(skip, IsParentBlockActive(mConditionalBlocksStack));
+	}
 
-						_expect(E_TOKEN_TYPE::COMMA, currToken.mType);
-					}
-					
-					// \note parse macro's value
-					extractValue(macroDesc, *mpLexer);
-				}
-				break;
-			default:
-				mOnErrorCallback({ E_ERROR_TYPE::INVALID_MACRO_DEFINITION, mpLexer->GetCurrLineIndex() });
-				break;
+	void Preprocessor::_processElseConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT
+	{
+		if (currStackEntry.mHasElseBeenFound)
+		{
+			mOnErrorCallback({ E_ERROR_TYPE::ANOTHER_ELSE_BLOCK_FOUND, mpLexer->GetCurrLineIndex() });
+			return;
 		}
-		
-		if (_shouldTokenBeSkipped())
+
+		currStackEntry.mShouldBeSkipped  = 
+			currStackEntry.mHasIfBlockBeenEntered || 
+			!currStackEntry.mShouldBeSkipped;
+
+		currStackEntry.mHasElseBeenFound = true;
+	}
+
+	void Preprocessor::_processElifConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT
+	{
+		if (currStackEntry.mHasElseBeenFound)
 		{
+			mOnErrorCallback({ E_ERROR_TYPE::ELIF_BLOCK_AFTER_ELSE_FOUND, mpLexer->GetCurrLineIndex() });
 			return;
 		}
 
-		if (std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&macroDesc](auto&& item) { return item.mName == macroDesc.mName; }) != mSymTable.cend())
+		const auto pPrecompiledCondition = mpLexer->GetPrecompiledCondition();
+
+		auto currToken = mpLexer->GetNextToken();
+		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+
+		std::vector<TToken> expressionTokens;
+
+		while ((currToken = mpLexer->GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
 		{
-			mOnErrorCallback({ E_ERROR_TYPE::MACRO_ALREADY_DEFINED, mpLexer->GetCurrLineIndex() });
-			return;
+			expressionTokens.push_back(currToken);
 		}
 
-		mSymTable.push_back(macroDesc);
+		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+
+		/// \note The expression isn't evaluated if some previous branch has been already taken
+		currStackEntry.mShouldBeSkipped =
+			currStackEntry.mHasIfBlockBeenEntered || !currStackEntry.mIsParentBlockActive ||
+			static_cast<bool>(!_evaluateExpression(expressionTokens, pPrecompiledCondition));
+
+		if (!currStackEntry.mShouldBeSkipped) currStackEntry.mHasIfBlockBeenEntered = true;
 	}
 
-	void Preprocessor::_removeMacroDefinition(const std::string& macroName) TCPP_NOEXCEPT
+	void Preprocessor::_trackConditionalRegion(E_TOKEN_TYPE directiveType, size_t line, const std::function<void()>& processDirective) TCPP_NOEXCEPT
 	{
-		if (_shouldTokenBeSkipped())
+		if (!mTrackMacroDependencies)
 		{
+			processDirective();
 			return;
 		}
 
-		auto iter = std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&macroName](auto&& item) { return item.mName == macroName; });
-		if (iter == mSymTable.cend())
+		const bool isBlockOpened = E_TOKEN_TYPE::ELIF != directiveType && E_TOKEN_TYPE::ELSE != directiveType;
+		if (!isBlockOpened && mConditionalBlocksStack.empty())
 		{
-			mOnErrorCallback({ E_ERROR_TYPE::UNDEFINED_MACRO, mpLexer->GetCurrLineIndex() });
+			processDirective();
 			return;
 		}
 
-		mSymTable.erase(iter);
+		std::vector<std::string> dependencies = mConditionalBlocksStack.empty() ? std::vector<std::string>() : mConditionalBlocksStack.top().mDependencies;
 
-		auto currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+		/// \note Reads of the condition are collected separately and merged into the set of the whole processing
+		SymbolsTable::TReadsTable conditionReads;
+		mSymTable.SetReadsSet(&conditionReads);
+
+		processDirective();
+
+		mSymTable.SetReadsSet(&mMacroDependencies);
+
+		for (auto&& currMacroRead : conditionReads)
+		{
+			dependencies.push_back(currMacroRead.second);
+		}
+
+		std::sort(dependencies.begin(), dependencies.end());
+		dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+
+		mMacroDependencies.insert(conditionReads.cbegin(), conditionReads.cend());
+
+		TIfStackEntry& currStackEntry = mConditionalBlocksStack.top();
+		currStackEntry.mDependencies = dependencies;
+
+		TConditionalRegionInfo regionInfo;
+		regionInfo.mFileId = mInclusionsStack.empty() ? "" : mInclusionsStack.back().mFileId;
+		regionInfo.mLine = mInclusionsStack.empty() ? line : (line - mInclusionsStack.back().mFirstLineIndex);
+		regionInfo.mDirectiveType = directiveType;
+		regionInfo.mMacros = std::move(dependencies);
+		regionInfo.mIsActive = !_shouldTokenBeSkipped();
+
+		mConditionalRegions.push_back(std::move(regionInfo));
 	}
 
-	std::vector<TToken> Preprocessor::_expandMacroDefinition(const TMacroDesc& macroDesc, const TToken& idToken, const std::function<TToken()>& getNextTokenCallback) const TCPP_NOEXCEPT
+	static std::string GetExpressionKey(const std::vector<TToken>& exprTokens) TCPP_NOEXCEPT
 	{
-		// \note expand object like macro with simple replacement
-		if (macroDesc.mArgsNames.empty())
+		std::string expressionKey;
+
+		for (const TToken& currToken : exprTokens)
 		{
-			static const std::unordered_map<std::string, std::function<TToken()>> systemMacrosTable
+			if (E_TOKEN_TYPE::SPACE == currToken.mType || E_TOKEN_TYPE::COMMENTARY == currToken.mType)
 			{
-				{ BuiltInDefines[0], [&idToken]() { return TToken {E_TOKEN_TYPE::BLOB, std::to_string(idToken.mLineId)}; }}, // __LINE__
-				{ BuiltInDefines[1], [&idToken]() { return TToken { E_TOKEN_TYPE::BLOB, idToken.mRawView }; } }, // __VA_ARGS__
-			};
+				continue;
+			}
+
+			expressionKey.append(currToken.mRawView);
 
-			if (E_TOKEN_TYPE::CONCAT_OP == mpLexer->PeekNextToken().mType) // If an argument is stringized or concatenated, the prescan does not occur.
+			/// \note Tokens of expanded macros aren't substituted again by the same macros, so their hide sets are a part of the key
+			if (currToken.mHideSetId)
 			{
-				return { TToken { E_TOKEN_TYPE::BLOB, macroDesc.mName } }; // BLOB type is used instead of IDENTIFIER to prevent infinite loop
+				expressionKey.push_back('#');
+				AppendBytes(expressionKey, currToken.mHideSetId);
 			}
 
-			auto iter = systemMacrosTable.find(macroDesc.mName);
-			if (iter != systemMacrosTable.cend())
+			expressionKey.push_back(' ');
+		}
+
+		return expressionKey;
+	}
+
+	intmax_t Preprocessor::_evaluateExpression(const std::vector<TToken>& exprTokens, const std::shared_ptr<const TCompiledExpression>& pPrecompiledExpression) const TCPP_NOEXCEPT
+	{
+		const std::string expressionKey = GetExpressionKey(exprTokens);
+
+		auto cacheIt = mpConditionsCache->find(expressionKey);
+
+		/// \note The result is reused if none of the macros which were read have been changed. Only valid expressions have results
+		const bool isResultValid = cacheIt != mpConditionsCache->cend() && cacheIt->second.mHasResult && 
+			std::all_of(cacheIt->second.mReadMacrosVersions.cbegin(), cacheIt->second.mReadMacrosVersions.cend(), [this](auto&& entry)
 			{
-				return { iter->second() };
-			}
+				return mSymTable.GetVersion(std::get<std::string>(entry)) == std::get<uint64_t>(entry);
+			});
 
-			return macroDesc.mValue;
+		if (isResultValid)
+		{
+			++mConditionsCacheStats.mHitsCount;
+			return cacheIt->second.mResult;
 		}
 
-		mContextStack.push_back(macroDesc.mName);
+		++mConditionsCacheStats.mMissesCount;
 
-		// \note function like macro's case
-		auto currToken = getNextTokenCallback();
+		TEvaluationContext context;
 
-		while (currToken.mType == E_TOKEN_TYPE::SPACE) { currToken = getNextTokenCallback(); } // \note skip space tokens
-		
-		if (E_TOKEN_TYPE::OPEN_BRACKET != currToken.mType)
+		/// \note The precompiled condition is used as is only if there are no macros to substitute
+		const bool isPrecompiledExpressionUsed = pPrecompiledExpression && pPrecompiledExpression->mIsValid && !pPrecompiledExpression->mHasMacroOperands;
+		const intmax_t result = isPrecompiledExpressionUsed ? _executeExpression(*pPrecompiledExpression, context) : _evaluateTokens(exprTokens, context);
+
+		if (context.mHasErrors)
 		{
-			return { TToken { E_TOKEN_TYPE::BLOB, macroDesc.mName }, currToken }; // \note Function like macro without brackets are is not expanded
+			mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
+			return 0;
 		}
 
-		_expect(E_TOKEN_TYPE::OPEN_BRACKET, currToken.mType);
+		TConditionCacheEntry& cacheEntry = mpConditionsCache.Detach()[expressionKey];
 
-		std::vector<std::vector<TToken>> processingTokens;
-		std::vector<TToken> currArgTokens;
+		cacheEntry.mHasResult = context.mIsCacheable;
+		cacheEntry.mResult = result;
+		cacheEntry.mReadMacrosVersions.clear();
 
-		uint8_t currNestingLevel = 0;
+		for (const std::string& currMacroName : context.mReadMacros)
+		{
+			cacheEntry.mReadMacrosVersions.emplace_back(currMacroName, mSymTable.GetVersion(currMacroName));
+		}
 
-		// \note read all arguments values
-		while (true)
+		return result;
+	}
+
+	intmax_t Preprocessor::_evaluateTokens(const std::vector<TToken>& exprTokens, TEvaluationContext& context) const TCPP_NOEXCEPT
+	{
+		const bool isOuterCompilationStale = context.mIsCompilationStale;
+
+		intmax_t result = 0;
+
+		/// \note If a macro has been changed since the compilation so that it should be substituted now, the expression is compiled again
+		for (bool isRecompilationForced : { false, true })
 		{
-			currArgTokens.clear();
+			context.mIsCompilationStale = false;
 
-			bool hasAnySpace = false;
-			while ((currToken = getNextTokenCallback()).mType == E_TOKEN_TYPE::SPACE) // \note skip space tokens
+			const auto pExpression = _compileExpression(exprTokens, context, isRecompilationForced);
+			if (!pExpression->mIsValid)
 			{
-				hasAnySpace = true;
+				context.mHasErrors = true;
+				result = 0;
+				break;
 			}
 
-			if (E_TOKEN_TYPE::CLOSE_BRACKET == currToken.mType || E_TOKEN_TYPE::COMMA == currToken.mType)
+			result = _executeExpression(*pExpression, context);
+
+			if (!context.mIsCompilationStale)
 			{
-				if (hasAnySpace)
-				{
-					currArgTokens.push_back({ E_TOKEN_TYPE::SPACE, " " });
-				}
-				else
-				{
-					break; // \note There should be at least one space for empty argument
-				}
+				break;
 			}
-			else
+		}
+
+		context.mIsCompilationStale = isOuterCompilationStale;
+
+		return result;
+	}
+
+	std::shared_ptr<const TCompiledExpression> Preprocessor::_compileExpression(const std::vector<TToken>& exprTokens, TEvaluationContext& context, bool isRecompilationForced) const TCPP_NOEXCEPT
+	{
+		std::string expressionKey = GetExpressionKey(exprTokens);
+
+		auto cacheIt = mpConditionsCache->find(expressionKey);
+
+		const bool isCompilationValid = !isRecompilationForced && cacheIt != mpConditionsCache->cend() && cacheIt->second.mpExpression &&
+			std::all_of(cacheIt->second.mSubstitutedMacrosVersions.cbegin(), cacheIt->second.mSubstitutedMacrosVersions.cend(), [this](auto&& entry)
 			{
-				currArgTokens.push_back(currToken);
-			}
+				return mSymTable.GetVersion(std::get<std::string>(entry)) == std::get<uint64_t>(entry);
+			});
 
-			if (E_TOKEN_TYPE::CLOSE_BRACKET != currToken.mType)
+		if (isCompilationValid)
+		{
+			for (auto&& currSubstitutedMacro : cacheIt->second.mSubstitutedMacrosVersions)
 			{
-				if (E_TOKEN_TYPE::OPEN_BRACKET == currToken.mType)
-				{
-					++currNestingLevel;
-				}
+				context.mReadMacros.push_back(std::get<std::string>(currSubstitutedMacro));
+			}
 
-				while ((currToken = getNextTokenCallback()).mType == E_TOKEN_TYPE::SPACE);
+			return cacheIt->second.mpExpression;
+		}
 
-				while ((currToken.mType != E_TOKEN_TYPE::COMMA &&
-					currToken.mType != E_TOKEN_TYPE::NEWLINE &&
-					currToken.mType != E_TOKEN_TYPE::CLOSE_BRACKET) || currNestingLevel)
-				{
-					switch (currToken.mType)
-					{
-					case E_TOKEN_TYPE::OPEN_BRACKET:
-						++currNestingLevel;
-						break;
-					case E_TOKEN_TYPE::CLOSE_BRACKET:
-						--currNestingLevel;
-						break;
-					default:
-						break;
-					}
+		TExpansionDependencies dependencies;
 
-					currArgTokens.push_back(currToken);
-					currToken = getNextTokenCallback();
-				}
+		auto pExpression = std::make_shared<const TCompiledExpression>(CompileExpression(exprTokens, [this, &context, &dependencies](std::vector<TToken>& tokens, size_t identifierIndex)
+		{
+			return _substituteMacro(tokens, identifierIndex, context, dependencies);
+		}));
 
-				if (currToken.mType != E_TOKEN_TYPE::COMMA && currToken.mType != E_TOKEN_TYPE::CLOSE_BRACKET)
-				{
-					_expect(E_TOKEN_TYPE::COMMA, currToken.mType);
-				}
-			}
+		context.mIsCacheable = context.mIsCacheable && dependencies.mIsCacheable;
 
-			processingTokens.push_back(currArgTokens);
+		if (dependencies.mIsCacheable)
+		{
+			TConditionCacheEntry& cacheEntry = mpConditionsCache.Detach()[std::move(expressionKey)];
 
-			if (currToken.mType == E_TOKEN_TYPE::CLOSE_BRACKET)
-			{
-				break;
-			}
+			cacheEntry.mpExpression = pExpression;
+			cacheEntry.mSubstitutedMacrosVersions = std::move(dependencies.mReadMacrosVersions);
 		}
 
-		if(macroDesc.mVariadic ?
-			(processingTokens.size() + 1 < macroDesc.mArgsNames.size()) :
-			(processingTokens.size()    != macroDesc.mArgsNames.size()))
+		return pExpression;
+	}
+
+	bool Preprocessor::_substituteMacro(std::vector<TToken>& exprTokens, size_t identifierIndex, TEvaluationContext& context, TExpansionDependencies& dependencies) const TCPP_NOEXCEPT
+	{
+		const TToken identifierToken = exprTokens[identifierIndex];
+		const std::string& macroName = identifierToken.mRawView;
+
+		/// \note Built-in macros are evaluated as operands, because their values depend on the position
+		if (std::find(BuiltInDefines.cbegin(), BuiltInDefines.cend(), macroName) != BuiltInDefines.cend())
 		{
-			mOnErrorCallback({ E_ERROR_TYPE::INCONSISTENT_MACRO_ARITY, mpLexer->GetCurrLineIndex() });
+			return false;
 		}
 
-		// \note execute macro's expansion
-		std::vector<TToken> replacementList{ macroDesc.mValue.cbegin(), macroDesc.mValue.cend() };
-		const auto& argsList = macroDesc.mArgsNames;
+		context.mReadMacros.push_back(macroName);
 
-		std::string replacementValue;
+		const TMacroDesc* pMacroDesc = mSymTable.Find(macroName);
+
+		if (!pMacroDesc || mHideSets.Contains(identifierToken.mHideSetId, mHideSets.GetMacroId(macroName)))
+		{
+			return false;
+		}
 
-		for (size_t currArgIndex = 0; currArgIndex < processingTokens.size(); ++currArgIndex)
+		/// \note A macro which is defined without a value is 1, but it's considered as empty if it's followed by an operand
+		if (pMacroDesc->mHasImplicitValue)
 		{
-			const bool variadics = macroDesc.mVariadic && currArgIndex == macroDesc.mArgsNames.size() - 1;
-			const std::string& currArgName = variadics ? argsList.back() : argsList[currArgIndex];
+			auto nextTokenIt = std::find_if(exprTokens.cbegin() + identifierIndex + 1, exprTokens.cend(), [](const TToken& token)
+			{
+				return E_TOKEN_TYPE::SPACE != token.mType && E_TOKEN_TYPE::COMMENTARY != token.mType && E_TOKEN_TYPE::NEWLINE != token.mType;
+			});
 
-			replacementValue.clear();
-			
-			for (auto&& currArgToken : processingTokens[currArgIndex])
+			if (nextTokenIt == exprTokens.cend())
 			{
-				replacementValue.append(currArgToken.mRawView);
+				return false;
 			}
 
-			if (variadics)
+			switch (nextTokenIt->mType)
 			{
-				for (size_t i = currArgIndex + 1; i < processingTokens.size(); ++i)
-				{
-					replacementValue.append(",");
-					for (auto&& currArgToken : processingTokens[i])
-					{
-						replacementValue.append(currArgToken.mRawView);
-					}
-				}
+				case E_TOKEN_TYPE::NUMBER:
+				case E_TOKEN_TYPE::CHAR_LITERAL:
+				case E_TOKEN_TYPE::IDENTIFIER:
+				case E_TOKEN_TYPE::KEYWORD:
+				case E_TOKEN_TYPE::OPEN_BRACKET:
+				case E_TOKEN_TYPE::NOT:
+				case E_TOKEN_TYPE::TILDE:
+					break;
+				default:
+					return false;
 			}
 
-			for (auto& currToken : replacementList)
+			dependencies.mReadMacrosVersions.emplace_back(macroName, mSymTable.GetVersion(macroName));
+			exprTokens.erase(exprTokens.cbegin() + identifierIndex);
+
+			return true;
+		}
+
+		if (pMacroDesc->mArgsNames.empty() && IsPrimaryExpression(pMacroDesc->mValue))
+		{
+			return false;
+		}
+
+		size_t lastTokenIndex = identifierIndex + 1;
+
+		if (!pMacroDesc->mArgsNames.empty())
+		{
+			while (lastTokenIndex < exprTokens.size() && E_TOKEN_TYPE::SPACE == exprTokens[lastTokenIndex].mType)
 			{
-				if ((currToken.mType != E_TOKEN_TYPE::IDENTIFIER) || (currToken.mRawView != currArgName))
-				{
-					continue;
-				}
+				++lastTokenIndex;
+			}
 
-				currToken.mRawView = replacementValue;
+			/// \note A function-like macro without brackets is an operand, an invocation is replaced together with its arguments
+			if (lastTokenIndex >= exprTokens.size() || E_TOKEN_TYPE::OPEN_BRACKET != exprTokens[lastTokenIndex].mType)
+			{
+				return false;
 			}
 
-			if (variadics)
+			uint32_t nestingLevel = 0;
+
+			do
 			{
-				break;
+				switch (exprTokens[lastTokenIndex++].mType)
+				{
+					case E_TOKEN_TYPE::OPEN_BRACKET:
+						++nestingLevel;
+						break;
+					case E_TOKEN_TYPE::CLOSE_BRACKET:
+						--nestingLevel;
+						break;
+					default:
+						break;
+				}
+			} 
+			while (nestingLevel && lastTokenIndex < exprTokens.size());
+
+			if (nestingLevel)
+			{
+				return false;
 			}
 		}
 
-		replacementList.push_back({ E_TOKEN_TYPE::REJECT_MACRO, macroDesc.mName });
-		return replacementList;
-	}
+		size_t currTokenIndex = identifierIndex + 1;
 
-	/*std::vector<TToken> Preprocessor::_expandMacroArg(const TMacroDesc& macroDesc, const TToken& idToken, const std::function<TToken()>& getNextTokenCallback) const TCPP_NOEXCEPT
-	{
-	}*/
+		TExpansionDependencies expansionDependencies;
 
-	void Preprocessor::_expect(const E_TOKEN_TYPE& expectedType, const E_TOKEN_TYPE& actualType) const TCPP_NOEXCEPT
-	{
-		if (expectedType == actualType)
+		const auto pExpandedTokens = _expandMacroDefinition(*pMacroDesc, identifierToken, [&exprTokens, &currTokenIndex, lastTokenIndex]
 		{
-			return;
+			return (currTokenIndex < lastTokenIndex) ? exprTokens[currTokenIndex++] : TToken { E_TOKEN_TYPE::END };
+		}, &expansionDependencies);
+
+		/// \note Macros which were read by arguments' pre-expansion affect the compiled expression too
+		dependencies.mReadMacrosVersions.emplace_back(macroName, mSymTable.GetVersion(macroName));
+
+		for (auto&& currReadMacro : expansionDependencies.mReadMacrosVersions)
+		{
+			dependencies.mReadMacrosVersions.push_back(currReadMacro);
+			context.mReadMacros.push_back(std::get<std::string>(currReadMacro));
 		}
 
-		mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
+		dependencies.mIsCacheable = dependencies.mIsCacheable && expansionDependencies.mIsCacheable;
+
+		exprTokens.erase(exprTokens.cbegin() + identifierIndex, exprTokens.cbegin() + lastTokenIndex);
+		exprTokens.insert(exprTokens.cbegin() + identifierIndex, pExpandedTokens->cbegin(), pExpandedTokens->cend());
+
+		return true;
 	}
 
-	void Preprocessor::_processInclusion() TCPP_NOEXCEPT
+	intmax_t Preprocessor::_executeExpression(const TCompiledExpression& expression, TEvaluationContext& context) const TCPP_NOEXCEPT
 	{
-		if (_shouldTokenBeSkipped())
+		if (!expression.mIsValid)
 		{
-			return;
+			return 0;
 		}
 
-		TToken currToken;
+		// \note Arithmetic is done with unsigned types to get wrapping instead of undefined behaviour on overflows
+		auto toSigned = [](uintmax_t value) { return static_cast<intmax_t>(value); };
 
-		while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE); // \note skip space tokens
-		
-		if (currToken.mType != E_TOKEN_TYPE::LESS && currToken.mType != E_TOKEN_TYPE::QUOTES)
+		std::vector<intmax_t> stack;
+		stack.reserve(8);
+
+		const std::vector<TExpressionInstruction>& instructions = expression.mInstructions;
+
+		for (size_t i = 0; i < instructions.size(); ++i)
 		{
-			while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::NEWLINE); // \note skip to end of current line
+			const TExpressionInstruction& currInstruction = instructions[i];
 
-			mOnErrorCallback({ E_ERROR_TYPE::INVALID_INCLUDE_DIRECTIVE, mpLexer->GetCurrLineIndex() });
-			return;
-		}
+			if (currInstruction.mOpCode >= E_EXPRESSION_OPCODE::MUL && currInstruction.mOpCode <= E_EXPRESSION_OPCODE::BIT_OR)
+			{
+				const intmax_t right = stack.back();
+				stack.pop_back();
 
-		bool isSystemPathInclusion = currToken.mType == E_TOKEN_TYPE::LESS;
-		
-		std::string path;
+				intmax_t& left = stack.back();
+
+				const uintmax_t leftBits = static_cast<uintmax_t>(left);
+				const uintmax_t rightBits = static_cast<uintmax_t>(right);
+
+				switch (currInstruction.mOpCode)
+				{
+					case E_EXPRESSION_OPCODE::MUL:
+						left = toSigned(leftBits * rightBits);
+						break;
+					case E_EXPRESSION_OPCODE::DIV: // \note division by zero is considered as false in the implementation
+						left = !right ? 0 : ((right == -1) ? toSigned(0 - leftBits) : left / right);
+						break;
+					case E_EXPRESSION_OPCODE::MOD:
+						left = (!right || right == -1) ? 0 : left % right;
+						break;
+					case E_EXPRESSION_OPCODE::ADD:
+						left = toSigned(leftBits + rightBits);
+						break;
+					case E_EXPRESSION_OPCODE::SUB:
+						left = toSigned(leftBits - rightBits);
+						break;
+					case E_EXPRESSION_OPCODE::LSHIFT:
+						left = (right < 0 || right >= static_cast<intmax_t>(sizeof(intmax_t) * 8)) ? 0 : toSigned(leftBits << right);
+						break;
+					case E_EXPRESSION_OPCODE::RSHIFT:
+						left = (right < 0) ? 0 : ((right >= static_cast<intmax_t>(sizeof(intmax_t) * 8)) ? (left < 0 ? -1 : 0) : (left >> right));
+						break;
+					case E_EXPRESSION_OPCODE::LESS:
+						left = left < right;
+						break;
+					case E_EXPRESSION_OPCODE::GREATER:
+						left = left > right;
+						break;
+					case E_EXPRESSION_OPCODE::LE:
+						left = left <= right;
+						break;
+					case E_EXPRESSION_OPCODE::GE:
+						left = left >= right;
+						break;
+					case E_EXPRESSION_OPCODE::EQ:
+						left = left == right;
+						break;
+					case E_EXPRESSION_OPCODE::NE:
+						left = left != right;
+						break;
+					case E_EXPRESSION_OPCODE::BIT_AND:
+						left = toSigned(leftBits & rightBits);
+						break;
+					case E_EXPRESSION_OPCODE::BIT_XOR:
+						left = toSigned(leftBits ^ rightBits);
+						break;
+					case E_EXPRESSION_OPCODE::BIT_OR:
+						left = toSigned(leftBits | rightBits);
+						break;
+					default:
+						break;
+				}
+
+				continue;
+			}
+
+			switch (currInstruction.mOpCode)
+			{
+				case E_EXPRESSION_OPCODE::PUSH_VALUE:
+					stack.push_back(currInstruction.mOperand);
+					break;
+				case E_EXPRESSION_OPCODE::PUSH_IDENTIFIER:
+					stack.push_back(_evaluateIdentifier(expression.mIdentifiers[currInstruction.mOperand], context));
+					break;
+				case E_EXPRESSION_OPCODE::PUSH_DEFINED:
+					context.mReadMacros.push_back(expression.mIdentifiers[currInstruction.mOperand].mRawView);
+					stack.push_back(mSymTable.Contains(expression.mIdentifiers[currInstruction.mOperand].mRawView));
+					break;
+				case E_EXPRESSION_OPCODE::PUSH_MACRO_CALL:
+					stack.push_back(_evaluateMacroCall(expression.mMacroCalls[currInstruction.mOperand], context));
+					break;
+				case E_EXPRESSION_OPCODE::PUSH_SUBEXPRESSION:
+					stack.push_back(_evaluateTokens(expression.mSubExpressions[currInstruction.mOperand], context));
+					break;
+				case E_EXPRESSION_OPCODE::NEGATE:
+					stack.back() = toSigned(0 - static_cast<uintmax_t>(stack.back()));
+					break;
+				case E_EXPRESSION_OPCODE::NOT:
+					stack.back() = !stack.back();
+					break;
+				case E_EXPRESSION_OPCODE::BIT_NOT:
+					stack.back() = ~stack.back();
+					break;
+				case E_EXPRESSION_OPCODE::TO_BOOL:
+					stack.back() = (stack.back() != 0);
+					break;
+				case E_EXPRESSION_OPCODE::AND_JUMP:
+					if (!stack.back())
+					{
+						i = static_cast<size_t>(currInstruction.mOperand) - 1;
+						break;
+					}
 
-		while (true)
-		{
-			if ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::QUOTES ||
-				currToken.mType == E_TOKEN_TYPE::GREATER)
-			{
-				break;
-			}
+					stack.pop_back();
+					break;
+				case E_EXPRESSION_OPCODE::OR_JUMP:
+					if (stack.back())
+					{
+						stack.back() = 1;
+						i = static_cast<size_t>(currInstruction.mOperand) - 1;
+						break;
+					}
 
-			if (currToken.mType == E_TOKEN_TYPE::NEWLINE)
-			{
-				mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_END_OF_INCLUDE_PATH, mpLexer->GetCurrLineIndex() });
-				break;
-			}
+					stack.pop_back();
+					break;
+				case E_EXPRESSION_OPCODE::JUMP_IF_ZERO:
+					{
+						const intmax_t condition = stack.back();
+						stack.pop_back();
 
-			path.append(currToken.mRawView);
+						if (!condition)
+						{
+							i = static_cast<size_t>(currInstruction.mOperand) - 1;
+						}
+					}
+					break;
+				case E_EXPRESSION_OPCODE::JUMP:
+					i = static_cast<size_t>(currInstruction.mOperand) - 1;
+					break;
+				default:
+					break;
+			}
 		}
 
-		while ((currToken = mpLexer->GetNextToken()).mType == E_TOKEN_TYPE::SPACE);
-		
-		if (E_TOKEN_TYPE::NEWLINE != currToken.mType && E_TOKEN_TYPE::END != currToken.mType)
-		{
-			mOnErrorCallback({ E_ERROR_TYPE::UNEXPECTED_TOKEN, mpLexer->GetCurrLineIndex() });
-		}
+		return stack.empty() ? 0 : stack.back();
+	}
+
+	intmax_t Preprocessor::_evaluateIdentifier(const TToken& identifierToken, TEvaluationContext& context) const TCPP_NOEXCEPT
+	{
+		const std::string& identifier = identifierToken.mRawView;
 
-		if (mOnIncludeCallback)
+		if (identifier == BuiltInDefines[0]) // __LINE__
 		{
-			mpLexer->PushStream(std::move(mOnIncludeCallback(path, isSystemPathInclusion)));
+			context.mIsCacheable = false;
+			return static_cast<intmax_t>(mpLexer->GetCurrLineIndex());
 		}
-	}
 
-	Preprocessor::TIfStackEntry Preprocessor::_processIfConditional() TCPP_NOEXCEPT
-	{
-		auto currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+		context.mReadMacros.push_back(identifier);
 
-		std::vector<TToken> expressionTokens;
+		const TMacroDesc* pMacroDesc = mSymTable.Find(identifier);
 
-		while ((currToken = mpLexer->GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
+		if (!pMacroDesc || !pMacroDesc->mArgsNames.empty() || identifier == BuiltInDefines[1] ||
+			mHideSets.Contains(identifierToken.mHideSetId, mHideSets.GetMacroId(identifier)))
 		{
-			if (E_TOKEN_TYPE::SPACE == currToken.mType) 
-			{ 
-				continue; 
-			}
+			/// \note Substituted arguments of macros are identifiers which contain numbers, other identifiers are replaced with 0
+			return ParseIntegerLiteral(identifier);
+		}
 
-			expressionTokens.push_back(currToken);
+		/// \note The macro has been redefined after the compilation, so it should be substituted into the expression now
+		if (!IsPrimaryExpression(pMacroDesc->mValue))
+		{
+			context.mIsCompilationStale = true;
+			return 0;
 		}
 
-		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
-		
-		// \note IsDisabledBlockProcessed is used to inherit disabled state for nested blocks
-		return TIfStackEntry(static_cast<bool>(!_evaluateExpression(expressionTokens)), IsParentBlockActive(mConditionalBlocksStack));
+		/// \note The value is compiled once per version of the macro, its tokens aren't substituted by the macro again
+		return _evaluateTokens(*_expandMacroDefinition(*pMacroDesc, identifierToken, [] { return TToken { E_TOKEN_TYPE::END }; }), context);
 	}
 
-
-	Preprocessor::TIfStackEntry Preprocessor::_processIfdefConditional() TCPP_NOEXCEPT
+	intmax_t Preprocessor::_evaluateMacroCall(const std::vector<TToken>& invocationTokens, TEvaluationContext& context) const TCPP_NOEXCEPT
 	{
-		auto currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
-
-		currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
+		const TToken& identifierToken = invocationTokens.front();
 
-		std::string macroIdentifier = currToken.mRawView;
+		context.mReadMacros.push_back(identifierToken.mRawView);
 
-		currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+		const TMacroDesc* pMacroDesc = mSymTable.Find(identifierToken.mRawView);
 
-		bool skip = std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&macroIdentifier](auto&& item)
-			{
-				return item.mName == macroIdentifier;
-			}) == mSymTable.cend();
+		if (!pMacroDesc || mHideSets.Contains(identifierToken.mHideSetId, mHideSets.GetMacroId(identifierToken.mRawView)) ||
+			std::find(BuiltInDefines.cbegin(), BuiltInDefines.cend(), identifierToken.mRawView) != BuiltInDefines.cend() ||
+			(pMacroDesc->mArgsNames.empty() && IsPrimaryExpression(pMacroDesc->mValue)))
+		{
+			return 0;
+		}
 
-		// \note IsParentBlockActive is used to inherit disabled state for nested blocks
-		return TIfStackEntry(skip, IsParentBlockActive(mConditionalBlocksStack));
+		/// \note The macro has been defined after the compilation, so the invocation should be substituted into the expression now
+		context.mIsCompilationStale = true;
+		return 0;
 	}
 
-	Preprocessor::TIfStackEntry Preprocessor::_processIfndefConditional() TCPP_NOEXCEPT
+	bool Preprocessor::_shouldTokenBeSkipped() const TCPP_NOEXCEPT
 	{
-		auto currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
-
-		currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::IDENTIFIER, currToken.mType);
-
-		std::string macroIdentifier = currToken.mRawView;
-
-		currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
-
-		bool skip = std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&macroIdentifier](auto&& item)
-			{
-				return item.mName == macroIdentifier;
-			}) != mSymTable.cend();
-
-		// \note IsParentBlockActive is used to inherit disabled state for nested blocks
-		return TIfStackEntry(skip, IsParentBlockActive(mConditionalBlocksStack));
+		return !mConditionalBlocksStack.empty() && (mConditionalBlocksStack.top().mShouldBeSkipped || !mConditionalBlocksStack.top().mIsParentBlockActive);
 	}
 
-	void Preprocessor::_processElseConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT
+	void Preprocessor::_skipInactiveBlock() TCPP_NOEXCEPT
 	{
-		if (currStackEntry.mHasElseBeenFound)
+		if (!_shouldTokenBeSkipped())
 		{
-			mOnErrorCallback({ E_ERROR_TYPE::ANOTHER_ELSE_BLOCK_FOUND, mpLexer->GetCurrLineIndex() });
 			return;
 		}
 
-		currStackEntry.mShouldBeSkipped  = 
-			currStackEntry.mHasIfBlockBeenEntered || 
-			!currStackEntry.mShouldBeSkipped;
+		/// \note If there are pending tokens the block is processed token by token and its output is thrown away
+		mpLexer->SkipInactiveBlock();
+	}
 
-		currStackEntry.mHasElseBeenFound = true;
+	constexpr size_t PermutationsProcessor::AnyFeatureValue;
+
+	PermutationsProcessor::PermutationsProcessor(const TPermutationsConfigInfo& config) TCPP_NOEXCEPT:
+		mConfig(config), mpWorkersPool(std::make_unique<WorkersPool>(config.mWorkersCount))
+	{
 	}
 
-	void Preprocessor::_processElifConditional(TIfStackEntry& currStackEntry) TCPP_NOEXCEPT
+	std::vector<PermutationsProcessor::TPermutationResult> PermutationsProcessor::Process(const std::string& source, const std::vector<TDefinesSet>& definesSets) TCPP_NOEXCEPT
 	{
-		if (currStackEntry.mHasElseBeenFound)
-		{
-			mOnErrorCallback({ E_ERROR_TYPE::ELIF_BLOCK_AFTER_ELSE_FOUND, mpLexer->GetCurrLineIndex() });
-			return;
-		}
+		Lexer lexer(std::make_unique<StringInputStream>(""));
 
-		auto currToken = mpLexer->GetNextToken();
-		_expect(E_TOKEN_TYPE::SPACE, currToken.mType);
+		TBatchContext context;
+		_initBatchContext(context, source, lexer);
 
-		std::vector<TToken> expressionTokens;
+		return _processBatch(context, definesSets, mConfig.mTrackMacroDependencies);
+	}
 
-		while ((currToken = mpLexer->GetNextToken()).mType != E_TOKEN_TYPE::NEWLINE)
-		{
-			expressionTokens.push_back(currToken);
-		}
+	PermutationsProcessor::TExplorationResult PermutationsProcessor::Explore(const std::string& source, const std::vector<TFeatureMacro>& features) TCPP_NOEXCEPT
+	{
+		TExplorationResult result;
 
-		_expect(E_TOKEN_TYPE::NEWLINE, currToken.mType);
+		Lexer lexer(std::make_unique<StringInputStream>(""));
 
-		currStackEntry.mShouldBeSkipped =
-			currStackEntry.mHasIfBlockBeenEntered || 
-			static_cast<bool>(!_evaluateExpression(expressionTokens));
+		TBatchContext context;
+		_initBatchContext(context, source, lexer);
 
-		if (!currStackEntry.mShouldBeSkipped) currStackEntry.mHasIfBlockBeenEntered = true;
-	}
+		std::unordered_map<std::string, size_t> outputsTable;
 
-	int Preprocessor::_evaluateExpression(const std::vector<TToken>& exprTokens) const TCPP_NOEXCEPT
-	{
-		std::vector<TToken> tokens{ exprTokens.begin(), exprTokens.end() };
-		tokens.push_back({ E_TOKEN_TYPE::END });
+		/// \note Every combination of the frontier has fixed features and the rest which are processed with their first values
+		std::vector<std::vector<size_t>> frontier { std::vector<size_t>(features.size(), AnyFeatureValue) };
 
-		auto evalPrimary = [this, &tokens]()
+		while (!frontier.empty())
 		{
-			while (E_TOKEN_TYPE::SPACE == tokens.front().mType) /// \note Skip whitespaces
+			std::vector<TDefinesSet> definesSets;
+
+			for (const std::vector<size_t>& currCombination : frontier)
 			{
-				tokens.erase(tokens.cbegin());
-			}
+				TDefinesSet defines;
 
-			auto currToken = tokens.front();
+				for (size_t i = 0; i < features.size(); ++i)
+				{
+					const std::vector<std::string>& values = features[i].mValues;
+					const size_t valueIndex = (AnyFeatureValue == currCombination[i]) ? 0 : currCombination[i];
 
-			switch (currToken.mType)
-			{
-				case E_TOKEN_TYPE::IDENTIFIER:
+					if (valueIndex < values.size() && !values[valueIndex].empty())
 					{
-						// \note macro call
-						TToken identifierToken;
-						if (currToken.mRawView == "defined")
-						{
-							// defined ( X )
-							do {
-								tokens.erase(tokens.cbegin());
-							} while (tokens.front().mType == E_TOKEN_TYPE::SPACE);
-
-							_expect(E_TOKEN_TYPE::OPEN_BRACKET, tokens.front().mType);
+						defines.emplace_back(features[i].mName, values[valueIndex]);
+					}
+				}
 
-							do {
-								tokens.erase(tokens.cbegin());
-							} while (tokens.front().mType == E_TOKEN_TYPE::SPACE);
+				definesSets.push_back(std::move(defines));
+			}
 
-							_expect(E_TOKEN_TYPE::IDENTIFIER, tokens.front().mType);
+			auto results = _processBatch(context, definesSets, true);
+			result.mPassesCount += results.size();
 
-							identifierToken = tokens.front();
+			std::vector<std::vector<size_t>> nextFrontier;
 
-							do {
-								tokens.erase(tokens.cbegin());
-							} while (tokens.front().mType == E_TOKEN_TYPE::SPACE);
+			for (size_t i = 0; i < frontier.size(); ++i)
+			{
+				const std::vector<std::string>& dependencies = results[i].mMacroDependencies;
 
-							_expect(E_TOKEN_TYPE::CLOSE_BRACKET, tokens.front().mType);
+				TCombinationsGroup group;
+				group.mValuesIndices = frontier[i];
+				group.mErrors = std::move(results[i].mErrors);
 
-							// \note simple identifier
-							return static_cast<int>(std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&identifierToken](auto&& item)
-							{
-								return item.mName == identifierToken.mRawView;
-							}) != mSymTable.cend());
-						}
-						else 
-						{
-							tokens.erase(tokens.cbegin());
-							identifierToken = currToken;
-						}
-						
-						/// \note Try to expand macro's value
-						auto it = std::find_if(mSymTable.cbegin(), mSymTable.cend(), [&identifierToken](auto&& item)
-						{
-							return item.mName == identifierToken.mRawView;
-						});
+				auto outputIt = outputsTable.find(results[i].mOutput);
+				if (outputIt == outputsTable.cend())
+				{
+					outputIt = outputsTable.emplace(results[i].mOutput, result.mOutputs.size()).first;
+					result.mOutputs.push_back(std::move(results[i].mOutput));
+				}
 
-						if (it == mSymTable.cend())
-						{
-							/// \note Lexer for now doesn't support numbers recognition so numbers are recognized as identifiers too
-							return atoi(identifierToken.mRawView.c_str());
-						}
-						else
-						{
-							if (it->mArgsNames.empty())
-							{
-								return _evaluateExpression(it->mValue); /// simple macro replacement
-							}
+				group.mOutputIndex = outputIt->second;
 
-							/// \note Macro function call so we should firstly expand that one
-							auto currTokenIt = tokens.cbegin();
-							return _evaluateExpression(_expandMacroDefinition(*it, identifierToken, [&currTokenIt] { return *currTokenIt++; }));
-						}
+				/// \note Consulted features which haven't been fixed yet are forked, the group keeps their first values
+				std::vector<size_t> forkedCombination = frontier[i];
 
-						return 0; /// \note Something went wrong so return 0
+				for (size_t j = 0; j < features.size(); ++j)
+				{
+					if (AnyFeatureValue != frontier[i][j] || !std::binary_search(dependencies.cbegin(), dependencies.cend(), features[j].mName))
+					{
+						continue;
 					}
 
-				case E_TOKEN_TYPE::NUMBER:
-					tokens.erase(tokens.cbegin());
-					return std::stoi(currToken.mRawView);
+					for (size_t k = 1; k < features[j].mValues.size(); ++k)
+					{
+						forkedCombination[j] = k;
+						nextFrontier.push_back(forkedCombination);
+					}
 
-				case E_TOKEN_TYPE::OPEN_BRACKET:
-					tokens.erase(tokens.cbegin());
-					return _evaluateExpression(tokens);
+					forkedCombination[j] = 0;
+					group.mValuesIndices[j] = 0;
+				}
 
-				default:
-					break;
+				result.mGroups.push_back(std::move(group));
 			}
-			
-			return 0;
-		};
 
-		auto evalUnary = [&tokens, &evalPrimary]()
+			frontier = std::move(nextFrontier);
+		}
+
+		return result;
+	}
+
+	size_t PermutationsProcessor::FindOutputIndex(const TExplorationResult& result, const std::vector<size_t>& valuesIndices) TCPP_NOEXCEPT
+	{
+		for (const TCombinationsGroup& currGroup : result.mGroups)
 		{
-			while (E_TOKEN_TYPE::SPACE == tokens.front().mType) /// \note Skip whitespaces
+			bool isMatched = currGroup.mValuesIndices.size() == valuesIndices.size();
+
+			for (size_t i = 0; isMatched && i < valuesIndices.size(); ++i)
 			{
-				tokens.erase(tokens.cbegin());
+				isMatched = (AnyFeatureValue == currGroup.mValuesIndices[i]) || (currGroup.mValuesIndices[i] == valuesIndices[i]);
 			}
 
-			bool resultApply = false;
-			TToken currToken;
-			while ((currToken = tokens.front()).mType == E_TOKEN_TYPE::NOT || currToken.mType == E_TOKEN_TYPE::MINUS)
+			if (isMatched)
 			{
-				switch (currToken.mType)
-				{
-				case E_TOKEN_TYPE::MINUS:
-					// TODO fix this
-					break;
-				case E_TOKEN_TYPE::NOT:
-					tokens.erase(tokens.cbegin());
-					resultApply = !resultApply;
-					break;
-				default:
-					break;
-				}
+				return currGroup.mOutputIndex;
 			}
+		}
 
-			// even number of NOTs: false ^ false = false, false ^ true = true
-			// odd number of NOTs: true ^ false = true (!false), true ^ true = false (!true)
-			return static_cast<int>(resultApply) ^ evalPrimary();
-		};
+		return AnyFeatureValue;
+	}
 
-		auto evalMultiplication = [&tokens, &evalUnary]()
+	void PermutationsProcessor::_initBatchContext(TBatchContext& context, const std::string& source, const Lexer& lexer) const TCPP_NOEXCEPT
+	{
+		context.mpSourceTokens = mConfig.mpTokensCache ? 
+			mConfig.mpTokensCache->GetTokens(source, lexer) : 
+			lexer.Tokenize(std::make_unique<StringInputStream>(source));
+
+		context.mOnIncludeCallback = [this, &lexer, &context](const std::string& path, bool isSystemPathInclusion) -> TInputStreamUniquePtr
 		{
-			int result = evalUnary();
-			int secondOperand = 0;
+			const std::string key = GetIncludeKey(path, isSystemPathInclusion);
 
-			TToken currToken;
-			while ((currToken = tokens.front()).mType == E_TOKEN_TYPE::STAR || currToken.mType == E_TOKEN_TYPE::SLASH)
 			{
-				switch (currToken.mType)
+				std::lock_guard<std::mutex> lock(context.mIncludedFilesMutex);
+
+				auto it = context.mIncludedFiles.find(key);
+				if (it != context.mIncludedFiles.cend())
 				{
-					case E_TOKEN_TYPE::STAR:
-						tokens.erase(tokens.cbegin());
-						result = result * evalUnary();
-						break;
-					case E_TOKEN_TYPE::SLASH:
-						tokens.erase(tokens.cbegin());
-						
-						secondOperand = evalUnary();
-						result = secondOperand ? (result / secondOperand) : 0 /* division by zero is considered as false in the implementation */;
-						break;
-					default:
-						break;
+					return it->second ? std::make_unique<TokensInputStream>(it->second) : nullptr;
 				}
 			}
 
-			return result;
-		};
-
-		auto evalAddition = [&tokens, &evalMultiplication]()
-		{
-			int result = evalMultiplication();
+			TTokensBufferSharedPtr pTokensBuffer = nullptr;
 
-			TToken currToken;
-			while ((currToken = tokens.front()).mType == E_TOKEN_TYPE::PLUS || currToken.mType == E_TOKEN_TYPE::MINUS)
+			if (mConfig.mOnIncludeCallback)
 			{
-				switch (currToken.mType)
+				if (TInputStreamUniquePtr pStream = mConfig.mOnIncludeCallback(path, isSystemPathInclusion))
 				{
-					case E_TOKEN_TYPE::PLUS:
-						tokens.erase(tokens.cbegin());
-						result = result + evalMultiplication();
-						break;
-					case E_TOKEN_TYPE::MINUS:
-						tokens.erase(tokens.cbegin());
-						result = result - evalMultiplication();
-						break;
-					default:
-						break;
+					pTokensBuffer = (mConfig.mpTokensCache && !pStream->GetTokensBuffer()) ? 
+						mConfig.mpTokensCache->GetTokens(ReadAllLines(*pStream), lexer) : 
+						lexer.Tokenize(std::move(pStream));
 				}
 			}
 
-			return result;
+			std::lock_guard<std::mutex> lock(context.mIncludedFilesMutex);
+
+			/// \note If the file has been loaded by another worker meanwhile its buffer is used, so all permutations see the same tokens
+			pTokensBuffer = context.mIncludedFiles.emplace(key, pTokensBuffer).first->second;
+
+			return pTokensBuffer ? std::make_unique<TokensInputStream>(pTokensBuffer) : nullptr;
 		};
+	}
 
-		auto evalComparison = [&tokens, &evalAddition]()
-		{
-			int result = evalAddition();
+	std::vector<PermutationsProcessor::TPermutationResult> PermutationsProcessor::_processBatch(const TBatchContext& context, const std::vector<TDefinesSet>& definesSets, 
+																								 bool trackMacroDependencies) TCPP_NOEXCEPT
+	{
+		std::vector<TPermutationResult> results(definesSets.size());
+		std::vector<std::shared_future<void>> tasks;
 
-			TToken currToken;
-			while ((currToken = tokens.front()).mType == E_TOKEN_TYPE::LESS || 
-					currToken.mType == E_TOKEN_TYPE::GREATER || 
-					currToken.mType == E_TOKEN_TYPE::LE || 
-					currToken.mType == E_TOKEN_TYPE::GE)
+		for (size_t i = 0; i < definesSets.size(); ++i)
+		{
+			tasks.push_back(mpWorkersPool->Submit([this, i, &results, &context, &definesSets, trackMacroDependencies]
 			{
-				switch (currToken.mType)
-				{
-					case E_TOKEN_TYPE::LESS:
-						tokens.erase(tokens.cbegin());
-						result = result < evalAddition();
-						break;
-					case E_TOKEN_TYPE::GREATER:
-						tokens.erase(tokens.cbegin());
-						result = result > evalAddition();
-						break;
-					case E_TOKEN_TYPE::LE:
-						tokens.erase(tokens.cbegin());
-						result = result <= evalAddition();
-						break;
-					case E_TOKEN_TYPE::GE:
-						tokens.erase(tokens.cbegin());
-						result = result >= evalAddition();
-						break;
-					default:
-						break;
-				}
-			}
+				results[i] = _processPermutation(context, definesSets[i], trackMacroDependencies);
+			}));
+		}
 
-			return result;
-		};
+		for (auto&& currTask : tasks)
+		{
+			currTask.wait();
+		}
+
+		return results;
+	}
+
+	PermutationsProcessor::TPermutationResult PermutationsProcessor::_processPermutation(const TBatchContext& context, const TDefinesSet& defines, bool trackMacroDependencies) const TCPP_NOEXCEPT
+	{
+		TPermutationResult result;
 
-		auto evalEquality = [&tokens, &evalComparison]()
+		Lexer lexer(std::make_unique<TokensInputStream>(context.mpSourceTokens));
+
+		Preprocessor::TPreprocessorConfigInfo preprocessorConfig;
+		preprocessorConfig.mOnErrorCallback = [&result](const TErrorInfo& errorInfo) { result.mErrors.push_back(errorInfo); };
+		preprocessorConfig.mOnIncludeCallback = context.mOnIncludeCallback; // \note Included files are already tokenized by the callback
+		preprocessorConfig.mSkipComments = mConfig.mSkipComments;
+		preprocessorConfig.mOnResolveIncludeCallback = mConfig.mOnResolveIncludeCallback;
+		preprocessorConfig.mMemoizeIncludedFiles = mConfig.mMemoizeIncludedFiles;
+		preprocessorConfig.mTrackMacroDependencies = trackMacroDependencies;
+
+		Preprocessor preprocessor(lexer, preprocessorConfig);
+
+		for (auto&& currDefine : defines)
 		{
-			int result = evalComparison();
+			TMacroDesc macroDesc;
+			macroDesc.mName = currDefine.first;
 
-			TToken currToken;
-			while ((currToken = tokens.front()).mType == E_TOKEN_TYPE::EQ || currToken.mType == E_TOKEN_TYPE::NE)
+			auto pValueTokens = lexer.Tokenize(std::make_unique<StringInputStream>(currDefine.second));
+
+			for (TToken currToken : pValueTokens->mTokens)
 			{
-				switch (currToken.mType)
+				if (E_TOKEN_TYPE::NEWLINE == currToken.mType || (E_TOKEN_TYPE::SPACE == currToken.mType && macroDesc.mValue.empty()))
 				{
-					case E_TOKEN_TYPE::EQ:
-						tokens.erase(tokens.cbegin());
-						result = result == evalComparison();
-						break;
-					case E_TOKEN_TYPE::NE:
-						tokens.erase(tokens.cbegin());
-						result = result != evalComparison();
-						break;
-					default:
-						break;
+					continue;
 				}
-			}
-
-			return result;
-		};
 
-		auto evalAndExpr = [&tokens, &evalEquality]()
-		{
-			int result = evalEquality();
+				if (E_TOKEN_TYPE::IDENTIFIER == currToken.mType && currToken.mRawView == macroDesc.mName)
+				{
+					currToken.mType = E_TOKEN_TYPE::BLOB; // \note Prevent self recursion like #define does
+				}
 
-			while (E_TOKEN_TYPE::SPACE == tokens.front().mType)
-			{ 
-				tokens.erase(tokens.cbegin());
+				macroDesc.mValue.push_back(std::move(currToken));
 			}
 
-			while (tokens.front().mType == E_TOKEN_TYPE::AND)
+			while (!macroDesc.mValue.empty() && E_TOKEN_TYPE::SPACE == macroDesc.mValue.back().mType)
 			{
-				tokens.erase(tokens.cbegin());
-				result = result && evalEquality();
+				macroDesc.mValue.pop_back();
 			}
 
-			return result;
-		};
-
-		auto evalOrExpr = [&tokens, &evalAndExpr]()
-		{
-			int result = evalAndExpr();
-			
-			while (tokens.front().mType == E_TOKEN_TYPE::OR)
+			if (macroDesc.mValue.empty())
 			{
-				tokens.erase(tokens.cbegin());
-				result = result || evalAndExpr();
+				macroDesc.mValue.push_back({ E_TOKEN_TYPE::NUMBER, "1", 0 });
+				macroDesc.mHasImplicitValue = true;
 			}
 
-			return result;
-		};
+			if (!preprocessor.AddMacro(macroDesc))
+			{
+				result.mErrors.push_back({ E_ERROR_TYPE::MACRO_ALREADY_DEFINED, 0 });
+			}
+		}
 
-		return evalOrExpr();
-	}
+		result.mOutput = preprocessor.Process();
+		result.mMacroDependencies = preprocessor.GetMacroDependencies();
 
-	bool Preprocessor::_shouldTokenBeSkipped() const TCPP_NOEXCEPT
-	{
-		return !mConditionalBlocksStack.empty() && (mConditionalBlocksStack.top().mShouldBeSkipped || !mConditionalBlocksStack.top().mIsParentBlockActive);
+		return result;
 	}
 
 #endif
-}
\ No newline at end of file
+}
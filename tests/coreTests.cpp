@@ -1031,4 +1031,1036 @@ TEST()
 		std::string output = preprocessor.Process();
 		REQUIRE((result && output == "int array[4];\n"));
 	}
+
+	SECTION("TestProcess_IncludeReturnsTokensStream_OutputIsSameAsForPlainStream")
+	{
+		const std::string inputSource = "#include <header>\n__LINE__ FOO\n";
+		const std::string headerSource = "#define FOO 42\n__LINE__\n/* multi\nline */ __LINE__\n";
+
+		auto process = [&inputSource, &headerSource](bool useTokensStream)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor preprocessor(lexer, { [](auto&&)
+			{
+				REQUIRE(false);
+			}, [&lexer, &headerSource, useTokensStream](auto&&, auto&&) -> TInputStreamUniquePtr
+			{
+				if (useTokensStream)
+				{
+					return std::make_unique<TokensInputStream>(lexer.Tokenize(std::make_unique<StringInputStream>(headerSource)));
+				}
+
+				return std::make_unique<StringInputStream>(headerSource);
+			} });
+
+			return preprocessor.Process();
+		};
+
+		const std::string expectedResult = process(false);
+
+		REQUIRE(expectedResult == "3\n/* multi\nline */ 5\n6 42\n");
+		REQUIRE(process(true) == expectedResult);
+	}
+
+	SECTION("TestProcess_PassSourceWithMixedWhitespaces_WhitespacesArePreservedAsIs")
+	{
+		std::string inputSource = "#define  FOO(X)\t \tX +\t1\n\t  int a = FOO( 2 )  \t;\nA \t## B";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "\t  int a = 2 +\t1  \t;\nAB");
+	}
+
+	SECTION("TestProcess_PassMacroNameWithinStringLiteral_LiteralIsNotChanged")
+	{
+		std::string inputSource = "#define FOO 42\n#define STR(X) X\nprintf(\"FOO \\\"FOO\\\"\", FOO, 'F', STR(\"(FOO, \"));";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "printf(\"FOO \\\"FOO\\\"\", 42, 'F', \"(FOO, \");");
+	}
+
+	SECTION("TestProcess_EnableSpeculativeLexing_OutputIsSameAndEachFileIsRequestedOnce")
+	{
+		const std::string inputSource = "#include <a.h>\nroot __LINE__\n#include \"b.h\"\n#if 0\n#include <c.h>\n#endif\n#include <a.h>\n";
+
+		const std::unordered_map<std::string, std::string> files
+		{
+			{ "a.h", "#include <c.h>\na __LINE__\n" },
+			{ "b.h", "#define B(X) X + X\nB(b)\n" },
+			{ "c.h", "c __LINE__\n" },
+		};
+
+		auto process = [&inputSource, &files](size_t workersCount, std::atomic<size_t>& requestsCount)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			bool result = true;
+
+			Preprocessor preprocessor(lexer, { [&result](auto&&)
+			{
+				result = false;
+			}, [&files, &requestsCount](const std::string& path, bool) -> TInputStreamUniquePtr
+			{
+				++requestsCount;
+				return std::make_unique<StringInputStream>(files.at(path));
+			}, false, nullptr, workersCount });
+
+			std::string output = preprocessor.Process();
+			REQUIRE(result);
+
+			return output;
+		};
+
+		std::atomic<size_t> plainRequestsCount { 0 };
+		std::atomic<size_t> speculativeRequestsCount { 0 };
+
+		REQUIRE(process(2, speculativeRequestsCount) == process(0, plainRequestsCount));
+		REQUIRE(plainRequestsCount == 5);
+		REQUIRE(speculativeRequestsCount == 3);
+	}
+
+	SECTION("TestProcess_PassSelfReferencingMacros_RecursiveExpansionIsSuppressed")
+	{
+		std::string inputSource = "#define A A + B\n#define B A\n#define F(X) G(X) + F(X)\n#define G(X) F(X)\nA\nF(1)\nF(F(2))";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "A + A\nF(1) + F(1)\nF(F(2) + F(2)) + F(F(2) + F(2))");
+	}
+
+	SECTION("TestProcess_PassInactiveBlocksWithInvalidDirectives_BlocksAreSkippedWithoutErrors")
+	{
+		const std::string inputSource = "#include <header>\nd __LINE__\n";
+		const std::string headerSource = 
+			"#if 0\n"
+			"#define BROKEN(\n"
+			"\"#endif\" /* #endif\n"
+			"#else */ // #endif\n"
+			"#if 1\n"
+			"#else\n"
+			"#endif\n"
+			"#elif 1\n"
+			"a __LINE__\n"
+			"#elif defined(\n"
+			"b\n"
+			"#else\n"
+			"c one#endif\n";
+
+		auto process = [&inputSource, &headerSource](bool useTokensStream)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor preprocessor(lexer, { [](auto&&)
+			{
+				REQUIRE(false);
+			}, [&lexer, &headerSource, useTokensStream](auto&&, auto&&) -> TInputStreamUniquePtr
+			{
+				if (useTokensStream)
+				{
+					return std::make_unique<TokensInputStream>(lexer.Tokenize(std::make_unique<StringInputStream>(headerSource)));
+				}
+
+				return std::make_unique<StringInputStream>(headerSource);
+			} });
+
+			return preprocessor.Process();
+		};
+
+		REQUIRE(process(false) == "a 10\n\nd 15\n");
+		REQUIRE(process(true) == "a 10\n\nd 15\n");
+	}
+
+	SECTION("TestProcess_PassInactiveBlocksWithConcatenatedDirectivesNames_NestedBlocksAreNotOpened")
+	{
+		Lexer lexer(std::make_unique<StringInputStream>(
+			"#if 0\n"
+			"#define CAT(a) a##if\n"
+			"#define CAT_SPACED(a) a ## ifdef_x\n"
+			"#endif\n"
+			"int x;\n"));
+		Preprocessor preprocessor(lexer, { errorCallback, nullptr });
+
+		REQUIRE(preprocessor.Process() == "\nint x;\n");
+	}
+
+	SECTION("TestProcess_ReplayNestedBlocksUnderDifferentMacros_OutputsMatchScannedSources")
+	{
+		const std::string headerSource = 
+			"#if A\n"
+			"#ifdef B\n"
+			"#if C > 1\nab2\n#elif C\nab1\n#else\nab0\n#endif\n"
+			"#endif\n"
+			"a\n"
+			"#elif defined(B) && C\n"
+			"#ifndef D\nbc\n#endif\n"
+			"#else\n"
+			"none __LINE__\n"
+			"#endif\n";
+
+		auto process = [&headerSource, &errorCallback](const std::string& defines, bool useTokensStream)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(defines + "#include <header>\n__LINE__\n"));
+
+			Preprocessor preprocessor(lexer, { errorCallback, [&lexer, &headerSource, useTokensStream](auto&&, auto&&) -> TInputStreamUniquePtr
+			{
+				if (useTokensStream)
+				{
+					return std::make_unique<TokensInputStream>(lexer.Tokenize(std::make_unique<StringInputStream>(headerSource)));
+				}
+
+				return std::make_unique<StringInputStream>(headerSource);
+			} });
+
+			return preprocessor.Process();
+		};
+
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const std::string defines = 
+				std::string((i & 1) ? "#define A\n" : "") + ((i & 2) ? "#define B\n" : "") + ((i & 4) ? "#define C 2\n" : "#define C 1\n") + ((i & 8) ? "#define D\n" : "");
+
+			REQUIRE(process(defines, true) == process(defines, false));
+		}
+	}
+
+	SECTION("TestProcess_TrackMacroDependencies_OnlyConsultedMacrosAreReported")
+	{
+		Lexer lexer(std::make_unique<StringInputStream>(
+			"#define USED 1\n#if A && B\nx\n#elif defined(C)\ny\n#else\n#ifdef D\nd\n#endif\nUSED\n#endif\n#include \"header\"\n"));
+
+		Preprocessor::TPreprocessorConfigInfo config { errorCallback, [](auto&&, auto&&) { return std::make_unique<StringInputStream>("#ifndef GUARD\nheader\n#endif\n"); } };
+		config.mTrackMacroDependencies = true;
+
+		Preprocessor preprocessor(lexer, config);
+		preprocessor.Process();
+
+		/// \note B isn't read because A is undefined, header is consulted as an identifier in active code
+		REQUIRE(preprocessor.GetMacroDependencies() == std::vector<std::string> { "A", "C", "D", "GUARD", "USED", "header" });
+
+		auto&& regions = preprocessor.GetConditionalRegions();
+		REQUIRE(regions.size() == 5);
+
+		REQUIRE((regions[0].mDirectiveType == E_TOKEN_TYPE::IF && regions[0].mLine == 2 && !regions[0].mIsActive));
+		REQUIRE(regions[0].mMacros == std::vector<std::string> { "A" });
+
+		REQUIRE((regions[1].mDirectiveType == E_TOKEN_TYPE::ELIF && !regions[1].mIsActive));
+		REQUIRE(regions[1].mMacros == std::vector<std::string> { "A", "C" });
+
+		REQUIRE((regions[2].mDirectiveType == E_TOKEN_TYPE::ELSE && regions[2].mIsActive));
+		REQUIRE(regions[2].mMacros == std::vector<std::string> { "A", "C" });
+
+		REQUIRE((regions[3].mDirectiveType == E_TOKEN_TYPE::IFDEF && regions[3].mLine == 7 && !regions[3].mIsActive));
+		REQUIRE(regions[3].mMacros == std::vector<std::string> { "A", "C", "D" });
+
+		REQUIRE((regions[4].mDirectiveType == E_TOKEN_TYPE::IFNDEF && regions[4].mLine == 1 && !regions[4].mFileId.empty() && regions[4].mIsActive));
+		REQUIRE(regions[4].mMacros == std::vector<std::string> { "GUARD" });
+	}
+
+	SECTION("TestProcess_TrackMacroDependenciesOfReplayedFiles_RegionsAreSameAsWithoutMemoization")
+	{
+		auto process = [&errorCallback](bool memoizeIncludedFiles, std::vector<Preprocessor::TConditionalRegionInfo>& regions)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>("#define B\n#define C\n#ifdef B\n#include \"header\"\n#endif\n#ifdef C\n#include \"header\"\n#endif\n"));
+
+			Preprocessor::TPreprocessorConfigInfo config { errorCallback, [](auto&&, auto&&) { return std::make_unique<StringInputStream>("#ifdef A\na\n#else\nb\n#endif\n"); } };
+			config.mMemoizeIncludedFiles = memoizeIncludedFiles;
+			config.mTrackMacroDependencies = true;
+
+			Preprocessor preprocessor(lexer, config);
+			const std::string output = preprocessor.Process();
+
+			regions = preprocessor.GetConditionalRegions();
+			REQUIRE(preprocessor.GetIncludedFilesCacheStats().mHitsCount == (memoizeIncludedFiles ? 1 : 0));
+
+			return output;
+		};
+
+		std::vector<Preprocessor::TConditionalRegionInfo> expectedRegions;
+		std::vector<Preprocessor::TConditionalRegionInfo> regions;
+
+		REQUIRE(process(true, regions) == process(false, expectedRegions));
+		REQUIRE(regions.size() == 6);
+		REQUIRE(regions.size() == expectedRegions.size());
+
+		for (size_t i = 0; i < regions.size(); ++i)
+		{
+			REQUIRE(regions[i].mFileId == expectedRegions[i].mFileId);
+			REQUIRE(regions[i].mLine == expectedRegions[i].mLine);
+			REQUIRE(regions[i].mDirectiveType == expectedRegions[i].mDirectiveType);
+			REQUIRE(regions[i].mMacros == expectedRegions[i].mMacros);
+			REQUIRE(regions[i].mIsActive == expectedRegions[i].mIsActive);
+		}
+
+		/// \note The replayed branches depend on the block which encloses the second directive
+		REQUIRE(regions[4].mMacros == std::vector<std::string> { "A", "C" });
+		REQUIRE(regions[5].mMacros == std::vector<std::string> { "A", "C" });
+	}
+
+	SECTION("TestFork_ProcessPreludeOnceAndBranch_ForksAreIndependent")
+	{
+		uint32_t openingsCount = 0;
+
+		auto onIncludeCallback = [&openingsCount](auto&&, auto&&) -> TInputStreamUniquePtr
+		{
+			++openingsCount;
+			return std::make_unique<StringInputStream>("#ifndef COMMON_H\n#define COMMON_H\n#define SCALE(x) (x * FACTOR)\n#endif\n");
+		};
+
+		Lexer preludeLexer(std::make_unique<StringInputStream>("#include \"common\"\n#define FACTOR 2\n#if FACTOR > 1\n#endif\n"));
+
+		Preprocessor preludePreprocessor(preludeLexer, { errorCallback, onIncludeCallback });
+		preludePreprocessor.Process();
+
+		Lexer firstLexer(std::make_unique<StringInputStream>("#include \"common\"\n#undef FACTOR\n#define FACTOR 3\nSCALE(1)\n"));
+		auto pFirstFork = preludePreprocessor.Fork(firstLexer);
+
+		Lexer secondLexer(std::make_unique<StringInputStream>("#if FACTOR > 1\nSCALE(1)\n#endif\n"));
+		auto pSecondFork = preludePreprocessor.Fork(secondLexer);
+
+		REQUIRE(pFirstFork->Process() == "\n(1 * 3)\n");
+		REQUIRE(pSecondFork->Process() == "(1 * 2)\n\n");
+
+		REQUIRE(openingsCount == 1); // \note The guard is inherited by forks
+		REQUIRE(pSecondFork->GetConditionsCacheStats().mHitsCount == 1);
+
+		auto&& macros = preludePreprocessor.GetSymbolsTable();
+
+		auto factorIt = std::find_if(macros.cbegin(), macros.cend(), [](auto&& macro) { return macro.mName == "FACTOR"; });
+		REQUIRE((factorIt != macros.cend() && factorIt->mValue.front().mRawView == "2"));
+
+		Lexer thirdLexer(std::make_unique<StringInputStream>("#define EXTRA\n"));
+		auto pThirdFork = pFirstFork->Fork(thirdLexer);
+		pThirdFork->Process();
+
+		REQUIRE(ContainsMacro(*pThirdFork, "EXTRA"));
+		REQUIRE(!ContainsMacro(*pFirstFork, "EXTRA"));
+		REQUIRE(!ContainsMacro(preludePreprocessor, "EXTRA"));
+	}
+
+	SECTION("TestFork_ForkTwiceOntoSameLexer_CustomDirectivesAreHandledByBothForks")
+	{
+		Lexer preludeLexer(std::make_unique<StringInputStream>("#define VALUE 1\n"));
+
+		Preprocessor preludePreprocessor(preludeLexer, { errorCallback, nullptr });
+		REQUIRE(preludePreprocessor.AddCustomDirectiveHandler("version", [](Preprocessor&, Lexer&, const std::string&) { return std::string("v"); }));
+		preludePreprocessor.Process();
+
+		Lexer lexer(std::make_unique<StringInputStream>("#version 450\nVALUE\n"));
+
+		auto pFirstFork = preludePreprocessor.Fork(lexer);
+		auto pSecondFork = preludePreprocessor.Fork(lexer); // \note The lexer knows the directive already
+
+		REQUIRE(pSecondFork->Process() == "v 450\n1\n");
+	}
+
+	SECTION("TestPermutationsProcessor_PassFewDefinesSets_OutputsMatchSeparateProcessing")
+	{
+		const std::string source = "#include \"common\"\n#if QUALITY > 1\nhigh SCALE\n#else\nlow __LINE__\n#endif\n#ifdef SHADOWS\n#include <shadows>\n#endif\n";
+
+		std::mutex openingsMutex;
+		std::unordered_map<std::string, uint32_t> openingsCount;
+
+		auto onIncludeCallback = [&openingsMutex, &openingsCount](const std::string& path, bool) -> TInputStreamUniquePtr
+		{
+			{
+				std::lock_guard<std::mutex> lock(openingsMutex);
+				++openingsCount[path];
+			}
+
+			if (path == "common")
+			{
+				return std::make_unique<StringInputStream>("#define SCALE (QUALITY * 2)\ncommon\n");
+			}
+
+			return (path == "shadows") ? std::make_unique<StringInputStream>("shadows SCALE\n") : nullptr;
+		};
+
+		std::vector<PermutationsProcessor::TDefinesSet> definesSets;
+
+		for (uint32_t i = 0; i < 8; ++i)
+		{
+			PermutationsProcessor::TDefinesSet defines { { "QUALITY", std::to_string(i % 4) } };
+
+			if (i & 4)
+			{
+				defines.push_back({ "SHADOWS", "" });
+			}
+
+			definesSets.push_back(defines);
+		}
+
+		PermutationsProcessor::TPermutationsConfigInfo config { onIncludeCallback, false, 4 };
+		config.mTrackMacroDependencies = true;
+
+		PermutationsProcessor permutationsProcessor(config);
+
+		auto results = permutationsProcessor.Process(source, definesSets);
+		REQUIRE(results.size() == definesSets.size());
+
+		REQUIRE(openingsCount["common"] == 1);
+		REQUIRE(openingsCount["shadows"] == 1);
+
+		for (size_t i = 0; i < definesSets.size(); ++i)
+		{
+			REQUIRE(results[i].mErrors.empty());
+
+			Lexer lexer(std::make_unique<StringInputStream>(source));
+			Preprocessor preprocessor(lexer, { errorCallback, onIncludeCallback });
+
+			for (auto&& currDefine : definesSets[i])
+			{
+				Lexer valueLexer(std::make_unique<StringInputStream>(currDefine.second.empty() ? "1" : currDefine.second));
+				REQUIRE(preprocessor.AddMacro({ currDefine.first, {}, { valueLexer.GetNextToken() } }));
+			}
+
+			REQUIRE(results[i].mOutput == preprocessor.Process());
+		}
+
+		REQUIRE(results[1].mMacroDependencies == std::vector<std::string> { "QUALITY", "SCALE", "SHADOWS", "common", "low" });
+
+		REQUIRE(results[3].mOutput == "common\nhigh (3 * 2)\n\n\n");
+		REQUIRE(results[6].mOutput == "common\nhigh (2 * 2)\n\nshadows (2 * 2)\n\n");
+	}
+
+	SECTION("TestPermutationsProcessor_ExploreFeatures_AllCombinationsAreCoveredWithFewerPasses")
+	{
+		const std::string source = "#ifdef SHADOWS\n#if QUALITY > 1\nsoft\n#else\nhard\n#endif\n#endif\n#if FOG\nfog\n#endif\nend\n";
+
+		const std::vector<PermutationsProcessor::TFeatureMacro> features
+		{
+			{ "SHADOWS", { "", "1" } },
+			{ "QUALITY", { "0", "1", "2" } },
+			{ "FOG", { "0", "1" } },
+			{ "UNUSED", { "", "1", "2" } },
+		};
+
+		PermutationsProcessor permutationsProcessor(PermutationsProcessor::TPermutationsConfigInfo { {}, false, 2 });
+
+		auto result = permutationsProcessor.Explore(source, features);
+		REQUIRE(result.mPassesCount == 8);
+		REQUIRE(result.mOutputs.size() == 6);
+
+		for (size_t i = 0; i < 36; ++i)
+		{
+			const std::vector<size_t> combination { i % 2, (i / 2) % 3, (i / 6) % 2, i / 12 };
+
+			Lexer lexer(std::make_unique<StringInputStream>(source));
+			Preprocessor preprocessor(lexer, { errorCallback });
+
+			for (size_t j = 0; j < features.size(); ++j)
+			{
+				const std::string& value = features[j].mValues[combination[j]];
+				if (!value.empty())
+				{
+					REQUIRE(preprocessor.AddMacro({ features[j].mName, {}, { { E_TOKEN_TYPE::NUMBER, value, 0 } } }));
+				}
+			}
+
+			const size_t outputIndex = PermutationsProcessor::FindOutputIndex(result, combination);
+			REQUIRE(outputIndex < result.mOutputs.size());
+			REQUIRE(result.mOutputs[outputIndex] == preprocessor.Process());
+		}
+	}
+
+	SECTION("TestPermutationsProcessor_PassRedefinedMacro_ErrorIsReported")
+	{
+		PermutationsProcessor permutationsProcessor(PermutationsProcessor::TPermutationsConfigInfo {});
+
+		auto results = permutationsProcessor.Process("__LINE__\n", { { { "__LINE__", "42" } } });
+		REQUIRE(results.size() == 1);
+		REQUIRE(results[0].mErrors.size() == 1);
+		REQUIRE(results[0].mErrors[0].mType == E_ERROR_TYPE::MACRO_ALREADY_DEFINED);
+	}
+
+	SECTION("TestProcess_PassConditionsWithAllOperators_ConditionsAreEvaluatedWithCPrecedence")
+	{
+		const std::vector<std::string> conditions
+		{
+			"(1 + 2) * 3 == 9",
+			"1 + 2 * 3 == 7",
+			"-2 - -3 == 1 && +1",
+			"~0 == -1 && (6 ^ 3) == 5 && (6 & 3) == 2 && (6 | 3) == 7",
+			"17 % 5 == 2 && 1 << 4 == 16 && 256 >> 4 == 16",
+			"0x1F == 31 && 010 == 8 && 42ul == 42 && 'A' == 65 && '\\n' == 10",
+			"1 ? 0 ? 5 : 6 : 7",
+			"TWO > ONE && defined ONE && defined(TWO) && !defined THREE",
+			"SUM(ONE, TWO) == 3 && MAX(TWO, 5) == 5",
+			"!(0 && BROKEN(1, 2, 3))",
+			"1 || BROKEN(1, 2, 3)",
+			"SELF == 0",
+			"9223372036854775807 + 1 < 0",
+		};
+
+		std::string inputSource = "#define ONE 1\n#define TWO (ONE + ONE)\n#define SUM(X, Y) ((X) + (Y))\n#define MAX(X, Y) ((X) > (Y) ? (X) : (Y))\n"
+			"#define BROKEN(X) X\n#define SELF SELF\n";
+
+		std::string expectedResult;
+
+		for (size_t i = 0; i < conditions.size(); ++i)
+		{
+			inputSource.append("#if " + conditions[i] + "\n" + std::to_string(i) + "\n#else\nfailed\n#endif\n");
+			expectedResult.append(std::to_string(i) + "\n\n");
+		}
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == expectedResult);
+	}
+
+	SECTION("TestProcess_PassConditionsWithNonPrimaryMacros_MacrosTokensAreSubstitutedIntoConditions")
+	{
+		const std::vector<std::string> conditions
+		{
+			"1 OP 1",
+			"EMPTY 1",
+			"F(1) * 2 == 3",
+			"!(0 && 1 OP) && (1 ? 2 OP 2 : 0)",
+		};
+
+		std::string inputSource = "#define OP ==\n#define EMPTY\n#define F(a) a + 1\n";
+		std::string expectedResult;
+
+		for (size_t i = 0; i < conditions.size(); ++i)
+		{
+			inputSource.append("#if " + conditions[i] + "\n" + std::to_string(i) + "\n#else\nfailed\n#endif\n");
+			expectedResult.append(std::to_string(i) + "\n\n");
+		}
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == expectedResult);
+	}
+
+	SECTION("TestProcess_PassMalformedCondition_ProcessingErrorOccurs")
+	{
+		std::string inputSource = "#if (1 + \nfailed\n#endif\n";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		bool result = false;
+
+		Preprocessor preprocessor(lexer, { [&result](auto&& arg)
+		{
+			result = arg.mType == E_ERROR_TYPE::UNEXPECTED_TOKEN;
+		} });
+
+		REQUIRE(preprocessor.Process() == "\n");
+		REQUIRE(result);
+	}
+
+	SECTION("TestProcess_PassSameConditionsFewTimes_ResultsAreReusedUntilMacrosChange")
+	{
+		const std::string condition = "#if defined(PLATFORM) && LEVEL >= 3\nyes\n#else\nno\n#endif\n";
+		const std::string lineCondition = "#if __LINE__ > 20\nlate\n#endif\n";
+
+		std::string inputSource = "#define PLATFORM\n#define LEVEL 3\n" + condition + condition + lineCondition + 
+			"#undef LEVEL\n#define LEVEL 2\n" + condition + condition + lineCondition;
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "yes\n\nyes\n\n\n\nno\n\n\nno\n\nlate\n\n");
+
+		const TCacheStats stats = preprocessor.GetConditionsCacheStats();
+		REQUIRE(stats.mHitsCount == 2);
+		REQUIRE(stats.mMissesCount == 4);
+	}
+
+	SECTION("TestProcess_PassArgumentsNamedAsParameters_EachParameterIsSubstitutedOnce")
+	{
+		std::string inputSource = "#define F(X, Y) X + Y + X\n#define STR(A, B) #A A ## B\nF(Y, 2)\nSTR(a, b)";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "Y + 2 + Y\n\"a\" ab");
+
+		const auto& symTable = preprocessor.GetSymbolsTable();
+
+		auto it = std::find_if(symTable.cbegin(), symTable.cend(), [](auto&& macroDesc) { return macroDesc.mName == "STR"; });
+		REQUIRE(it != symTable.cend());
+
+		/// \note #A A ## B is split into the operator, a slot, a space, a slot, spaces with the operator and a slot
+		const std::vector<TMacroBodyChunk>& chunks = it->mBodyChunks;
+		REQUIRE(chunks.size() == 6);
+		REQUIRE((!chunks[1].mTokensCount && chunks[1].mArgIndex == 0 && chunks[1].mIsStringized && !chunks[1].mIsConcatenated));
+		REQUIRE((!chunks[3].mTokensCount && chunks[3].mArgIndex == 0 && !chunks[3].mIsStringized && chunks[3].mIsConcatenated));
+		REQUIRE((!chunks[5].mTokensCount && chunks[5].mArgIndex == 1 && chunks[5].mIsConcatenated));
+	}
+
+	SECTION("TestProcess_PassSameMacroInvocationsFewTimes_ExpansionsAreReusedUntilMacroChanges")
+	{
+		std::string inputSource = "#define ONE 1\n#define PACK(A, B) ((A) << 1 | (B))\nPACK(0, ONE)\nPACK(0, ONE)\n#undef ONE\n#define ONE 2\nPACK(0, ONE) __LINE__\nONE";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "((0) << 1 | (1))\n((0) << 1 | (1))\n((0) << 1 | (2)) 7\n2");
+
+		/// \note PACK depends on ONE through its pre-expanded argument, so it's reused only before the redefinition
+		const TCacheStats stats = preprocessor.GetExpansionsCacheStats();
+		REQUIRE(stats.mHitsCount == 2);
+		REQUIRE(stats.mMissesCount == 4);
+	}
+
+	SECTION("TestProcess_ExceedExpansionsCacheCapacity_LeastRecentlyUsedExpansionsAreEvicted")
+	{
+		std::string inputSource = "#define A 1\n#define B 2\n#define C 3\nA B A C A B";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor::TPreprocessorConfigInfo config;
+		config.mOnErrorCallback = errorCallback;
+		config.mExpansionsCacheCapacity = 2;
+
+		Preprocessor preprocessor(lexer, config);
+		REQUIRE(preprocessor.Process() == "1 2 1 3 1 2");
+
+		/// \note C evicts B, because A has been reused after B was stored
+		const TCacheStats stats = preprocessor.GetExpansionsCacheStats();
+		REQUIRE(stats.mHitsCount == 2);
+		REQUIRE(stats.mMissesCount == 4);
+	}
+
+	SECTION("TestProcess_PassExpansionWhichArgumentsContinueInSource_ArgumentsAreReadAcrossExpansionFrames")
+	{
+		std::string inputSource = "#define B 1\n#define OPEN(x) ADD(x\n#define ADD(x, y) x + y\n#define CAT B ## C\nOPEN(B), 2)\nCAT";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "1 + 2\nBC");
+	}
+
+	SECTION("TestProcess_PassMultiTokenArguments_ArgumentsTokensAreRescanned")
+	{
+		std::string inputSource = "#define TWO 2\n#define ID(x) x\n#define STR(x) #x\n#define LIST(first, ...) first: __VA_ARGS__\nID(TWO + TWO)\nSTR(TWO + TWO)\nLIST(TWO, ID(1), TWO)";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "2 + 2\n\"TWO + TWO\"\n2: 1,2");
+	}
+
+	SECTION("TestProcess_PassArgumentUsedFewTimes_ArgumentIsPreExpandedOnce")
+	{
+		std::string inputSource = "#define X 1\n#define MAX(a, b) ((a) > (b) ? (a) : (b))\n#define STR(a) #a a\n#define CAT(a) a ## _suffix a\nMAX(X, X + 1)\nSTR(X)\nCAT(X)";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "((1) > (1 + 1) ? (1) : (1 + 1))\n\"X\" 1\nX_suffix 1");
+
+		/// \note MAX, STR and CAT are missed, X is expanded once per argument and then its result is reused
+		const TCacheStats stats = preprocessor.GetExpansionsCacheStats();
+		REQUIRE(stats.mMissesCount == 4);
+		REQUIRE(stats.mHitsCount == 3);
+	}
+
+	SECTION("TestProcess_PassGuardedHeadersFewTimes_HeadersAreReopenedOnlyWhenGuardsAreUndefined")
+	{
+		const std::string inputSource = 
+			"#include \"guarded\"\n#include \"once\"\n#include \"plain\"\n"
+			"#include \"guarded\"\n#include \"once\"\n#include \"plain\"\n"
+			"#undef GUARDED_H\n#include \"guarded\"\n#pragma pack(1)\n";
+
+		const std::unordered_map<std::string, std::string> headers
+		{
+			{ "guarded", "// comment\n#ifndef GUARDED_H\n#define GUARDED_H\nguarded\n#endif\n" },
+			{ "once", "#pragma once\nonce\n" },
+			{ "plain", "#ifndef PLAIN_H\n#define PLAIN_H\n#endif\nplain\n" },
+		};
+
+		std::unordered_map<std::string, uint32_t> openingsCount;
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { errorCallback, [&headers, &openingsCount](const std::string& path, bool)
+		{
+			++openingsCount[path];
+			return std::make_unique<StringInputStream>(headers.at(path));
+		}, true });
+
+		REQUIRE(preprocessor.Process() == "\nguarded\n\nonce\n\nplain\n\n\n\nplain\n\nguarded\n\n#pragma pack(1)\n");
+
+		REQUIRE(openingsCount["guarded"] == 2);
+		REQUIRE(openingsCount["once"] == 1);
+		REQUIRE(openingsCount["plain"] == 2);
+	}
+
+	SECTION("TestProcess_SkipGuardedHeaders_OutputAndLinesMatchProcessingWithoutSkipping")
+	{
+		const std::string inputSource =
+			"#include \"guarded\"\n#include \"guarded\"\n__LINE__\n"
+			"#include \"outer\"\n#include \"outer\"\n__LINE__\n#endif\n";
+
+		const std::unordered_map<std::string, std::string> headers
+		{
+			{ "guarded", "\n\n#ifndef G_H\n#define G_H\nint g;\n#endif\n\n\n" },
+			{ "outer", " \t#ifndef OUTER_H\n#define OUTER_H\n#include \"guarded\"\nint outer;\n#endif  \r\n" },
+		};
+
+		auto process = [&inputSource, &headers](bool isSkippingEnabled)
+		{
+			uint32_t openingsCount = 0;
+			std::vector<size_t> errorsLines;
+
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor::TPreprocessorConfigInfo config;
+			config.mOnErrorCallback = [&errorsLines](const TErrorInfo& errorInfo) { errorsLines.push_back(errorInfo.mLine); };
+			config.mOnIncludeCallback = [&headers, &openingsCount](const std::string& path, bool)
+			{
+				++openingsCount;
+				return std::make_unique<StringInputStream>(headers.at(path));
+			};
+
+			if (!isSkippingEnabled)
+			{
+				config.mOnResolveIncludeCallback = [](auto&&, auto&&) { return std::string(); };
+			}
+
+			Preprocessor preprocessor(lexer, config);
+			const std::string output = preprocessor.Process();
+
+			return std::make_tuple(output, errorsLines, openingsCount);
+		};
+
+		const auto skippedResult = process(true);
+		const auto processedResult = process(false);
+
+		REQUIRE(std::get<std::string>(skippedResult) == std::get<std::string>(processedResult));
+		REQUIRE(std::get<std::vector<size_t>>(skippedResult) == std::get<std::vector<size_t>>(processedResult));
+		REQUIRE(std::get<std::vector<size_t>>(skippedResult).size() == 1);
+
+		REQUIRE(std::get<uint32_t>(skippedResult) == 2);
+		REQUIRE(std::get<uint32_t>(processedResult) == 5);
+	}
+
+	SECTION("TestProcess_PassPragmasWithDifferentLineTerminators_TerminatorsArePreserved")
+	{
+		Lexer lexer(std::make_unique<StringInputStream>("#pragma  pack(1)\r\nx\r\n#pragma pack(2)"));
+
+		Preprocessor preprocessor(lexer, { errorCallback });
+		REQUIRE(preprocessor.Process() == "#pragma  pack(1)\r\nx\r\n#pragma pack(2)");
+	}
+
+	SECTION("TestProcess_IncludeFilesWithSameMacrosFewTimes_OutputsAreReplayed")
+	{
+		const std::string inputSource = 
+			"#define COLOR(X) X,\n#include \"colors\"\n#include \"colors\"\n"
+			"#undef COLOR\n#define COLOR(X) #X;\n#include \"colors\"\n#include \"outer\"\n#include \"outer\"\n"
+			"#define STEP 1\n#include \"step\"\nSTEP\n#include \"step\"\nSTEP\n#include \"step\"\nSTEP\n"
+			"#include \"line\"\n#include \"line\"\n";
+
+		const std::unordered_map<std::string, std::string> headers
+		{
+			{ "colors", "COLOR(red) COLOR(green)\n" },
+			{ "outer", "#include \"colors\"\n" },
+			{ "step", "#if STEP == 1\n#undef STEP\n#define STEP 2\n#else\n#undef STEP\n#define STEP 1\n#endif\n" },
+			{ "line", "__LINE__\n" },
+		};
+
+		auto process = [&](bool memoizeIncludedFiles, std::unordered_map<std::string, uint32_t>& openingsCount, TCacheStats& stats)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor preprocessor(lexer, { errorCallback, [&headers, &openingsCount](const std::string& path, bool)
+			{
+				++openingsCount[path];
+				return std::make_unique<StringInputStream>(headers.at(path));
+			}, false, nullptr, 0, {}, nullptr, memoizeIncludedFiles });
+
+			const std::string output = preprocessor.Process();
+			stats = preprocessor.GetIncludedFilesCacheStats();
+
+			return output;
+		};
+
+		std::unordered_map<std::string, uint32_t> memoizedOpeningsCount;
+		TCacheStats memoizedStats;
+
+		const std::string memoizedOutput = process(true, memoizedOpeningsCount, memoizedStats);
+
+		std::unordered_map<std::string, uint32_t> plainOpeningsCount;
+		TCacheStats plainStats;
+
+		const std::string plainOutput = process(false, plainOpeningsCount, plainStats);
+
+		REQUIRE(memoizedOutput == plainOutput);
+
+		REQUIRE(memoizedOpeningsCount["colors"] == 2);
+		REQUIRE(memoizedOpeningsCount["outer"] == 1);
+		REQUIRE(memoizedOpeningsCount["step"] == 2);
+		REQUIRE(memoizedOpeningsCount["line"] == 2);
+
+		REQUIRE(memoizedStats.mHitsCount == 4);
+		REQUIRE(memoizedStats.mMissesCount == 7);
+
+		REQUIRE(plainOpeningsCount["colors"] == 5);
+		REQUIRE(plainOpeningsCount["outer"] == 2);
+		REQUIRE(plainOpeningsCount["step"] == 3);
+		REQUIRE(plainOpeningsCount["line"] == 2);
+
+		REQUIRE(plainStats.mHitsCount == 0);
+		REQUIRE(plainStats.mMissesCount == 0);
+	}
+
+	SECTION("TestProcess_PassSameSourceWithOutputCache_OutputIsReusedUntilHeaderChanges")
+	{
+		const std::string inputSource = "#define VALUE 1\n#include \"header\"\nVALUE HEADER_MACRO\n";
+
+		std::unordered_map<std::string, std::string> headers
+		{
+			{ "header", "#define HEADER_MACRO 42\nheader\n" },
+		};
+
+		auto pOutputCache = std::make_shared<OutputCache>(1 << 20);
+
+		auto process = [&]()
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor preprocessor(lexer, { errorCallback, [&headers](const std::string& path, bool)
+			{
+				return std::make_unique<StringInputStream>(headers.at(path));
+			}, false, nullptr, 0, {}, pOutputCache });
+
+			const std::string output = preprocessor.Process();
+
+			const auto macros = preprocessor.GetSymbolsTable();
+			REQUIRE(std::find_if(macros.cbegin(), macros.cend(), [](auto&& macro) { return macro.mName == "HEADER_MACRO"; }) != macros.cend());
+
+			return output;
+		};
+
+		REQUIRE(process() == "header\n1 42\n");
+		REQUIRE(process() == "header\n1 42\n");
+
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 1);
+
+		headers["header"] = "#define HEADER_MACRO 24\nheader\n";
+		REQUIRE(process() == "header\n1 24\n");
+
+		const TCacheStats stats = pOutputCache->GetStats();
+		REQUIRE(stats.mHitsCount == 1);
+		REQUIRE(stats.mMissesCount == 2);
+	}
+
+	SECTION("TestProcess_OutputCacheHitOnReusedPreprocessor_UnchangedMacrosKeepCachedConditions")
+	{
+		const std::string cachedSource = "#if A\ncached\n#endif\n";
+
+		auto pOutputCache = std::make_shared<OutputCache>(1 << 20);
+
+		Preprocessor::TPreprocessorConfigInfo config;
+		config.mOnErrorCallback = errorCallback;
+		config.mpOutputCache = pOutputCache;
+
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(cachedSource));
+
+			Preprocessor preprocessor(lexer, config);
+			REQUIRE(preprocessor.AddMacro({ "A", {}, { { E_TOKEN_TYPE::NUMBER, "1" } } }));
+			REQUIRE(preprocessor.Process() == "cached\n\n");
+		}
+
+		Lexer lexer(std::make_unique<StringInputStream>("#if A\nfirst\n#endif\n"));
+
+		Preprocessor preprocessor(lexer, config);
+		REQUIRE(preprocessor.AddMacro({ "A", {}, { { E_TOKEN_TYPE::NUMBER, "1" } } }));
+		REQUIRE(preprocessor.Process() == "first\n\n");
+
+		lexer.PushStream(std::make_unique<StringInputStream>(cachedSource));
+		REQUIRE(preprocessor.Process() == "cached\n\n");
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 1);
+
+		/// \note The hit hasn't redefined A, so its condition is still valid
+		lexer.PushStream(std::make_unique<StringInputStream>("#if A\nlast\n#endif\n"));
+		REQUIRE(preprocessor.Process() == "last\n\n");
+		REQUIRE(preprocessor.GetConditionsCacheStats().mHitsCount == 1);
+	}
+
+	SECTION("TestProcess_OutputCacheHitWithTrackedDependencies_DependenciesAndRegionsAreRestored")
+	{
+		const std::string cachedSource = "#ifdef A\na\n#endif\n#include \"header\"\n";
+
+		auto pOutputCache = std::make_shared<OutputCache>(1 << 20);
+
+		Preprocessor::TPreprocessorConfigInfo config { errorCallback, [](auto&&, auto&&) { return std::make_unique<StringInputStream>("#ifndef GUARD\nheader\n#endif\n"); } };
+		config.mTrackMacroDependencies = true;
+		config.mpOutputCache = pOutputCache;
+
+		std::vector<std::string> expectedDependencies;
+		std::vector<Preprocessor::TConditionalRegionInfo> expectedRegions;
+
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(cachedSource));
+
+			Preprocessor preprocessor(lexer, config);
+			preprocessor.Process();
+
+			expectedDependencies = preprocessor.GetMacroDependencies();
+			expectedRegions = preprocessor.GetConditionalRegions();
+		}
+
+		REQUIRE(expectedDependencies == std::vector<std::string> { "A", "GUARD", "header" });
+		REQUIRE(expectedRegions.size() == 2);
+
+		/// \note The preprocessor has tracked another source before the hit, so stale results would be visible
+		Lexer lexer(std::make_unique<StringInputStream>("#if B\nb\n#endif\n"));
+
+		Preprocessor preprocessor(lexer, config);
+		preprocessor.Process();
+
+		lexer.PushStream(std::make_unique<StringInputStream>(cachedSource));
+		preprocessor.Process();
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 1);
+
+		REQUIRE(preprocessor.GetMacroDependencies() == expectedDependencies);
+
+		auto&& regions = preprocessor.GetConditionalRegions();
+		REQUIRE(regions.size() == expectedRegions.size());
+
+		for (size_t i = 0; i < regions.size(); ++i)
+		{
+			REQUIRE(regions[i].mFileId == expectedRegions[i].mFileId);
+			REQUIRE(regions[i].mLine == expectedRegions[i].mLine);
+			REQUIRE(regions[i].mDirectiveType == expectedRegions[i].mDirectiveType);
+			REQUIRE(regions[i].mMacros == expectedRegions[i].mMacros);
+			REQUIRE(regions[i].mIsActive == expectedRegions[i].mIsActive);
+		}
+	}
+
+	SECTION("TestProcess_UseOutputCacheWithSpeculativeLexing_HeadersAreRequestedOncePerProcessing")
+	{
+		const std::string inputSource = "#include \"first\"\n#include \"second\"\n";
+
+		const std::unordered_map<std::string, std::string> headers
+		{
+			{ "first", "first\n#include \"second\"\n" },
+			{ "second", "second\n" },
+		};
+
+		auto pOutputCache = std::make_shared<OutputCache>(1 << 20);
+
+		std::mutex openingsMutex;
+		std::unordered_map<std::string, uint32_t> openingsCount;
+
+		auto process = [&]()
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor::TPreprocessorConfigInfo config;
+			config.mOnErrorCallback = errorCallback;
+			config.mOnIncludeCallback = [&](const std::string& path, bool)
+			{
+				std::lock_guard<std::mutex> lock(openingsMutex);
+				++openingsCount[path];
+
+				return std::make_unique<StringInputStream>(headers.at(path));
+			};
+			config.mSpeculativeLexingWorkersCount = 2;
+			config.mpOutputCache = pOutputCache;
+
+			Preprocessor preprocessor(lexer, config);
+			return preprocessor.Process();
+		};
+
+		REQUIRE(process() == "first\nsecond\nsecond\n");
+		REQUIRE(openingsCount["first"] == 1);
+		REQUIRE(openingsCount["second"] == 1);
+
+		/// \note A hit reads every file of the manifest to validate the entry
+		REQUIRE(process() == "first\nsecond\nsecond\n");
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 1);
+		REQUIRE(openingsCount["first"] == 2);
+		REQUIRE(openingsCount["second"] == 3);
+	}
+
+	SECTION("TestProcess_PassStringizeOperatorOutsideOfMacro_ProcessingErrorOccurs")
+	{
+		std::string inputSource = "#define STR(X) #X\nSTR(a)\n#b";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		bool result = false;
+
+		Preprocessor preprocessor(lexer, { [&result](auto&& arg)
+		{
+			result = arg.mType == E_ERROR_TYPE::INCORRECT_OPERATION_USAGE;
+		} });
+
+		preprocessor.Process();
+		REQUIRE(result);
+	}
+}
+
+
+TEST_CASE("SymbolsTable Tests")
+{
+	SECTION("TestAddRemove_ManyMacros_LookupsAreConsistent")
+	{
+		SymbolsTable symTable;
+
+		const size_t macrosCount = 5000;
+
+		for (size_t i = 0; i < macrosCount; ++i)
+		{
+			REQUIRE(symTable.Add({ "MACRO_" + std::to_string(i) }));
+		}
+
+		REQUIRE(!symTable.Add({ "MACRO_42" }));
+		REQUIRE(symTable.GetMacros().size() == macrosCount);
+
+		for (size_t i = 0; i < macrosCount; i += 2)
+		{
+			REQUIRE(symTable.Remove("MACRO_" + std::to_string(i)));
+		}
+
+		REQUIRE(!symTable.Remove("MACRO_0"));
+		REQUIRE(symTable.GetMacros().size() == macrosCount / 2);
+
+		for (size_t i = 0; i < macrosCount; ++i)
+		{
+			const std::string macroName = "MACRO_" + std::to_string(i);
+			const TMacroDesc* pMacroDesc = symTable.Find(macroName);
+
+			REQUIRE((pMacroDesc != nullptr) == (i % 2 == 1));
+			REQUIRE((!pMacroDesc || pMacroDesc->mName == macroName));
+		}
+
+		const std::string view = "MACRO_1)";
+		REQUIRE(symTable.Find(view.data(), view.length() - 1));
+		REQUIRE(!symTable.Find("identifier"));
+	}
+
+	SECTION("TestCopy_ChangeOriginalAndCopy_TablesAreIndependent")
+	{
+		SymbolsTable symTable;
+		REQUIRE(symTable.Add({ "SHARED" }));
+		REQUIRE(symTable.Add({ "REMOVED" }));
+
+		SymbolsTable copiedSymTable = symTable;
+		const TMacroDesc* pSharedMacroDesc = symTable.Find("SHARED");
+
+		REQUIRE(copiedSymTable.Remove("REMOVED"));
+		REQUIRE(copiedSymTable.Add({ "ADDED" }));
+
+		REQUIRE(symTable.Find("SHARED") == pSharedMacroDesc); // \note The original state isn't copied
+		REQUIRE(symTable.Contains("REMOVED"));
+		REQUIRE(!symTable.Contains("ADDED"));
+		REQUIRE(symTable.GetVersion("ADDED") == 0);
+
+		REQUIRE(copiedSymTable.Contains("SHARED"));
+		REQUIRE(!copiedSymTable.Contains("REMOVED"));
+		REQUIRE(copiedSymTable.Contains("ADDED"));
+	}
 }
@@ -46,14 +46,36 @@ TEST_CASE("Lexer Tests")
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
 	}
 
-	SECTION("TestGetNextToken_PassStreamWithWhitespacesLines_ReturnsAllSPACEandENDTokens")
+	SECTION("TestGetNextToken_PassStreamWithWhitespacesLines_ReturnsSingleSPACETokenPerRunAndENDToken")
 	{
 		Lexer lexer(std::make_unique<MockInputStream>(std::vector<std::string> { "    ", "  \t " }));
 
-		for (size_t i = 0; i < 8; i++)
-		{
-			REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
-		}
+		TToken currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::SPACE && currToken.mRawView == "    "));
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::SPACE && currToken.mRawView == "  \t "));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
+	}
+
+	SECTION("TestGetNextToken_PassIndentedLine_WhitespacesRunIsStoppedByNewline")
+	{
+		Lexer lexer(std::make_unique<MockInputStream>(std::vector<std::string> { "\t\t  return 0;  \r\n" }));
+
+		TToken currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::SPACE && currToken.mRawView == "\t\t  "));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::KEYWORD);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::NUMBER);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SEMICOLON);
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::SPACE && currToken.mRawView == "  "));
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::NEWLINE && currToken.mRawView == "\r\n"));
 
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
 	}
@@ -307,12 +329,7 @@ TEST_CASE("Lexer Tests")
 		Lexer lexer(std::make_unique<MockInputStream>(std::vector<std::string> { "AAA   ## BB" }));
 
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::IDENTIFIER);
-
-		for (short i = 0; i < 3; ++i)
-		{
-			REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
-		}
-
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::CONCAT_OP);
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::IDENTIFIER);
@@ -359,4 +376,71 @@ TEST_CASE("Lexer Tests")
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::NEWLINE);
 		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
 	}
-}
\ No newline at end of file
+
+	SECTION("TestGetNextToken_PassStringAndCharLiterals_ReturnsSingleTokenPerLiteral")
+	{
+		Lexer lexer(std::make_unique<MockInputStream>(std::vector<std::string> { "\"FOO \\\"bar\\\" // baz\" 'c' '\\''" }));
+
+		TToken currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::STRING_LITERAL && currToken.mRawView == "\"FOO \\\"bar\\\" // baz\""));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::CHAR_LITERAL && currToken.mRawView == "'c'"));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::SPACE);
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::CHAR_LITERAL && currToken.mRawView == "'\\''"));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
+	}
+
+	SECTION("TestGetNextToken_PassConditionalExpressionOperators_ReturnsCorrectTokensSequence")
+	{
+		Lexer lexer(std::make_unique<MockInputStream>(std::vector<std::string> { "0x1Fu%a^~b?c:0UL" }));
+
+		TToken currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::NUMBER && currToken.mRawView == "0x1Fu"));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::PERCENT);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::IDENTIFIER);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::CARET);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::TILDE);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::IDENTIFIER);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::QUESTION);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::IDENTIFIER);
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::COLON);
+
+		currToken = lexer.GetNextToken();
+		REQUIRE((currToken.mType == E_TOKEN_TYPE::NUMBER && currToken.mRawView == "0UL"));
+
+		REQUIRE(lexer.GetNextToken().mType == E_TOKEN_TYPE::END);
+	}
+
+	SECTION("TestTokenize_PassNestedConditionalBlocks_SkeletonPointsToNextBranches")
+	{
+		Lexer lexer(std::make_unique<StringInputStream>(""));
+
+		auto pTokensBuffer = lexer.Tokenize(std::make_unique<StringInputStream>(
+			"#if A\n#ifdef B\nb\n#endif\na\n#elif C\nc\n#else\nd\n#endif\n#endif\n"));
+
+		const std::vector<TConditionalDirectiveInfo>& directives = pTokensBuffer->mConditionalDirectives;
+		REQUIRE(directives.size() == 7);
+
+		/// \note Indices of directives which end blocks after #if A, #ifdef B, #endif, #elif C, #else, #endif and the unbalanced #endif
+		const std::vector<size_t> expectedNextDirectives { 3, 2, 3, 4, 5, 6, 7 };
+
+		for (size_t i = 0; i < directives.size(); ++i)
+		{
+			const size_t expectedTokenIndex = (expectedNextDirectives[i] < directives.size()) ? directives[expectedNextDirectives[i]].mTokenIndex : pTokensBuffer->mTokens.size();
+			REQUIRE(directives[i].mNextBranchTokenIndex == expectedTokenIndex);
+		}
+
+		REQUIRE(directives[0].mpCondition);
+		REQUIRE(!directives[1].mpCondition);
+		REQUIRE(directives[3].mpCondition);
+		REQUIRE(!directives[4].mpCondition);
+	}
+}
@@ -0,0 +1,428 @@
+#include <catch2/catch.hpp>
+#include "tcppLibrary.hpp"
+#include <string>
+#include <fstream>
+
+using namespace tcpp;
+
+
+static const std::string TestCacheDirectory = "tcpp_tokens_cache";
+
+
+TEST_CASE("LRUCache Tests")
+{
+	LRUCache<std::string, int> cache(2);
+
+	SECTION("TestInsert_ExceedCapacity_LeastRecentlyUsedEntryIsEvicted")
+	{
+		REQUIRE(cache.Insert("first", 1, 1));
+		REQUIRE(cache.Insert("second", 2, 1));
+
+		REQUIRE(*cache.Find("first") == 1);
+		REQUIRE(cache.Insert("third", 3, 1));
+
+		REQUIRE(cache.Peek("first"));
+		REQUIRE(!cache.Peek("second"));
+		REQUIRE(cache.GetSize() == 2);
+	}
+
+	SECTION("TestInsert_PassTooLargeEntry_CacheIsntChanged")
+	{
+		REQUIRE(cache.Insert("first", 1, 1));
+		REQUIRE(!cache.Insert("first", 2, 3));
+
+		REQUIRE(*cache.Peek("first") == 1);
+	}
+
+	SECTION("TestCopy_ChangeCopy_SourceIsntChanged")
+	{
+		REQUIRE(cache.Insert("first", 1, 1));
+
+		LRUCache<std::string, int> copy(cache);
+		REQUIRE(copy.Insert("second", 2, 1));
+		REQUIRE(copy.Remove("first"));
+
+		REQUIRE(cache.Peek("first"));
+		REQUIRE(!cache.Peek("second"));
+		REQUIRE(copy.GetEntriesCount() == 1);
+	}
+}
+
+
+TEST_CASE("DiskTokensCache Tests")
+{
+	Lexer lexer(std::make_unique<StringInputStream>(""));
+
+	DiskTokensCache cache(TestCacheDirectory, 1 << 20);
+	cache.Clear();
+
+	SECTION("TestGetTokens_PassSameSourceTwice_SecondCallReplaysStoredTokens")
+	{
+		const std::string source = "#define FOO(X) X\nint foo = FOO(42); // comment\n";
+
+		auto pExpectedTokens = lexer.Tokenize(std::make_unique<StringInputStream>(source));
+		auto pTokens = cache.GetTokens(source, lexer);
+
+		REQUIRE(cache.GetSize() > 0);
+
+		auto pLoadedTokens = cache.Load(DiskTokensCache::ComputeKey(source, lexer));
+		REQUIRE(pLoadedTokens);
+		REQUIRE(pLoadedTokens->mLinesCount == pExpectedTokens->mLinesCount);
+		REQUIRE(pLoadedTokens->mTokens.size() == pExpectedTokens->mTokens.size());
+
+		for (size_t i = 0; i < pExpectedTokens->mTokens.size(); ++i)
+		{
+			REQUIRE(pLoadedTokens->mTokens[i].mType == pExpectedTokens->mTokens[i].mType);
+			REQUIRE(pLoadedTokens->mTokens[i].mRawView == pExpectedTokens->mTokens[i].mRawView);
+			REQUIRE(pLoadedTokens->mTokens[i].mLineId == pExpectedTokens->mTokens[i].mLineId);
+		}
+	}
+
+	SECTION("TestLoad_PassCorruptedEntry_EntryIsRejectedAndRemoved")
+	{
+		const std::string source = "int x = 42;\n";
+		const uint64_t key = DiskTokensCache::ComputeKey(source, lexer);
+
+		cache.GetTokens(source, lexer);
+
+		char hexKey[17];
+		snprintf(hexKey, sizeof(hexKey), "%016llx", static_cast<unsigned long long>(key));
+
+		const std::string entryPath = TestCacheDirectory + "/" + hexKey + ".tcpptok";
+
+		{
+			std::fstream file(entryPath, std::ios::binary | std::ios::in | std::ios::out);
+			REQUIRE(file.is_open());
+
+			file.seekp(-1, std::ios::end);
+			file.put('#');
+		}
+
+		REQUIRE(!cache.Load(key));
+		REQUIRE(!std::ifstream(entryPath).is_open());
+	}
+
+	SECTION("TestStore_ExceedSizeLimit_OldEntriesAreEvicted")
+	{
+		DiskTokensCache smallCache(TestCacheDirectory, 512);
+
+		for (int i = 0; i < 16; ++i)
+		{
+			smallCache.GetTokens("int value" + std::to_string(i) + " = " + std::to_string(i) + ";\n", lexer);
+		}
+
+		REQUIRE(smallCache.GetSize() <= 512);
+	}
+
+	SECTION("TestStore_OverwriteExistingEntry_SizeIsCountedOnce")
+	{
+		const std::string source = "int x = 42;\n";
+		const uint64_t key = DiskTokensCache::ComputeKey(source, lexer);
+
+		auto pTokens = lexer.Tokenize(std::make_unique<StringInputStream>(source));
+
+		REQUIRE(cache.Store(key, *pTokens));
+		const size_t size = cache.GetSize();
+
+		REQUIRE(cache.Store(key, *pTokens));
+		REQUIRE(cache.GetSize() == size);
+	}
+
+	SECTION("TestGetTokens_DifferentLexerConfigs_ProduceDifferentKeys")
+	{
+		Lexer customLexer(std::make_unique<StringInputStream>(""));
+		customLexer.AddCustomDirective("version");
+
+		REQUIRE(DiskTokensCache::ComputeKey("#version 450\n", lexer) != DiskTokensCache::ComputeKey("#version 450\n", customLexer));
+	}
+
+	cache.Clear();
+}
+
+
+TEST_CASE("DiskOutputCache Tests")
+{
+	const std::string key = "00112233445566778899aabbccddeeff";
+
+	auto pDiskCache = std::make_shared<DiskOutputCache>(TestCacheDirectory, 1 << 20);
+	pDiskCache->Clear();
+
+	OutputCache::TOutputEntry entry;
+	entry.mIncludes.push_back({ "header.h", true, 42 });
+	entry.mMacros.push_back({ "ADD", { "X", "Y" }, { { E_TOKEN_TYPE::IDENTIFIER, "X", 1, 0 }, { E_TOKEN_TYPE::PLUS, "+", 1, 1 }, { E_TOKEN_TYPE::IDENTIFIER, "Y", 1, 2 } } });
+	entry.mOutput = "int x = 1 + 2;\n";
+	entry.mMacroDependencies = { "ADD", "FOO" };
+	entry.mConditionalRegions.push_back({ "header.h", 3, E_TOKEN_TYPE::IFDEF, { "FOO" }, true });
+
+	SECTION("TestLoad_PassStoredEntry_EntryIsRestored")
+	{
+		REQUIRE(!pDiskCache->Load(key));
+		REQUIRE(pDiskCache->Store(key, entry));
+
+		auto pLoadedEntry = pDiskCache->Load(key);
+		REQUIRE(pLoadedEntry);
+		REQUIRE(pLoadedEntry->mOutput == entry.mOutput);
+
+		REQUIRE(pLoadedEntry->mIncludes.size() == 1);
+		REQUIRE(pLoadedEntry->mIncludes[0].mPath == "header.h");
+		REQUIRE(pLoadedEntry->mIncludes[0].mIsSystemPathInclusion);
+		REQUIRE(pLoadedEntry->mIncludes[0].mContentHash == 42);
+
+		REQUIRE(pLoadedEntry->mMacros.size() == 1);
+		REQUIRE(pLoadedEntry->mMacros[0].mName == "ADD");
+		REQUIRE(pLoadedEntry->mMacros[0].mArgsNames == entry.mMacros[0].mArgsNames);
+		REQUIRE(pLoadedEntry->mMacros[0].mValue.size() == 3);
+		REQUIRE(pLoadedEntry->mMacros[0].mValue[1].mRawView == "+");
+		REQUIRE(!pLoadedEntry->mMacros[0].mBodyChunks.empty());
+
+		REQUIRE(pLoadedEntry->mMacroDependencies == entry.mMacroDependencies);
+
+		REQUIRE(pLoadedEntry->mConditionalRegions.size() == 1);
+		REQUIRE(pLoadedEntry->mConditionalRegions[0].mFileId == "header.h");
+		REQUIRE(pLoadedEntry->mConditionalRegions[0].mLine == 3);
+		REQUIRE(pLoadedEntry->mConditionalRegions[0].mDirectiveType == E_TOKEN_TYPE::IFDEF);
+		REQUIRE(pLoadedEntry->mConditionalRegions[0].mMacros == entry.mConditionalRegions[0].mMacros);
+		REQUIRE(pLoadedEntry->mConditionalRegions[0].mIsActive);
+
+		const TCacheStats stats = pDiskCache->GetStats();
+		REQUIRE(stats.mHitsCount == 1);
+		REQUIRE(stats.mMissesCount == 1);
+	}
+
+	SECTION("TestLoad_PassCorruptedEntry_EntryIsRejectedAndRemoved")
+	{
+		REQUIRE(pDiskCache->Store(key, entry));
+
+		const std::string entryPath = TestCacheDirectory + "/" + key + ".tcppout";
+
+		{
+			std::fstream file(entryPath, std::ios::binary | std::ios::in | std::ios::out);
+			REQUIRE(file.is_open());
+
+			file.seekp(-1, std::ios::end);
+			file.put('#');
+		}
+
+		REQUIRE(!pDiskCache->Load(key));
+		REQUIRE(!std::ifstream(entryPath).is_open());
+	}
+
+	SECTION("TestStore_ExceedSizeLimit_OldEntriesAreEvicted")
+	{
+		DiskOutputCache smallCache(TestCacheDirectory, 512);
+
+		for (int i = 0; i < 16; ++i)
+		{
+			smallCache.Store(key + std::to_string(i), entry);
+		}
+
+		REQUIRE(smallCache.GetSize() <= 512);
+	}
+
+	SECTION("TestStore_OverwriteExistingEntry_SizeIsCountedOnce")
+	{
+		REQUIRE(pDiskCache->Store(key, entry));
+		const size_t size = pDiskCache->GetSize();
+
+		REQUIRE(pDiskCache->Store(key, entry));
+		REQUIRE(pDiskCache->GetSize() == size);
+	}
+
+	SECTION("TestConstructor_DirectoryExceedsSizeLimit_OldEntriesAreEvicted")
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			pDiskCache->Store(key + std::to_string(i), entry);
+		}
+
+		REQUIRE(pDiskCache->GetSize() > 512);
+		REQUIRE(DiskOutputCache(TestCacheDirectory, 512).GetSize() <= 512);
+	}
+
+	SECTION("TestProcess_UseDiskCacheAfterRestart_OutputIsLoadedFromDisk")
+	{
+		const std::string headerContent = "#define HEADER_MACRO 42\n";
+
+		auto process = [&headerContent](const std::shared_ptr<OutputCache>& pOutputCache)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>("#include <header>\nHEADER_MACRO\n"));
+
+			Preprocessor preprocessor(lexer, { [](auto&&) { REQUIRE(false); }, [&headerContent](const std::string&, bool)
+			{
+				return std::make_unique<StringInputStream>(headerContent);
+			}, false, nullptr, 0, {}, pOutputCache });
+
+			return preprocessor.Process();
+		};
+
+		const std::string expectedOutput = process(std::make_shared<OutputCache>(1 << 20, pDiskCache));
+
+		/// \note A fresh in-memory cache emulates a restart of the process
+		auto pOutputCache = std::make_shared<OutputCache>(1 << 20, std::make_shared<DiskOutputCache>(TestCacheDirectory, 1 << 20));
+		REQUIRE(process(pOutputCache) == expectedOutput);
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 1);
+
+		REQUIRE(process(pOutputCache) == expectedOutput);
+		REQUIRE(pOutputCache->GetStats().mHitsCount == 2);
+	}
+
+	pDiskCache->Clear();
+}
+
+
+TEST_CASE("TokensCache Tests")
+{
+	Lexer lexer(std::make_unique<StringInputStream>(""));
+
+	SECTION("TestGetTokens_PassSameFileIdentityTwice_StreamIsRequestedOnlyOnce")
+	{
+		TokensCache cache(1 << 20);
+
+		size_t requestsCount = 0;
+
+		auto streamFactory = [&requestsCount]
+		{
+			++requestsCount;
+			return std::make_unique<StringInputStream>("int x = 42;\n");
+		};
+
+		auto pFirstTokens = cache.GetTokens("include/header.h", lexer, streamFactory);
+		auto pSecondTokens = cache.GetTokens("include/header.h", lexer, streamFactory);
+
+		REQUIRE(pFirstTokens == pSecondTokens);
+		REQUIRE(requestsCount == 1);
+		REQUIRE(cache.GetStats().mHitsCount == 1);
+		REQUIRE(cache.GetStats().mMissesCount == 1);
+
+		cache.Invalidate("include/header.h", lexer);
+		cache.GetTokens("include/header.h", lexer, streamFactory);
+
+		REQUIRE(requestsCount == 2);
+	}
+
+	SECTION("TestGetTokens_ExceedMemoryBudget_LeastRecentlyUsedEntriesAreEvicted")
+	{
+		const std::string firstSource = "int first = 1;\n";
+		const std::string secondSource = "int second = 2;\n";
+		const std::string thirdSource = "int third = 3;\n";
+
+		const size_t budget = 2 * lexer.Tokenize(std::make_unique<StringInputStream>(secondSource))->mTokens.capacity() * sizeof(TToken) + 512;
+
+		TokensCache cache(budget);
+
+		cache.GetTokens(firstSource, lexer);
+		cache.GetTokens(secondSource, lexer);
+		cache.GetTokens(firstSource, lexer); // \note the second source becomes the least recently used one
+		cache.GetTokens(thirdSource, lexer);
+
+		REQUIRE(cache.GetSize() <= budget);
+
+		const size_t hitsCount = cache.GetStats().mHitsCount;
+
+		cache.GetTokens(firstSource, lexer);
+		REQUIRE(cache.GetStats().mHitsCount == hitsCount + 1);
+
+		cache.GetTokens(secondSource, lexer);
+		REQUIRE(cache.GetStats().mHitsCount == hitsCount + 1);
+	}
+
+	SECTION("TestProcess_IncludeSameHeaderFewTimes_HeaderIsScannedOnlyOnce")
+	{
+		const std::string inputSource = "#define X(name) int name;\n#include \"list.h\"\n#undef X\n#define X(name) #name,\n#include \"list.h\"\n#include \"list.h\"\n";
+		const std::string headerSource = "X(first)\nX(second)\n";
+
+		auto process = [&inputSource, &headerSource](std::shared_ptr<TokensCache> pCache)
+		{
+			Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+			Preprocessor preprocessor(lexer, { [](auto&&)
+			{
+				REQUIRE(false);
+			}, [&headerSource](auto&&, auto&&)
+			{
+				return std::make_unique<StringInputStream>(headerSource);
+			}, false, pCache });
+
+			return preprocessor.Process();
+		};
+
+		auto pCache = std::make_shared<TokensCache>(1 << 20);
+
+		REQUIRE(process(pCache) == process(nullptr));
+		REQUIRE(pCache->GetStats().mMissesCount == 1);
+		REQUIRE(pCache->GetStats().mHitsCount == 2);
+	}
+}
+
+
+TEST_CASE("IncludeContentCache Tests")
+{
+	const std::string headerPath = "tcpp_include_content_cache_header.h";
+
+	auto writeFile = [&headerPath](const std::string& content)
+	{
+		std::ofstream file(headerPath, std::ios::binary | std::ios::trunc);
+		file << content;
+	};
+
+	writeFile("#define VALUE 1\nVALUE\n");
+
+	SECTION("TestGetContent_PassSameFileTwice_ContentIsSharedUntilFileChanges")
+	{
+		IncludeContentCache cache(1 << 20, 4);
+
+		auto pFirstContent = cache.GetContent(headerPath);
+		auto pSecondContent = cache.GetContent(headerPath);
+
+		REQUIRE(pFirstContent);
+		REQUIRE(pFirstContent == pSecondContent);
+		REQUIRE(cache.GetStats().mHitsCount == 1);
+		REQUIRE(cache.GetStats().mMissesCount == 1);
+
+		writeFile("#define VALUE 42\nVALUE\n");
+
+		auto pUpdatedContent = cache.GetContent(headerPath);
+		REQUIRE(*pUpdatedContent == "#define VALUE 42\nVALUE\n");
+		REQUIRE(cache.GetSize() == pUpdatedContent->length());
+
+		cache.Invalidate(headerPath);
+		REQUIRE(cache.GetContent(headerPath) != pUpdatedContent);
+		REQUIRE(!cache.GetContent("tcpp_missing_header.h"));
+	}
+
+	SECTION("TestOpenStream_IncludeCachedFileFewTimes_FileIsReadOnce")
+	{
+		IncludeContentCache cache(1 << 20);
+
+		const std::string inputSource = "#include \"" + headerPath + "\"\n#undef VALUE\n#include \"" + headerPath + "\"\n";
+
+		Lexer lexer(std::make_unique<StringInputStream>(inputSource));
+
+		Preprocessor preprocessor(lexer, { [](auto&&)
+		{
+			REQUIRE(false);
+		}, [&cache](const std::string& path, bool)
+		{
+			return cache.OpenStream(path);
+		} });
+
+		REQUIRE(preprocessor.Process() == "1\n1\n");
+		REQUIRE(cache.GetStats().mMissesCount == 1);
+		REQUIRE(cache.GetStats().mHitsCount == 1);
+	}
+
+	SECTION("TestGetContent_ExceedMemoryBudget_ContentIsReturnedWithoutStoring")
+	{
+		IncludeContentCache cache(16, 1); // \note Only small files fit into the budget
+
+		cache.GetContent(headerPath);
+		REQUIRE(cache.GetSize() == 0);
+
+		writeFile("VALUE\n");
+		cache.GetContent(headerPath);
+
+		REQUIRE(cache.GetSize() == 6);
+	}
+
+	std::remove(headerPath.c_str());
+}